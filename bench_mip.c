@@ -0,0 +1,137 @@
+#include "mip.h"
+#include "ethernet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Number of frames decoded in each round.
+ */
+#define BENCH_FRAMES 4096
+
+/**
+ * Number of rounds for each decoder.
+ */
+#define BENCH_ROUNDS 2000
+
+/**
+ * Store a checksum of every decoded header, so the compiler cannot drop the work.
+ */
+volatile uint32_t benchSink;
+
+/**
+ * Get the current time of the monotonic clock.
+ * Return:
+ *      The time in nanoseconds.
+ */
+uint64_t bench_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Decode every header with the original one field per call functions.
+ * Input:
+ *      headers - Pointers to the packet headers.
+ * Return:
+ *      A checksum of the decoded fields.
+ */
+uint32_t bench_getters(char **headers) {
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        sum += (mip_is_transport(headers[i]) << 2) | (mip_is_routing(headers[i]) << 1) | mip_is_arp(headers[i]);
+        sum += mip_get_dest(headers[i]) + mip_get_src(headers[i]) + mip_get_payload_length(headers[i]);
+    }
+    return sum;
+}
+
+/**
+ * Decode every header with the single load decoder.
+ * Input:
+ *      headers - Pointers to the packet headers.
+ * Return:
+ *      A checksum of the decoded fields.
+ */
+uint32_t bench_decode(char **headers) {
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        struct mip_header header;
+        mip_decode(headers[i], &header);
+        sum += header.type + header.destination + header.source + header.length;
+    }
+    return sum;
+}
+
+/**
+ * Decode every header with the batch decoder.
+ * Input:
+ *      headers - Pointers to the packet headers.
+ *      decoded - Room for every decoded header.
+ * Return:
+ *      A checksum of the decoded fields.
+ */
+uint32_t bench_decode_batch(char **headers, struct mip_header *decoded) {
+    uint32_t sum = 0;
+    int i;
+    mip_decode_batch(headers, decoded, BENCH_FRAMES);
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        sum += decoded[i].type + decoded[i].destination + decoded[i].source + decoded[i].length;
+    }
+    return sum;
+}
+
+/**
+ * Main method. Prints the time per header of each decoder.
+ */
+int main(int argc, char *argv[]) {
+    // Frames of the largest size, so the headers are spread over memory like in a receive batch.
+    size_t frameSize = MAX_PACKET_SIZE + sizeof(struct ethernet_frame);
+    char *frames = malloc((size_t)BENCH_FRAMES * frameSize);
+    char **headers = malloc(BENCH_FRAMES * sizeof(char *));
+    struct mip_header *decoded = malloc(BENCH_FRAMES * sizeof(struct mip_header));
+    if (!frames || !headers || !decoded) {
+        perror("main: malloc()");
+        exit(EXIT_FAILURE);
+    }
+
+    srand(1);
+    int i;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        headers[i] = frames + (size_t)i * frameSize + sizeof(struct ethernet_frame);
+        int type = rand() % 3;
+        mip_build_header(type == 0, 0, type == 1, rand() & 0xFF, rand() & 0xFF, rand() % 374, headers[i]);
+    }
+
+    // Every decoder must agree with the original functions.
+    if (bench_getters(headers) != bench_decode(headers) || bench_decode(headers) != bench_decode_batch(headers, decoded)) {
+        printf("Decoders disagree.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *names[] = {"mip_get_*()", "mip_decode()", "mip_decode_batch()"};
+    int variant;
+    for (variant = 0; variant < 3; variant++) {
+        uint64_t start = bench_now();
+        int round;
+        for (round = 0; round < BENCH_ROUNDS; round++) {
+            if (variant == 0) {
+                benchSink = bench_getters(headers);
+            } else if (variant == 1) {
+                benchSink = bench_decode(headers);
+            } else {
+                benchSink = bench_decode_batch(headers, decoded);
+            }
+        }
+        uint64_t elapsed = bench_now() - start;
+        printf("%-20s %6.2f ns/header\n", names[variant], (double)elapsed / ((double)BENCH_FRAMES * BENCH_ROUNDS));
+    }
+
+    free(decoded);
+    free(headers);
+    free(frames);
+    return EXIT_SUCCESS;
+}
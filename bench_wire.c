@@ -0,0 +1,380 @@
+#include "ethernet.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNTAX "Syntax: %s [-h] [-N daemons] [-n count] [-w window] [-s size] [-D delay_us] [-L loss_percent]\n"
+
+/**
+ * Max number of daemons on the wire.
+ */
+#define WIRE_MAX_PORTS 16
+
+/**
+ * Max number of delayed frames in flight towards a single daemon. More are dropped, like a full queue.
+ */
+#define WIRE_QUEUE_SIZE 4096
+
+/**
+ * Max size of a frame on the wire.
+ */
+#define WIRE_FRAME_SIZE (MAX_PACKET_SIZE + sizeof(struct ethernet_frame))
+
+/**
+ * A frame on its way to a daemon, held back for the delay of the wire.
+ */
+struct wire_frame {
+    uint64_t releaseAt; // When the frame is delivered, in nanoseconds of the monotonic clock.
+    size_t length;
+    char data[WIRE_FRAME_SIZE];
+};
+
+/**
+ * The wire end of the link of a single daemon.
+ */
+struct wire_port {
+    int fd; // Our end of the socketpair.
+    int head; // Ring buffer of delayed frames towards the daemon.
+    int count;
+    struct wire_frame *queue;
+};
+
+/**
+ * Store the settings and counters of the wire.
+ */
+struct wire_port wirePorts[WIRE_MAX_PORTS];
+int wirePortCount = 2;
+uint64_t setting_delay = 0; // In nanoseconds.
+double setting_loss = 0; // In percent.
+uint64_t wireForwarded = 0;
+uint64_t wireLost = 0;
+uint64_t wireOverflow = 0;
+
+/**
+ * Get the current time of the monotonic clock.
+ * Return:
+ *      The time in nanoseconds.
+ */
+uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Start a program with a file descriptor kept open for it. Every other descriptor of ours is closed on exec.
+ * Input:
+ *      argv - The program and its arguments.
+ *      keepFd - The descriptor to keep, or -1.
+ *      quiet - Whether to send its output to /dev/null.
+ * Return:
+ *      The process id.
+ */
+pid_t spawn(char *argv[], int keepFd, char quiet) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("spawn: fork()");
+        exit(EXIT_FAILURE);
+    }
+    if (pid) {
+        return pid;
+    }
+
+    if (keepFd != -1) {
+        fcntl(keepFd, F_SETFD, 0);
+    }
+    if (quiet) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    execv(argv[0], argv);
+    perror("spawn: execv()");
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * Wait until a UNIX socket file exists.
+ * Input:
+ *      path - The path of the socket.
+ * Return:
+ *      0 if it exists, -1 if it did not show up within 5 seconds.
+ */
+int wait_for_socket(char *path) {
+    int i;
+    for (i = 0; i < 500; i++) {
+        struct stat info;
+        if (!stat(path, &info) && S_ISSOCK(info.st_mode)) {
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+/**
+ * Deliver a frame to a daemon now.
+ * Input:
+ *      port - The port of the daemon.
+ *      data - The frame.
+ *      length - Length of the frame.
+ */
+void wire_deliver(struct wire_port *port, char *data, size_t length) {
+    if (send(port->fd, data, length, MSG_DONTWAIT) == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+            perror("wire_deliver: send()");
+            exit(EXIT_FAILURE);
+        }
+        wireOverflow++; // The daemon is not keeping up.
+        return;
+    }
+    wireForwarded++;
+}
+
+/**
+ * Put a frame from one daemon on the wire, towards every other daemon. Like a hub.
+ * Input:
+ *      from - The index of the port the frame came from.
+ *      data - The frame.
+ *      length - Length of the frame.
+ *      now - The current time, in nanoseconds.
+ */
+void wire_forward(int from, char *data, size_t length, uint64_t now) {
+    int i;
+    for (i = 0; i < wirePortCount; i++) {
+        if (i == from) {
+            continue;
+        }
+        if (setting_loss > 0 && rand() < setting_loss / 100.0 * RAND_MAX) {
+            wireLost++;
+            continue;
+        }
+
+        struct wire_port *port = &wirePorts[i];
+        if (!setting_delay) {
+            wire_deliver(port, data, length);
+            continue;
+        }
+        if (port->count == WIRE_QUEUE_SIZE) {
+            wireOverflow++;
+            continue;
+        }
+        // The delay is the same for every frame, so the queue stays sorted by release time.
+        struct wire_frame *frame = &port->queue[(port->head + port->count) % WIRE_QUEUE_SIZE];
+        frame->releaseAt = now + setting_delay;
+        frame->length = length;
+        memcpy(frame->data, data, length);
+        port->count++;
+    }
+}
+
+/**
+ * Deliver every delayed frame that is due.
+ * Input:
+ *      now - The current time, in nanoseconds.
+ * Return:
+ *      The release time of the next delayed frame, or 0 if none are waiting.
+ */
+uint64_t wire_release(uint64_t now) {
+    uint64_t next = 0;
+    int i;
+    for (i = 0; i < wirePortCount; i++) {
+        struct wire_port *port = &wirePorts[i];
+        while (port->count && port->queue[port->head].releaseAt <= now) {
+            wire_deliver(port, port->queue[port->head].data, port->queue[port->head].length);
+            port->head = (port->head + 1) % WIRE_QUEUE_SIZE;
+            port->count--;
+        }
+        if (port->count && (!next || port->queue[port->head].releaseAt < next)) {
+            next = port->queue[port->head].releaseAt;
+        }
+    }
+    return next;
+}
+
+/**
+ * Run an end to end benchmark over the emulated wire: Start a daemon per port, an echo server on the last
+ * one, and a load test from the first one to it. Needs no privileges.
+ */
+int main(int argc, char *argv[]) {
+    char *count = "100000";
+    char *window = "32";
+    char *size = "64";
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h")) {
+            printf(SYNTAX, argv[0]);
+            printf("-h: Show help and exit.\n");
+            printf("-N: Number of daemons on the wire, 2 to %d. Default 2.\n", WIRE_MAX_PORTS);
+            printf("-n: Number of pings. Default 100000.\n");
+            printf("-w: Max number of pings waiting for a reply. Default 32.\n");
+            printf("-s: Size of each payload in bytes. Default 64.\n");
+            printf("-D: One way delay of the wire in microseconds. Default 0.\n");
+            printf("-L: Percentage of frames lost on the wire. Default 0.\n");
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "-N") && i + 1 < argc) {
+            wirePortCount = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = argv[++i];
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            window = argv[++i];
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            size = argv[++i];
+        } else if (!strcmp(argv[i], "-D") && i + 1 < argc) {
+            setting_delay = (uint64_t)atoll(argv[++i]) * 1000;
+        } else if (!strcmp(argv[i], "-L") && i + 1 < argc) {
+            setting_loss = atof(argv[++i]);
+        } else {
+            printf(SYNTAX, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (wirePortCount < 2 || wirePortCount > WIRE_MAX_PORTS) {
+        printf(SYNTAX, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The other programs are expected next to this one.
+    char *binDir = dirname(strdup(argv[0]));
+    char daemonPath[4096], serverPath[4096], clientPath[4096];
+    snprintf(daemonPath, sizeof(daemonPath), "%s/mip_daemon", binDir);
+    snprintf(serverPath, sizeof(serverPath), "%s/ping_server", binDir);
+    snprintf(clientPath, sizeof(clientPath), "%s/ping_client", binDir);
+
+    int epoll_fd = epoll_create(10);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || timer_fd == -1) {
+        perror("main: epoll_create()");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = WIRE_MAX_PORTS;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    // A socketpair and a daemon for every port. MIP addresses are 1 to N.
+    pid_t daemons[WIRE_MAX_PORTS];
+    char sockPaths[WIRE_MAX_PORTS][108];
+    for (i = 0; i < wirePortCount; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, pair) == -1) {
+            perror("main: socketpair()");
+            exit(EXIT_FAILURE);
+        }
+        // Room for a good burst of frames in each direction.
+        int bufferSize = 4 << 20;
+        setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+        setsockopt(pair[0], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+        setsockopt(pair[1], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+        setsockopt(pair[1], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+        wirePorts[i].fd = pair[0];
+        wirePorts[i].queue = malloc(WIRE_QUEUE_SIZE * sizeof(struct wire_frame));
+        if (!wirePorts[i].queue) {
+            perror("main: malloc()");
+            exit(EXIT_FAILURE);
+        }
+        ev.data.u32 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pair[0], &ev);
+
+        char link[32], mip[8];
+        snprintf(link, sizeof(link), "emu:%d", pair[1]);
+        snprintf(mip, sizeof(mip), "%d", i + 1);
+        snprintf(sockPaths[i], sizeof(sockPaths[i]), "/tmp/bench_wire_%d_%d.sock", getpid(), i + 1);
+        char *daemonArgs[] = {daemonPath, "-l", link, sockPaths[i], mip, NULL};
+        daemons[i] = spawn(daemonArgs, pair[1], 1);
+        close(pair[1]);
+    }
+    for (i = 0; i < wirePortCount; i++) {
+        if (wait_for_socket(sockPaths[i]) == -1) {
+            printf("Daemon %d did not start.\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char *serverArgs[] = {serverPath, "-e", "-i", "3600", sockPaths[wirePortCount - 1], NULL};
+    pid_t server = spawn(serverArgs, -1, 1);
+    usleep(200000); // Let the server start listening.
+
+    char destination[8];
+    snprintf(destination, sizeof(destination), "%d", wirePortCount);
+    char *clientArgs[] = {clientPath, "-n", count, "-w", window, "-s", size, destination, "bench", sockPaths[0], NULL};
+    printf(
+        "Emulated wire: %d daemons, %llu us delay, %.2f%% loss.\n",
+        wirePortCount,
+        (unsigned long long)(setting_delay / 1000),
+        setting_loss
+    );
+    fflush(stdout);
+    pid_t client = spawn(clientArgs, -1, 0);
+
+    // Run the wire until the load test is done.
+    static char frame[WIRE_FRAME_SIZE];
+    int status = 0;
+    uint64_t armed = 0;
+    while (waitpid(client, &status, WNOHANG) == 0) {
+        struct epoll_event events[WIRE_MAX_PORTS + 1];
+        int nfds = epoll_wait(epoll_fd, events, WIRE_MAX_PORTS + 1, 10);
+        if (nfds == -1 && errno != EINTR) {
+            perror("main: epoll_wait()");
+            exit(EXIT_FAILURE);
+        }
+
+        int n;
+        for (n = 0; n < nfds; n++) {
+            int port = events[n].data.u32;
+            if (port == WIRE_MAX_PORTS) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                    perror("main: read()");
+                    exit(EXIT_FAILURE);
+                }
+                armed = 0;
+                continue;
+            }
+            ssize_t length;
+            while ((length = recv(wirePorts[port].fd, frame, sizeof(frame), MSG_DONTWAIT)) > 0) {
+                wire_forward(port, frame, length, now_ns());
+            }
+        }
+
+        // Deliver what is due, and wake up for the next delayed frame.
+        uint64_t next = wire_release(now_ns());
+        if (next && next != armed) {
+            struct itimerspec spec = {0};
+            spec.it_value.tv_sec = next / 1000000000;
+            spec.it_value.tv_nsec = next % 1000000000;
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+            armed = next;
+        }
+    }
+
+    printf(
+        "Wire: %llu frames delivered, %llu lost, %llu dropped on full queues.\n",
+        (unsigned long long)wireForwarded,
+        (unsigned long long)wireLost,
+        (unsigned long long)wireOverflow
+    );
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    for (i = 0; i < wirePortCount; i++) {
+        kill(daemons[i], SIGTERM);
+        waitpid(daemons[i], NULL, 0);
+        unlink(sockPaths[i]);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -4,8 +4,24 @@
 #include "mac_utils.h"
 #include "mip.h"
 #include "debug.h"
+#include "session.h"
+#include "pending.h"
+#include "rx_ring.h"
+#include "rx_batch.h"
+#include "timer.h"
+#include "neigh.h"
+#include "worker.h"
+#include "frame_pool.h"
+#include "link.h"
+#include "fragment.h"
+#include "stats.h"
+#include "trace.h"
+#include "routing.h"
+#include "interface.h"
+#include "uring.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <net/if.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -17,36 +33,85 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
 /**
- * Store whether or not the daemon is expecting a packet now or not.
+ * Store a linked list of all the connected interfaces, along with information about them.
  */
-enum packet_waiting_status packetIsExpected = NOT_WAITING;
+struct eth_interface *interfaces;
 
 /**
- * Store the payload we are gonna send after receiving the mac address of an ARP lookup.
+ * Store whether this daemon has any MIP address available, and what the addresses are.
  */
-enum arp_restore_status respBuffer;
-unsigned char destinationMip;
-char arpBuffer[MAX_PAYLOAD_SIZE] = {0};
+char *myAddresses;
 
 /**
- * Store a linked list of all the connected interfaces, along with information about them.
+ * Store whether frames should be received through a memory mapped ring instead of recv().
  */
-struct eth_interface *interfaces;
+char setting_rx_ring = 0;
 
 /**
- * Store whether this daemon has any MIP address available, and what the addresses are.
+ * Store whether frames should be sent through a memory mapped ring instead of sendmmsg().
  */
-char *myAddresses;
+char setting_tx_ring = 0;
 
 /**
- * Store a cache of what MAC address belongs to any MIP address.
- * Format:
- *      macCache[Mip Address] = Mac address.
- *      If mac address is all 0's, assume it is unknown, since that mac is mostly used for loopback.
+ * Store the buffers used to read batches of frames from interfaces without a receive ring.
  */
-uint8_t macCache[256][6] = {0};
+struct rx_batch *rxBatch;
+
+/**
+ * Store whether the socket filter should drop frames not addressed to one of our MIP addresses.
+ */
+char setting_filter_dest = 0;
+
+/**
+ * Store how long a request can wait for an ARP or data response, in milliseconds.
+ */
+unsigned int setting_timeout = 1000;
+
+/**
+ * Store the timeouts of every pending request.
+ */
+struct timer_wheel timerWheel;
+
+/**
+ * Store the number of receive worker threads. 0 to receive on the main thread.
+ */
+int setting_workers = 0;
+
+/**
+ * Store how the kernel spreads the frames of an interface over the workers.
+ */
+enum worker_fanout setting_fanout = FANOUT_HASH;
+
+/**
+ * Store the number of events in the trace ring. 0 to not record a trace.
+ */
+unsigned int setting_trace_events = 0;
+
+/**
+ * Store whether to wait for events with io_uring instead of epoll, when the kernel supports it.
+ */
+char setting_uring = 0;
+
+/**
+ * Store the io_uring completions handled in one round of the main loop. Grows if a round ever needs more.
+ */
+struct io_uring_cqe *uringEvents;
+unsigned int uringEventsSize;
+
+/**
+ * Store the receive workers, when there are any.
+ */
+struct worker *workers;
+
+/**
+ * Store a message too large for a single frame while it is received from a session, before it is split.
+ * Also holds statistics snapshots while they are sent.
+ */
+char largeMessage[MAX_MESSAGE_SIZE];
 
 /**
  * Add a file descriptor to the epoll.
@@ -70,324 +135,1186 @@ int epoll_add(struct epoll_control *epctrl, int fd) {
 }
 
 /**
- * Handle an incoming connection event from any socket.
+ * Change the events the epoll watches a file descriptor for.
  * Input:
- *      epctrl - The epoll controller struct.
- *      n - The event counter, says which event to handle.
+ *      epctrl - Epoll controller struct.
+ *      fd - The file descriptor, already in the epoll.
+ *      events - The events to watch for.
+ * Error:
+ *      Will end the program in case of errors.
+ */
+void epoll_modify(struct epoll_control *epctrl, int fd, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epctrl->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        perror("epoll_modify: epoll_ctl()");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Wait for a file descriptor to become readable: through the epoll, or as a multishot poll with io_uring.
+ * Input:
+ *      epctrl - Epoll controller struct.
+ *      fd - The file descriptor to watch.
+ */
+void event_add(struct epoll_control *epctrl, int fd) {
+    if (epctrl->uring) {
+        uring_poll_multishot(epctrl->uring, fd, EVENT_DATA(EVENT_POLL, fd));
+    } else {
+        epoll_add(epctrl, fd);
+    }
+}
+
+/**
+ * Stop watching a file descriptor about to be closed. Closing it is enough for the epoll, but io_uring keeps
+ * the file open for as long as a request uses it.
+ * Input:
+ *      epctrl - Epoll controller struct.
+ *      fd - The file descriptor.
+ */
+void event_remove(struct epoll_control *epctrl, int fd) {
+    if (epctrl->uring) {
+        uring_cancel(epctrl->uring, EVENT_DATA(EVENT_POLL, fd), EVENT_DATA(EVENT_CANCEL, fd));
+    }
+}
+
+/**
+ * Wait for room on the socket of a session with queued replies: by watching it for EPOLLOUT as well, or as a
+ * single poll with io_uring.
+ * Input:
+ *      epctrl - Epoll controller struct.
+ *      s - The session.
+ */
+void event_watch_writable(struct epoll_control *epctrl, struct session *s) {
+    if (epctrl->uring) {
+        uring_poll_writable(epctrl->uring, s->fd, EVENT_DATA(EVENT_WRITABLE, s->fd));
+    } else {
+        epoll_modify(epctrl, s->fd, EPOLLIN | EPOLLOUT | EPOLLET);
+    }
+}
+
+/**
+ * Wait for room on the socket of every session that started queueing replies since the last call.
+ * Input:
+ *      epctrl - Epoll controller struct.
+ */
+void watch_blocked_sessions(struct epoll_control *epctrl) {
+    struct session *s;
+    while ((s = session_next_blocked())) {
+        event_watch_writable(epctrl, s);
+    }
+}
+
+/**
+ * Select the interface to send frames to a MIP address on.
+ * Input:
+ *      destination - The MIP address to send to.
+ * Return:
+ *      The interface the next hop towards the destination was learned on, or NULL if there is no usable interface.
+ */
+struct eth_interface *select_egress(uint8_t destination) {
+    return neigh_get(routing_next_hop(destination))->interface;
+}
+
+/**
+ * Queue a frame with a payload to a MIP address, on a given interface. The MAC address of the next hop towards
+ * the destination must be known.
+ * The source MIP address is the one of the interface. The payload is sent by reference, not copied.
+ * Input:
+ *      egress - The interface to send on.
+ *      destination - The MIP address to send to.
+ *      type - The type of the frame, MIP_DATA or MIP_FRAGMENT.
+ *      buffer - The buffer with the payload at FRAME_PAYLOAD_OFFSET.
+ *      length - The length of the payload in bytes. At most MAX_PAYLOAD_SIZE.
+ */
+void send_payload_frame(
+    struct eth_interface *egress,
+    uint8_t destination,
+    enum mip_type type,
+    struct frame_buffer *buffer,
+    size_t length
+) {
+    uint16_t payloadLength = mip_calc_payload_length(length);
+    char *payload = buffer->data + FRAME_PAYLOAD_OFFSET;
+    memset(&payload[length], 0, payloadLength * 4 - length); // Padding.
+
+    // Build the headers in place in front of the payload.
+    struct ethernet_frame * eth_frame = (struct ethernet_frame*)buffer->data;
+    memcpy(eth_frame->destination, neigh_get(routing_next_hop(destination))->mac, 6);
+    memcpy(eth_frame->source, egress->mac, 6);
+    eth_frame->protocol = htons(ETH_P_MIP);
+
+    struct mip_header header = {0};
+    header.type = type;
+    header.destination = destination;
+    header.source = egress->mip_addr;
+    header.length = payloadLength * 4;
+    header.ttl = MIP_DEFAULT_TTL;
+    mip_encode(&header, eth_frame->msg);
+
+    tx_queue_push_gather(egress->txq, buffer->data, FRAME_PAYLOAD_OFFSET, buffer, payload, payloadLength * 4);
+
+    TRACE(TRACE_FRAME_TX, egress->mip_addr, destination, egress->sock, type, payloadLength * 4);
+}
+
+/**
+ * Queue a payload to a MIP address with a known MAC address, on the interface it was learned on.
+ * A payload too large for a single frame is sent as a frame per fragment.
+ * Input:
+ *      destination - The MIP address to send to.
+ *      buffer - The buffer with the payload at FRAME_PAYLOAD_OFFSET, or the first fragment of a larger payload.
+ *      length - The length of the payload in bytes. At most MAX_MESSAGE_SIZE.
+ */
+void send_data_frame(uint8_t destination, struct frame_buffer *buffer, size_t length) {
+    struct eth_interface *egress = select_egress(destination);
+    if (!egress) {
+        debug_print("No interface to reach %u, dropping frame.\n", destination);
+        stats_drop(DROP_NO_EGRESS);
+        return;
+    }
+
+    if (length <= MAX_PAYLOAD_SIZE) {
+        send_payload_frame(egress, destination, MIP_DATA, buffer, length);
+        return;
+    }
+
+    unsigned int index;
+    for (index = 0; buffer; buffer = buffer->more, index++) {
+        send_payload_frame(egress, destination, MIP_FRAGMENT, buffer, fragment_payload_length(length, index));
+    }
+}
+
+/**
+ * Queue an ARP request for a MIP address on a single interface.
+ * Input:
+ *      interface - The interface to send on.
+ *      destination - The MIP address to look up.
+ *      mac - The MAC address to send to. NULL to broadcast.
+ */
+void send_arp_frame(struct eth_interface *interface, uint8_t destination, uint8_t *mac) {
+    struct ethernet_frame * eth_frame = (struct ethernet_frame*)tx_queue_reserve(interface->txq);
+
+    if (mac) {
+        memcpy(eth_frame->destination, mac, 6);
+    } else {
+        memset(eth_frame->destination, 0xFF, 6);
+    }
+    memcpy(eth_frame->source, interface->mac, 6);
+    eth_frame->protocol = htons(ETH_P_MIP);
+
+    mip_build_header(0, 0, 1, destination, interface->mip_addr, 0, eth_frame->msg);
+
+    tx_queue_commit(interface->txq, sizeof(struct ethernet_frame) + 4);
+    interface->counters.arpRequestsOut++;
+
+    TRACE(TRACE_FRAME_TX, interface->mip_addr, destination, interface->sock, MIP_ARP_REQUEST, 0);
+}
+
+/**
+ * Queue an ARP request broadcast for a MIP address on every interface.
+ * Input:
+ *      destination - The MIP address to look up.
  * Affected by:
- *      packetIsExpected, respBuffer, macCache, destinationMip, arpBuffer.
+ *      interfaceTable.
  */
-void epoll_event(struct epoll_control * epctrl, int n) {
-    unsigned char mip_addr = 0; // Mip address storage, for sendmsg and recvmsg.
-    enum info infoBuffer = 0; // To store and send errors and info between processes.
-    char intBuffer[MAX_PACKET_SIZE] = {0}; // Internal communications buffer
-    char extBuffer[MAX_PACKET_SIZE + sizeof(struct ethernet_frame)] = {0}; // External communications buffer
+void send_arp_request(uint8_t destination) {
+    int id;
+    for (id = 0; id < interfaceCount; id++) {
+        send_arp_frame(interfaceTable[id], destination, NULL);
+    }
+}
 
-    if (epctrl->events[n].data.fd == epctrl->sock_fd) { // If the incoming event is creating a socket connection.
-        if (epctrl->unix_fd && epctrl->unix_fd != -1) {
-            close(epctrl->unix_fd);
-        }
+/**
+ * Queue a routing update broadcast on an interface.
+ * Input:
+ *      interface - The interface to send on.
+ *      payload - The routing update.
+ *      length - Length of the update, at most ROUTE_UPDATE_SIZE.
+ */
+void send_routing_frame(struct eth_interface *interface, char *payload, size_t length) {
+    struct ethernet_frame * eth_frame = (struct ethernet_frame*)tx_queue_reserve(interface->txq);
+
+    memset(eth_frame->destination, 0xFF, 6);
+    memcpy(eth_frame->source, interface->mac, 6);
+    eth_frame->protocol = htons(ETH_P_MIP);
+
+    // Only for the neighbours, never forwarded.
+    struct mip_header header = {0};
+    header.type = MIP_ROUTING;
+    header.destination = MIP_BROADCAST;
+    header.source = interface->mip_addr;
+    header.length = length;
+    header.ttl = 1;
+    mip_encode(&header, eth_frame->msg);
+
+    uint16_t payloadLength = mip_calc_payload_length(length) * 4;
+    memcpy(&eth_frame->msg[4], payload, length);
+    memset(&eth_frame->msg[4 + length], 0, payloadLength - length); // Padding.
+
+    tx_queue_commit(interface->txq, sizeof(struct ethernet_frame) + 4 + payloadLength);
+    TRACE(TRACE_FRAME_TX, interface->mip_addr, MIP_BROADCAST, interface->sock, MIP_ROUTING, payloadLength);
+}
 
-        // Accept connection.
-        epctrl->unix_fd = accept(epctrl->sock_fd, &(epctrl->sockaddr), &(epctrl->sockaddrlen));
-        if (epctrl->unix_fd == -1) {
-            perror("epoll_event: accept()");
-            exit(EXIT_FAILURE);
+/**
+ * Send every frame queued on every interface.
+ * Affected by:
+ *      interfaceTable.
+ */
+void flush_transmit() {
+    int id;
+    for (id = 0; id < interfaceCount; id++) {
+        if (interfaceTable[id]->txq->count) {
+            tx_queue_flush(interfaceTable[id]->txq);
         }
+    }
+}
 
-        // Update the event so the rest of the decision making ends up correct.
-        epctrl->events[n].data.fd = epctrl->unix_fd;
+/**
+ * Queue every frame waiting on an interface that sends with sendmmsg() as io_uring sends, to be submitted with
+ * the next wait. Frames on other interfaces are sent right away. The queues must not be touched until every send
+ * has completed, see tx_queue_done().
+ * Input:
+ *      ring - The io_uring.
+ * Return:
+ *      The number of sends queued.
+ * Affected by:
+ *      interfaceTable.
+ */
+unsigned int uring_flush_transmit(struct uring *ring) {
+    unsigned int sends = 0;
+    int id, i;
+    for (id = 0; id < interfaceCount; id++) {
+        struct tx_queue *q = interfaceTable[id]->txq;
+        if (!q->count) {
+            continue;
+        }
+        if (q->sender != tx_queue_sendmmsg || q->ringSock != -1) {
+            tx_queue_flush(q);
+            continue;
+        }
+        for (i = 0; i < q->count; i++) {
+            uring_sendmsg(ring, q->sock, &q->msgs[i].msg_hdr, EVENT_DATA(EVENT_SEND, q->sock));
+        }
+        sends += q->count;
+    }
+    return sends;
+}
 
-        // Add to epoll.
-        epoll_add(epctrl, epctrl->unix_fd);
+/**
+ * Empty the transmit queues sent by uring_flush_transmit(), once every send has completed.
+ * Affected by:
+ *      interfaceTable.
+ */
+void uring_transmit_done() {
+    int id;
+    for (id = 0; id < interfaceCount; id++) {
+        if (interfaceTable[id]->txq->count) {
+            tx_queue_done(interfaceTable[id]->txq);
+        }
     }
+}
 
-    // Packet/frame/event type decision tree.
-    if (epctrl->events[n].data.fd == epctrl->unix_fd) { // If the incoming event is on the established socket.
-        // Creating the iov and msghdr structs for receiving here.
-        struct iovec iov[3];
-        iov[0].iov_base = &mip_addr;
-        iov[0].iov_len = sizeof(mip_addr);
+/**
+ * Send every payload waiting for the ARP lookup of a MIP address, now that its MAC address is known.
+ * Input:
+ *      mip - The MIP address that has been resolved.
+ */
+void flush_pending_frames(uint8_t mip) {
+    struct pending_entry *entry = pending_find(mip);
+    if (!entry) {
+        return;
+    }
 
-        iov[1].iov_base = &infoBuffer;
-        iov[1].iov_len = sizeof(infoBuffer);
+    uint64_t sentAt = timer_now_ns();
+    struct pending_frame *frame;
+    while ((frame = pending_peek_frame(entry))) {
+        send_data_frame(mip, frame->buffer, frame->length);
 
-        iov[2].iov_base = intBuffer;
-        iov[2].iov_len = sizeof(intBuffer);
+        if (
+            frame->respBuffer == EXP_DATA
+            && pending_add_waiter(entry, frame->fd, frame->requestId, frame->tag, frame->deadline, sentAt) == -1
+        ) {
+            stats_drop(DROP_QUEUE_FULL);
+            struct session *s = session_get(frame->fd);
+            if (s) {
+                session_reply(s, mip, QUEUE_FULL, frame->requestId, NULL, 0);
+            }
+        }
+        pending_pop_frame(entry);
+    }
+}
 
-        struct msghdr message = {0};
-        message.msg_iov = iov;
-        message.msg_iovlen = 3;
+/**
+ * Send every payload waiting for a neighbour, now that its MAC address is known. That includes the payloads to
+ * destinations routed through it.
+ * Input:
+ *      mip - The MIP address of the neighbour.
+ */
+void neighbour_resolved(uint8_t mip) {
+    flush_pending_frames(mip);
 
-        if (recvmsg(epctrl->events[n].data.fd, &message, MSG_WAITALL) == -1) {
-            perror("epoll_event: recvmsg()");
-            exit(EXIT_FAILURE);
+    int destination;
+    for (destination = 0; destination < 256; destination++) {
+        if (destination != mip && routing_next_hop(destination) == mip && pending_find(destination)) {
+            flush_pending_frames(destination);
         }
+    }
+}
 
-        if (infoBuffer == LISTEN) { // If we are just gonna listen as a server.
-            packetIsExpected = LISTENING;
-            debug_print("Now listening to incoming connections.\n");
-        } else if (infoBuffer == RESET) {
-            packetIsExpected = NOT_WAITING;
-            debug_print("Daemon has been reset, no longer listening.\n");
-        } else { // If we are gonna send a message.
-            if (strlen(intBuffer) > MAX_PAYLOAD_SIZE) {
-                infoBuffer = TOO_LONG_PAYLOAD;
-                if (sendmsg(epctrl->events[n].data.fd, &message, 0) == -1) {
-                    perror("epoll_event: sendmsg()");
-                    exit(EXIT_FAILURE);
-                }
+/**
+ * Create a session for a connection accepted on the UNIX socket.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      fd - The non-blocking socket of the connection.
+ */
+void open_session(struct epoll_control *epctrl, int fd) {
+    if (!session_open(fd)) {
+        debug_print("Too many sessions, rejecting connection %d.\n", fd);
+        close(fd);
+        return;
+    }
+
+    event_add(epctrl, fd);
+    TRACE(TRACE_SESSION_OPEN, 0, 0, fd, 0, 0);
+}
+
+/**
+ * Accept every pending connection on the UNIX socket and create a session for each.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ */
+void accept_sessions(struct epoll_control *epctrl) {
+    while (1) {
+        int fd = accept4(epctrl->sock_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 return;
             }
-            
-            char isMipKnown = 0; // Used to store whether the mip is known after checking the cache.
-            int i;
-            for (i = 0; i < 6; i++) {
-                if (macCache[mip_addr][i] != 0) {
-                    isMipKnown = 1;
-                    break;
-                }
-            }
+            perror("accept_sessions: accept4()");
+            exit(EXIT_FAILURE);
+        }
+        open_session(epctrl, fd);
+    }
+}
 
-            if (isMipKnown) {
-                if (infoBuffer != NO_RESPONSE) {
-                    packetIsExpected = WAITING_DATA;
-                }
+/**
+ * Close a session, and stop watching its file descriptors.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      s - The session.
+ */
+void close_session(struct epoll_control *epctrl, struct session *s) {
+    TRACE(TRACE_SESSION_CLOSE, 0, 0, s->fd, 0, 0);
+    event_remove(epctrl, s->fd);
+    if (epctrl->uring && s->blocked) {
+        uring_cancel(epctrl->uring, EVENT_DATA(EVENT_WRITABLE, s->fd), EVENT_DATA(EVENT_CANCEL, s->fd));
+    }
+    if (s->rings) {
+        event_remove(epctrl, s->rings->daemonEvent);
+    }
+    session_close(s);
+}
 
-                struct eth_interface * tmp_interface = interfaces;
-                while (tmp_interface) {
-                    struct ethernet_frame * eth_frame = (struct ethernet_frame*)&extBuffer;
+/**
+ * Send a payload from a session, or queue it until the MAC address of the next hop towards the destination is known.
+ * Input:
+ *      s - The session the payload is from.
+ *      mip_addr - The destination.
+ *      infoBuffer - The info in the message. NO_RESPONSE if no response is expected.
+ *      requestId - The request ID in the message.
+ *      buffer - The buffer with the payload at FRAME_PAYLOAD_OFFSET, or the first of its fragments. Referenced
+ *               if the payload is kept.
+ *      length - Length of the payload. At most MAX_MESSAGE_SIZE.
+ *      tag - Fingerprint of the payload, see pending_tag().
+ */
+void session_send(
+    struct session *s,
+    uint8_t mip_addr,
+    enum info infoBuffer,
+    uint32_t requestId,
+    struct frame_buffer *buffer,
+    size_t length,
+    uint32_t tag
+) {
+    struct pending_entry *entry = pending_get(mip_addr);
+    enum arp_restore_status respBuffer = infoBuffer == NO_RESPONSE ? EXP_NO_RESP : EXP_DATA;
+    uint64_t now = timer_now();
+    uint64_t deadline = now + setting_timeout;
+    uint8_t hop = routing_next_hop(mip_addr);
+
+    // Don't flood ARP for a MIP address that recently did not answer.
+    if (neigh_is_failed(hop, now)) {
+        debug_print("MIP %u is unreachable, not running arp.\n", mip_addr);
+        if (respBuffer == EXP_DATA) {
+            session_reply(s, mip_addr, HOST_UNREACHABLE, requestId, NULL, 0);
+        }
+        return;
+    }
 
-                    memcpy(eth_frame->destination, macCache[mip_addr], 6);
-                    memcpy(eth_frame->source, tmp_interface->mac, 6);
-                    eth_frame->protocol = htons(ETH_P_MIP);
+    // Keep the order of payloads if some are still waiting for ARP.
+    struct neigh_entry *neighbour = neigh_lookup(hop, now);
+    if (neighbour && entry->status != WAITING_ARP) {
+        if (
+            respBuffer == EXP_DATA
+            && pending_add_waiter(entry, s->fd, requestId, tag, deadline, timer_now_ns()) == -1
+        ) {
+            stats_drop(DROP_QUEUE_FULL);
+            session_reply(s, mip_addr, QUEUE_FULL, requestId, NULL, 0);
+            return;
+        }
+        send_data_frame(mip_addr, buffer, length);
 
-                    uint16_t payloadLength = mip_calc_payload_length(strlen(intBuffer));
+        // Confirm a stale neighbour in the background, while still using it. Unicast, since we know where it is.
+        if (neigh_needs_probe(neighbour, now) && neighbour->interface) {
+            send_arp_frame(neighbour->interface, hop, neighbour->mac);
+        }
+    } else {
+        char isArpRunning = entry->status == WAITING_ARP;
 
-                    mip_build_header(
-                        1, 0, 0,
-                        mip_addr,
-                        tmp_interface->mip_addr,
-                        payloadLength,
-                        eth_frame->msg
-                    );
+        // Store the message we intend to send until the MAC address is known.
+        if (pending_queue_frame(entry, s->fd, requestId, tag, respBuffer, buffer, length, deadline) == -1) {
+            stats_drop(DROP_QUEUE_FULL);
+            session_reply(s, mip_addr, QUEUE_FULL, requestId, NULL, 0);
+            return;
+        }
 
-                    memcpy((char*)(&eth_frame->msg[4]), &intBuffer, payloadLength * 4);
+        if (!isArpRunning) {
+            neigh_incomplete(hop, now);
+            entry->arpStarted = timer_now_ns();
+            TRACE(TRACE_ARP_START, 0, hop, s->fd, 0, 0);
+            send_arp_request(hop);
+        }
+    }
+}
 
-                    send(tmp_interface->sock, &extBuffer, payloadLength * 4, 0);
+/**
+ * Handle a single message from the process connected to a session.
+ * Input:
+ *      epctrl - The epoll control, to wait for the eventfd of new shared memory rings.
+ *      s - The session the message arrived on.
+ *      mip_addr - The MIP address in the message.
+ *      infoBuffer - The info/action in the message.
+ *      requestId - The request ID in the message. 0 in the legacy format.
+ *      buffer - The buffer the payload was received into, at FRAME_PAYLOAD_OFFSET. Referenced if the payload
+ *               is kept. Anything past MAX_PACKET_SIZE was received into largeMessage, at the same offset.
+ *      length - Length of the payload. Larger than MAX_MESSAGE_SIZE if it did not fit.
+ */
+void session_message(
+    struct epoll_control *epctrl,
+    struct session *s,
+    uint8_t mip_addr,
+    enum info infoBuffer,
+    uint32_t requestId,
+    struct frame_buffer *buffer,
+    size_t length
+) {
+    if (infoBuffer == LISTEN) { // If we are just gonna listen as a server.
+        s->status = LISTENING;
+        debug_print("Session %d now listening to incoming connections.\n", s->fd);
+        return;
+    } else if (infoBuffer == RESET) {
+        s->status = NOT_WAITING;
+        debug_print("Session %d has been reset, no longer listening.\n", s->fd);
+        return;
+    } else if (infoBuffer == UPGRADE) { // Confirm in the old format, then switch.
+        session_reply(s, mip_addr, UPGRADE, 0, NULL, 0);
+        s->version = IPC_VERSION;
+        debug_print("Session %d now uses the length prefixed format.\n", s->fd);
+        return;
+    } else if (infoBuffer == STATS) {
+        size_t snapshotLength = stats_snapshot(interfaces, largeMessage, sizeof(largeMessage));
+        session_reply(s, mip_addr, STATS, requestId, largeMessage, snapshotLength);
+        return;
+    } else if (infoBuffer == SHM_RINGS) { // Only in the length prefixed format, and only once.
+        int eventFd = s->version == IPC_VERSION && !s->rings ? session_open_rings(s) : -1;
+        if (eventFd == -1) {
+            session_reply(s, mip_addr, SHM_RINGS, requestId, NULL, 0); // Refused: no rings, keep using the socket.
+            return;
+        }
+        event_add(epctrl, eventFd);
+        debug_print("Session %d now uses shared memory rings.\n", s->fd);
+        return;
+    }
 
-                    debug_print("Frame sent:\n");
-                    debug_print_frame(eth_frame);
-                    debug_print("MIP To: %u, From: %u.\n", mip_addr, tmp_interface->mip_addr);
+    // If we are gonna send a message.
+    if (length > MAX_MESSAGE_SIZE) {
+        stats_drop(DROP_TOO_LONG);
+        session_reply(s, mip_addr, TOO_LONG_PAYLOAD, requestId, NULL, 0);
+        return;
+    }
 
-                    tmp_interface = tmp_interface->next;
-                }
-            } else {
-                debug_print("Unknown MIP. Running arp.\n");
-                // Store the message we intend to send in the buffer.
-                memset(arpBuffer, 0, MAX_PAYLOAD_SIZE);
-                memcpy(arpBuffer, intBuffer, MAX_PAYLOAD_SIZE);
-                destinationMip = mip_addr;
-                if (infoBuffer == NO_RESPONSE && packetIsExpected != LISTENING) {
-                    respBuffer = EXP_NO_RESP;
-                } else if (infoBuffer == NO_RESPONSE && packetIsExpected == LISTENING) {
-                    respBuffer = RESUME_LISTEN;
-                } else {
-                    respBuffer = EXP_DATA;
-                }
-                packetIsExpected = WAITING_ARP;
+    // Split a payload too large for a single frame, and send the fragments in its place.
+    if (length > MAX_PAYLOAD_SIZE) {
+        memcpy(largeMessage, buffer->data + FRAME_PAYLOAD_OFFSET, MAX_PACKET_SIZE);
+        struct frame_buffer *fragments = fragment_split(largeMessage, length);
+        session_send(s, mip_addr, infoBuffer, requestId, fragments, length, pending_tag(largeMessage, length));
+        frame_unref(fragments);
+        return;
+    }
+    session_send(
+        s, mip_addr, infoBuffer, requestId, buffer, length, pending_tag(buffer->data + FRAME_PAYLOAD_OFFSET, length)
+    );
+}
 
-                // Make ethernet frame
-                struct ethernet_frame * eth_frame = (struct ethernet_frame*)&extBuffer;
-                memset(eth_frame->destination, 0xFF, 6);
-                eth_frame->protocol = htons(ETH_P_MIP);
+/**
+ * Handle an event on a session, reading every message queued on the connection.
+ * Input:
+ *      epctrl - The epoll control.
+ *      s - The session with the event.
+ */
+void session_event(struct epoll_control *epctrl, struct session *s) {
+    // Received straight into a pooled frame buffer, behind room for the headers. The buffer is reused
+    // for the next message unless the payload was kept for sending.
+    struct frame_buffer *buffer = frame_alloc();
 
-                // Send ARP requests.
-                struct eth_interface * tmp_interface = interfaces;
-                while (tmp_interface) {
-                    memcpy(eth_frame->source, tmp_interface->mac, 6);
+    while (1) {
+        unsigned char mip_addr = 0; // Mip address storage, for recvmsg.
+        enum info infoBuffer = 0; // To store errors and info between processes.
+        struct ipc_header header = {0}; // Header of the length prefixed format.
 
-                    mip_build_header(0, 0, 1, destinationMip, tmp_interface->mip_addr, 0, eth_frame->msg);
+        // Creating the iov and msghdr structs for receiving here.
+        struct iovec iov[3];
+        struct msghdr message = {0};
+        message.msg_iov = iov;
+        size_t headerLength;
 
-                    if (send(tmp_interface->sock, &extBuffer, 18, 0) == -1) {
-                        perror("epoll_event: send()");
-                        exit(EXIT_FAILURE);
-                    }
+        if (s->version == IPC_VERSION) {
+            iov[0].iov_base = &header;
+            iov[0].iov_len = sizeof(header);
 
-                    debug_print("ARP frame sent on %s from %u:\n", tmp_interface->name, tmp_interface->mip_addr);
-                    debug_print_frame(eth_frame);
-                    debug_print("MIP To: %u, From: %u.\n", destinationMip, tmp_interface->mip_addr);
+            iov[1].iov_base = buffer->data + FRAME_PAYLOAD_OFFSET;
+            iov[1].iov_len = MAX_PACKET_SIZE;
 
-                    tmp_interface = tmp_interface->next;
-                }
+            // The rest of a payload too large for a single frame.
+            iov[2].iov_base = largeMessage + MAX_PACKET_SIZE;
+            iov[2].iov_len = MAX_MESSAGE_SIZE - MAX_PACKET_SIZE;
+
+            message.msg_iovlen = 3;
+            headerLength = sizeof(header);
+        } else {
+            iov[0].iov_base = &mip_addr;
+            iov[0].iov_len = sizeof(mip_addr);
+
+            iov[1].iov_base = &infoBuffer;
+            iov[1].iov_len = sizeof(infoBuffer);
+
+            iov[2].iov_base = buffer->data + FRAME_PAYLOAD_OFFSET;
+            iov[2].iov_len = MAX_PACKET_SIZE;
+
+            message.msg_iovlen = 3;
+            headerLength = sizeof(mip_addr) + sizeof(infoBuffer);
+        }
+
+        ssize_t received = recvmsg(s->fd, &message, MSG_DONTWAIT);
+        if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             }
+            perror("session_event: recvmsg()");
         }
-    } else {
-        // Get headers.
-        if (recv(epctrl->events[n].data.fd, &extBuffer, 18, 0) == -1) {
-            perror("epoll_event: recv()");
-            exit(EXIT_FAILURE);
+        if (received <= 0) { // Connection closed, or broken.
+            close_session(epctrl, s);
+            break;
         }
-        struct ethernet_frame *eth_frame = (struct ethernet_frame *)&extBuffer; // Create an eth frame pointer to the buffer.
-
-        char * mip_header = eth_frame->msg; // Store a direct pointer to the MIP header.
-        char * mip_content = &(eth_frame->msg[4]); // Store a pointer to the MIP payload.
+        size_t length = (size_t)received > headerLength ? received - headerLength : 0;
 
-        // If there is a payload: Get it.
-        int tmp_payloadLength = mip_get_payload_length(mip_header) * 4;
-        if (tmp_payloadLength > 0) {
-            if (recv(epctrl->events[n].data.fd, mip_content, tmp_payloadLength, 0) == -1) {
-                perror("epoll_event: recv()");
-                exit(EXIT_FAILURE);
+        if (s->version == IPC_VERSION) {
+            if ((size_t)received < headerLength || header.version != IPC_VERSION) {
+                debug_print("Malformed message on session %d.\n", s->fd);
+                continue;
+            }
+            // The payload is binary, and exactly as long as the header says. Too long if it was cut off.
+            if (message.msg_flags & MSG_TRUNC || header.length > MAX_MESSAGE_SIZE) {
+                length = MAX_MESSAGE_SIZE + 1;
+            } else if (header.length < length) {
+                length = header.length;
             }
+            mip_addr = header.mip;
+            infoBuffer = header.info;
+        } else {
+            // The payload is a string, padded with zeroes to the buffer size.
+            length = strnlen(buffer->data + FRAME_PAYLOAD_OFFSET, length);
         }
 
-        // Store source MIP in cache.
-        memcpy(macCache[mip_get_src(mip_header)], eth_frame->source, 6);
+        s->counters.messagesIn++;
+        s->counters.bytesIn += length;
+        TRACE(TRACE_SESSION_MSG, 0, mip_addr, s->fd, infoBuffer, length);
+        session_message(epctrl, s, mip_addr, infoBuffer, header.requestId, buffer, length);
 
-        // Dump incoming frame.
-        debug_print("Incoming frame:\n");
-        debug_print_frame(eth_frame);
-        debug_print(
-            "Transport: %u, Routing: %u, ARP: %u\n",
-            mip_is_transport(mip_header),
-            mip_is_routing(mip_header),
-            mip_is_arp(mip_header)
-        );
+        if (buffer->refs > 1) {
+            frame_unref(buffer);
+            buffer = frame_alloc();
+        }
+    }
 
-        if (
-            packetIsExpected == WAITING_ARP
-            && !mip_is_transport(mip_header)
-            && !mip_is_routing(mip_header)
-            && !mip_is_arp(mip_header)
-        ) { // If ARP response packet is expected.
-            struct eth_interface * tmp_interface = interfaces;
-            while (tmp_interface) {
-                memcpy(eth_frame->destination, macCache[mip_get_src(mip_header)], 6);
-                memcpy(eth_frame->source, tmp_interface->mac, 6);
-                eth_frame->protocol = htons(ETH_P_MIP);
-
-                uint16_t payloadLength = mip_calc_payload_length(strlen(intBuffer));
-
-                memcpy(mip_content, arpBuffer, payloadLength * 4);
-
-                mip_build_header(
-                    1, 0, 0,
-                    destinationMip,
-                    tmp_interface->mip_addr,
-                    payloadLength,
-                    mip_header
-                );
-
-                send(tmp_interface->sock, &extBuffer, payloadLength * 4, 0);
-
-                debug_print("Frame sent after ARP received:\n");
-                debug_print_frame(eth_frame);
-
-                tmp_interface = tmp_interface->next;
-            }
+    frame_unref(buffer);
+}
+
+/**
+ * Handle a wakeup from a process with shared memory rings, handling every message in its ring. Each payload is
+ * copied once, into a pooled frame buffer, since the process may reuse the slot as soon as it is popped.
+ * Input:
+ *      epctrl - The epoll control.
+ *      s - The session the rings belong to.
+ */
+void ring_event(struct epoll_control *epctrl, struct session *s) {
+    struct ipc_ring *ring = &s->rings->toDaemon;
+    ipc_rings_clear(s->rings->daemonEvent);
+
+    // The process can write anything to the shared memory, stop trusting it once it breaks the ring.
+    if (!ipc_rings_valid(ring)) {
+        debug_print("Broken shared memory ring on session %d.\n", s->fd);
+        close_session(epctrl, s);
+        return;
+    }
+
+    struct frame_buffer *buffer = frame_alloc();
+    struct ipc_header header;
+    char *payload;
+    while ((payload = ipc_rings_peek(ring, &header))) {
+        // Checked on our own copy of the header, which the process cannot change any more.
+        if (header.version != IPC_VERSION || header.length > IPC_RING_MAX_PAYLOAD) {
+            ipc_rings_pop(ring);
+            debug_print("Malformed message on session %d.\n", s->fd);
+            continue;
+        }
+        memcpy(buffer->data + FRAME_PAYLOAD_OFFSET, payload, header.length);
+        ipc_rings_pop(ring);
+
+        s->counters.messagesIn++;
+        s->counters.bytesIn += header.length;
+        TRACE(TRACE_SESSION_MSG, 0, header.mip, s->fd, header.info, header.length);
+        session_message(epctrl, s, header.mip, header.info, header.requestId, buffer, header.length);
 
-            // Update status
-            if (respBuffer == EXP_NO_RESP) {
-                packetIsExpected = NOT_WAITING;
-            } else if (respBuffer == EXP_DATA) {
-                packetIsExpected = WAITING_DATA;
-            } else if (respBuffer == RESUME_LISTEN) {
-                packetIsExpected = LISTENING;
+        if (buffer->refs > 1) {
+            frame_unref(buffer);
+            buffer = frame_alloc();
+        }
+    }
+
+    frame_unref(buffer);
+}
+
+/**
+ * Pass a payload received from a MIP address to the session waiting for a response from it, or to a server.
+ * MIP frames carry no request ID, so which request a payload answers cannot be told exactly. A payload echoing a
+ * request goes to that request, see pending_match_waiter(). Since a destination answers in order, the requests
+ * of the same session sent before it were then lost, and are timed out right away instead of taking the
+ * following replies. Any other payload goes to the oldest request, and a lost request or reply shifts every
+ * later reply by one, until the waiters drain.
+ * Input:
+ *      src - The MIP address the payload is from.
+ *      payload - The payload.
+ *      length - Length of the payload.
+ */
+void deliver_data(uint8_t src, char *payload, size_t length) {
+    struct session *s = NULL;
+    struct pending_entry *entry = pending_find(src);
+    uint32_t requestId = 0;
+    if (entry && entry->waiterCount) {
+        int index = pending_match_waiter(entry, pending_tag(payload, length));
+        struct pending_waiter waiter;
+        pending_take_waiter(entry, index, &waiter);
+        requestId = waiter.requestId;
+        stats_round_trip(timer_now_ns() - waiter.sentAt);
+        s = session_get(waiter.fd);
+
+        while (index-- > 0) {
+            struct pending_waiter *lost = pending_waiter_at(entry, index);
+            if (lost->fd != waiter.fd) {
+                continue;
             }
-              
-        } else if (
-            (packetIsExpected == WAITING_DATA
-            || packetIsExpected == LISTENING)
-            && mip_is_transport(mip_header)
-            && !mip_is_routing(mip_header)
-            && !mip_is_arp(mip_header)
-        ) { // If data packet is expected.
-
-            // Is it actually ment for us?
-            char mentForUs = 0;
-            struct eth_interface * tmp_interface = interfaces;
-            while (tmp_interface) {
-                if (
-                    tmp_interface->sock == epctrl->events[n].data.fd
-                    && tmp_interface->mip_addr == mip_get_dest(mip_header)
-                ) {
-                    mentForUs = 1;
-                    break;
-                }
-                tmp_interface = tmp_interface->next;
+            struct pending_waiter stale;
+            pending_take_waiter(entry, index, &stale);
+            stats_timeout(0);
+            if (s) {
+                TRACE(TRACE_DATA_TIMEOUT, 0, src, s->fd, stale.requestId, 0);
+                session_reply(s, src, TIMED_OUT, stale.requestId, NULL, 0);
             }
-            if (!mentForUs) {
+        }
+    }
+    if (!s) {
+        s = session_find_listening();
+        requestId = 0;
+    }
+    if (!s) {
+        stats_drop(DROP_NO_SESSION);
+        return;
+    }
+
+    TRACE(TRACE_DELIVER, src, 0, s->fd, requestId, length);
+    session_reply(s, src, NO_ERROR, requestId, payload, length);
+}
+
+/**
+ * Pass a frame for another node on towards its destination. Only the ethernet addresses and the MIP header
+ * word are rewritten, in the receive buffer, before the frame is queued on the egress interface. The payload
+ * is never looked at, and never goes through a session.
+ * Input:
+ *      frame - The frame, starting at the ethernet header. Modified.
+ *      received - The length of the frame.
+ *      header - The decoded MIP header of the frame. Modified.
+ */
+void forward_frame(char *frame, size_t received, struct mip_header *header) {
+    struct route *route = routing_lookup(header->destination);
+    if (!route->known || route->cost >= ROUTE_INFINITY) {
+        stats_drop(DROP_NO_ROUTE);
+        return;
+    }
+    if (header->ttl <= 1) { // Would reach 0 here.
+        stats_drop(DROP_TTL_EXPIRED);
+        return;
+    }
+
+    // No ARP on the fast path. The next hop advertised the route, so its MAC address is known.
+    struct neigh_entry *hop = neigh_get(route->nextHop);
+    struct eth_interface *egress = hop->interface;
+    if (!egress || (hop->state != NEIGH_REACHABLE && hop->state != NEIGH_STALE)) {
+        stats_drop(DROP_NO_EGRESS);
+        return;
+    }
+
+    struct ethernet_frame *eth_frame = (struct ethernet_frame *)frame;
+    memcpy(eth_frame->destination, hop->mac, 6);
+    memcpy(eth_frame->source, egress->mac, 6);
+    header->ttl--;
+    mip_encode(header, eth_frame->msg);
+
+    tx_queue_push(egress->txq, frame, received);
+    stats_forwarded();
+    TRACE(TRACE_FORWARD, header->source, header->destination, egress->sock, header->ttl, header->length);
+}
+
+/**
+ * Handle a single incoming frame from one of the network interfaces.
+ * Input:
+ *      fd - The socket of the interface the frame arrived on.
+ *      frame - The frame, starting at the ethernet header. May be modified.
+ *      received - The length of the frame.
+ * Affected by:
+ *      interfaceByFd, interfaceLocal.
+ */
+void handle_frame(int fd, char *frame, size_t received) {
+    if (received < sizeof(struct ethernet_frame) + 4) { // Too short to be a MIP frame.
+        stats_drop(DROP_SHORT);
+        return;
+    }
+    struct ethernet_frame *eth_frame = (struct ethernet_frame *)frame; // Create an eth frame pointer to the buffer.
+    if (eth_frame->protocol != htons(ETH_P_MIP)) { // Only AF_PACKET links filter on the protocol.
+        stats_drop(DROP_NOT_MIP);
+        return;
+    }
+
+    char * mip_content = &(eth_frame->msg[4]); // Store a pointer to the MIP payload.
+
+    // Decode the whole header at once, instead of reading it again for every field.
+    struct mip_header header;
+    mip_decode(eth_frame->msg, &header);
+    if (header.length > received - sizeof(struct ethernet_frame) - 4) { // Truncated frame.
+        stats_drop(DROP_TRUNCATED);
+        return;
+    }
+
+    struct eth_interface *in_interface = interface_by_fd(fd);
+    if (in_interface) {
+        in_interface->counters.rxFrames++;
+        in_interface->counters.rxBytes += received;
+    }
+
+    uint8_t src = header.source;
+    uint64_t now = timer_now();
+
+    TRACE(TRACE_FRAME_RX, src, header.destination, fd, header.type, header.length);
+
+    if (header.type == MIP_ARP_RESPONSE) { // Store the neighbour, and send what is waiting for it, if anything.
+        if (in_interface) {
+            in_interface->counters.arpRepliesIn++;
+        }
+        struct pending_entry *entry = pending_find(src);
+        if (entry && entry->status == WAITING_ARP) {
+            stats_arp_resolved(timer_now_ns() - entry->arpStarted);
+            TRACE(TRACE_ARP_RESOLVED, src, 0, fd, 0, 0);
+        }
+        neigh_confirm(src, eth_frame->source, in_interface, now);
+        neighbour_resolved(src);
+    } else if (header.type == MIP_DATA || header.type == MIP_FRAGMENT) { // Data packet, or part of one.
+
+        // Is it actually ment for us? If not, and it was sent to us, pass it on.
+        if (!in_interface) {
+            stats_drop(DROP_NOT_FOR_US);
+            return;
+        }
+        if (!interface_is_local(header.destination)) {
+            if (memcmp(eth_frame->destination, in_interface->mac, 6)) {
+                stats_drop(DROP_NOT_FOR_US);
                 return;
             }
+            forward_frame(frame, received, &header);
+            return;
+        }
+        neigh_refresh(src, eth_frame->source, now);
 
-            // Creating the iov and msghdr structs for sending data back here.
-            struct iovec iov[3];
-            iov[0].iov_base = &mip_addr;
-            iov[0].iov_len = sizeof(mip_addr);
+        if (header.type == MIP_DATA) {
+            deliver_data(src, mip_content, header.length);
+            return;
+        }
 
-            iov[1].iov_base = &infoBuffer;
-            iov[1].iov_len = sizeof(infoBuffer);
+        // Deliver a fragmented payload once every fragment has arrived.
+        size_t length;
+        char *message = fragment_receive(src, mip_content, header.length, now, &length);
+        if (message) {
+            deliver_data(src, message, length);
+        }
+    } else if (header.type == MIP_ARP_REQUEST) { // If ARP packet.
+        // Only answer on the interface owning the address, so the sender learns the right interface.
+        char isMe = in_interface && header.destination == (uint8_t)in_interface->mip_addr;
+        if (isMe) {
+            in_interface->counters.arpRequestsIn++;
+
+            // The sender is evidently reachable through this interface.
+            neigh_confirm(src, eth_frame->source, in_interface, now);
+            neighbour_resolved(src);
+
+            struct mip_header response = {0};
+            response.type = MIP_ARP_RESPONSE;
+            response.destination = src;
+            response.source = in_interface->mip_addr;
+            response.ttl = MIP_DEFAULT_TTL;
+            mip_encode(&response, eth_frame->msg);
+
+            memcpy(eth_frame->destination, eth_frame->source, 6);
+            memcpy(eth_frame->source, in_interface->mac, 6);
+
+            tx_queue_push(in_interface->txq, frame, sizeof(struct ethernet_frame) + 4);
+            in_interface->counters.arpRepliesOut++;
+            TRACE(TRACE_FRAME_TX, response.source, src, fd, MIP_ARP_RESPONSE, 0);
+        }
+    } else if (header.type == MIP_ROUTING) { // Routing update from a neighbour.
+        if (!in_interface) {
+            return;
+        }
+        // The update came straight from the neighbour, so it shows where the neighbour is.
+        neigh_confirm(src, eth_frame->source, in_interface, now);
+        routing_receive(in_interface, src, mip_content, header.length, now);
+        neighbour_resolved(src);
+    } else {
+        stats_drop(DROP_UNKNOWN_TYPE);
+    }
+}
 
-            iov[2].iov_base = intBuffer;
-            iov[2].iov_len = sizeof(intBuffer);
+/**
+ * Handle an incoming frame event on one of the network interfaces.
+ * Input:
+ *      fd - The socket of the interface with the event.
+ * Affected by:
+ *      interfaceByFd.
+ */
+void frame_event(int fd) {
+    struct eth_interface * tmp_interface = interface_by_fd(fd);
+    if (!tmp_interface) {
+        return;
+    }
 
-            struct msghdr message = {0};
-            message.msg_iov = iov;
-            message.msg_iovlen = 3;
+    // Drain the link, since the event is edge triggered.
+    tmp_interface->link->recv_batch(tmp_interface, rxBatch, handle_frame);
+}
 
-            infoBuffer = NO_ERROR;
-            mip_addr = mip_get_src(mip_header);
-            memcpy(intBuffer, mip_content, MAX_PAYLOAD_SIZE);
+/**
+ * Handle the workers waking the dispatch thread, handling every frame they have queued.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ * Affected by:
+ *      workers.
+ */
+void worker_event(struct epoll_control *epctrl) {
+    // Reset the eventfd before draining, so frames queued while draining trigger a new event.
+    uint64_t wakeups;
+    if (read(epctrl->worker_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN) {
+        perror("worker_event: read()");
+        exit(EXIT_FAILURE);
+    }
 
-            if (sendmsg(epctrl->unix_fd, &message, 0) == -1) {
-                perror("epoll_event: senmsg()");
-                exit(EXIT_FAILURE);
-            }
+    int i;
+    for (i = 0; i < setting_workers; i++) {
+        worker_drain(&workers[i], handle_frame);
+    }
+}
+
+/**
+ * Time out every payload waiting for ARP in an entry, which has passed its deadline.
+ * Input:
+ *      timer - The ARP timer of the entry.
+ */
+void pending_arp_expired(struct timer *timer) {
+    struct pending_entry *entry = timer->data;
+    uint64_t now = timer_now();
+
+    // No answer, so stop sending ARP requests for the address for a while, and stop routing through it.
+    uint8_t hop = routing_next_hop(entry->mip);
+    neigh_failed(hop, now);
+    routing_neighbour_lost(hop, now);
+
+    struct pending_frame *frame;
+    while ((frame = pending_peek_frame(entry)) && frame->deadline <= now) {
+        struct session *s = session_get(frame->fd);
+        if (s && frame->respBuffer == EXP_DATA) {
+            session_reply(s, entry->mip, TIMED_OUT, frame->requestId, NULL, 0);
+        }
+        stats_timeout(1);
+        TRACE(TRACE_ARP_TIMEOUT, 0, entry->mip, frame->fd, 0, 0);
+        pending_pop_frame(entry);
+    }
+}
+
+/**
+ * Time out every session waiting for data in an entry, which has passed its deadline.
+ * Input:
+ *      timer - The data timer of the entry.
+ */
+void pending_data_expired(struct timer *timer) {
+    struct pending_entry *entry = timer->data;
+    uint64_t now = timer_now();
+
+    struct pending_waiter *waiter;
+    while ((waiter = pending_peek_waiter(entry)) && waiter->deadline <= now) {
+        uint32_t requestId = waiter->requestId;
+        struct session *s = session_get(pending_pop_waiter(entry));
+        stats_timeout(0);
+        if (s) {
+            TRACE(TRACE_DATA_TIMEOUT, 0, entry->mip, s->fd, requestId, 0);
+            session_reply(s, entry->mip, TIMED_OUT, requestId, NULL, 0);
+        }
+    }
+}
+
+/**
+ * Handle the timerfd firing, running every timer that has expired.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ */
+void timer_event(struct epoll_control *epctrl) {
+    uint64_t expirations;
+    if (read(epctrl->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("timer_event: read()");
+        exit(EXIT_FAILURE);
+    }
+    epctrl->timer_armed = 0;
+    timer_advance(&timerWheel, timer_now());
+}
+
+/**
+ * Arm the timerfd for the next expiry in the timer wheel, if it is not already armed for it.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ */
+void arm_timer(struct epoll_control *epctrl) {
+    uint64_t next = timer_next_expiry(&timerWheel);
+    if (next == epctrl->timer_armed) {
+        return;
+    }
+
+    // An all zero value disarms the timer.
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = next / 1000;
+    spec.it_value.tv_nsec = (next % 1000) * 1000000;
+    if (timerfd_settime(epctrl->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        perror("arm_timer: timerfd_settime()");
+        exit(EXIT_FAILURE);
+    }
+    epctrl->timer_armed = next;
+}
+
+/**
+ * Handle room on the socket of a session with queued replies: send as many as fit, and keep waiting for room
+ * while any are left. The epoll reports the next room by itself, being edge triggered.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      s - The session.
+ */
+void writable_event(struct epoll_control *epctrl, struct session *s) {
+    if (!s->blocked) { // Sent everything already.
+        return;
+    }
+    if (session_flush(s) == 1) {
+        if (epctrl->uring) {
+            event_watch_writable(epctrl, s);
+        }
+    } else if (!epctrl->uring) {
+        epoll_modify(epctrl, s->fd, EPOLLIN | EPOLLET);
+    }
+}
 
-            debug_print("Send to process.\n");
+/**
+ * Handle a file descriptor becoming readable, from either the epoll or io_uring.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      fd - The file descriptor.
+ */
+void handle_event(struct epoll_control *epctrl, int fd) {
+    struct session *s;
 
-            // Update status
-            if (packetIsExpected == WAITING_DATA) {
-                packetIsExpected = NOT_WAITING;
+    // Packet/frame/event type decision tree.
+    if (fd == epctrl->sock_fd) { // If the incoming event is creating a socket connection.
+        accept_sessions(epctrl);
+    } else if (fd == epctrl->timer_fd) { // If a request has timed out.
+        timer_event(epctrl);
+    } else if (fd == epctrl->worker_fd) { // If the receive workers have queued frames.
+        worker_event(epctrl);
+    } else if ((s = session_get(fd))) { // If the incoming event is on an established session.
+        session_event(epctrl, s);
+    } else if ((s = session_by_event(fd))) { // If a process pushed messages to its shared memory ring.
+        ring_event(epctrl, s);
+    } else {
+        frame_event(fd);
+    }
+}
+
+/**
+ * Handle an incoming connection event from any socket.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      n - The event counter, says which event to handle.
+ */
+void epoll_event(struct epoll_control * epctrl, int n) {
+    int fd = epctrl->events[n].data.fd;
+    struct session *s;
+    if ((epctrl->events[n].events & EPOLLOUT) && (s = session_get(fd))) {
+        writable_event(epctrl, s);
+    }
+    if (epctrl->events[n].events & ~EPOLLOUT) {
+        handle_event(epctrl, fd);
+    }
+}
+
+/**
+ * Exit after a failed io_uring request that cannot be retried.
+ * Input:
+ *      name - What failed, for the message.
+ *      res - The result of the request, a negated errno.
+ */
+void uring_failed(const char *name, int res) {
+    errno = -res;
+    perror(name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Handle a single io_uring completion, other than a send. Multishot requests the kernel has ended are restarted
+ * before anything else, so a cancel queued while handling the completion also ends the new request.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ *      cqe - The completion.
+ */
+void completion_event(struct epoll_control *epctrl, struct io_uring_cqe *cqe) {
+    struct uring *ring = epctrl->uring;
+    int fd = EVENT_FD(cqe->user_data);
+    char more = cqe->flags & IORING_CQE_F_MORE ? 1 : 0;
+    struct session *s;
+
+    switch (EVENT_TYPE(cqe->user_data)) {
+    case EVENT_POLL:
+        if (cqe->res < 0) { // Cancelled, or the file descriptor is gone.
+            return;
+        }
+        if (!more) {
+            uring_poll_multishot(ring, fd, cqe->user_data);
+        }
+        handle_event(epctrl, fd);
+        break;
+    case EVENT_FRAME:
+        // Out of receive buffers, the frames stay in the socket until the request is restarted. The buffers are
+        // handed back as the frames before this completion are handled.
+        if (!more && (cqe->res >= 0 || cqe->res == -ENOBUFS)) {
+            uring_recv_multishot(ring, fd, cqe->user_data);
+        }
+        if (cqe->res == -ENOBUFS) {
+            return;
+        }
+        if (cqe->res < 0) {
+            uring_failed("completion_event: recv()", cqe->res);
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            handle_frame(fd, uring_buffer(ring, cqe), cqe->res);
+            uring_recycle(ring, cqe);
+        }
+        break;
+    case EVENT_WRITABLE:
+        if (cqe->res < 0) { // Cancelled, or the file descriptor is gone.
+            return;
+        }
+        if ((s = session_get(fd))) {
+            writable_event(epctrl, s);
+        }
+        break;
+    case EVENT_ACCEPT:
+        if (!more) {
+            uring_accept_multishot(ring, fd, cqe->user_data);
+        }
+        if (cqe->res < 0) {
+            uring_failed("completion_event: accept()", cqe->res);
+        }
+        open_session(epctrl, cqe->res);
+        break;
+    default: // Cancels. Sends are handled in uring_loop().
+        break;
+    }
+}
+
+/**
+ * Serve with io_uring: every send queued in a round is submitted with the wait for the next events, in a single
+ * syscall, and frames are received into the registered buffers without a syscall of their own.
+ * Input:
+ *      epctrl - The epoll controller struct.
+ */
+void uring_loop(struct epoll_control *epctrl) {
+    struct uring *ring = epctrl->uring;
+    while (1) {
+        // Send everything queued while handling the events, wake the processes with replies in shared memory,
+        // wait for room for the replies queued on sockets, and make sure the timerfd fires for the next timeout.
+        unsigned int sends = uring_flush_transmit(ring);
+        session_wake();
+        watch_blocked_sessions(epctrl);
+        arm_timer(epctrl);
+
+        // Collect completions until every send is done, since the queues are reused afterwards.
+        unsigned int count = 0;
+        unsigned int sent = 0;
+        do {
+            if (uring_submit(ring, 1) == -1) {
+                exit(EXIT_FAILURE);
             }
-        } else { // No packet of this kind is expected.
-            if (mip_is_arp(mip_header)) { // If ARP packet.
-                char isMe = 0;
-                struct eth_interface * tmp_interface = interfaces;
-                while (tmp_interface) {
-                    if (mip_get_dest(mip_header) == tmp_interface->mip_addr) {
-                        isMe = 1;
-                        break;
+            struct io_uring_cqe cqes[64];
+            unsigned int n, i;
+            while ((n = uring_reap(ring, cqes, 64))) {
+                for (i = 0; i < n; i++) {
+                    if (EVENT_TYPE(cqes[i].user_data) == EVENT_SEND) {
+                        if (cqes[i].res < 0) {
+                            uring_failed("uring_loop: sendmsg()", cqes[i].res);
+                        }
+                        sent++;
+                        continue;
                     }
-                    tmp_interface = tmp_interface->next;
-                }
-                printf("IsMe %d\n", isMe);
-                if (isMe) {
-                    mip_build_header(
-                        0, 0, 0,
-                        mip_get_src(mip_header),
-                        tmp_interface->mip_addr,
-                        0,
-                        eth_frame->msg
-                    );
-                    
-                    uint8_t tmp_mac[6] = {0};
-                    memcpy(&tmp_mac, eth_frame->source, 6);
-                    memcpy(eth_frame->source, eth_frame->destination, 6);
-                    memcpy(eth_frame->destination, &tmp_mac, 6);
-
-                    if (send(epctrl->events[n].data.fd, &extBuffer, 18, 0) == -1) {
-                        perror("epoll_event: send()");
-                        exit(EXIT_FAILURE);
+                    if (count == uringEventsSize) {
+                        uringEventsSize *= 2;
+                        uringEvents = realloc(uringEvents, uringEventsSize * sizeof(struct io_uring_cqe));
+                        if (!uringEvents) {
+                            perror("uring_loop: realloc()");
+                            exit(EXIT_FAILURE);
+                        }
                     }
-
-                    debug_print("Sent ARP response:\n");
-                    debug_print_frame(eth_frame);
+                    uringEvents[count++] = cqes[i];
                 }
-            } else { // If not ARP packet.
-                debug_print("Unexpected packet received.\n");
             }
+        } while (sent < sends);
+        if (sends) {
+            uring_transmit_done();
+        }
+
+        unsigned int i;
+        for (i = 0; i < count; i++) {
+            completion_event(epctrl, &uringEvents[i]);
         }
     }
 }
@@ -395,41 +1322,78 @@ void epoll_event(struct epoll_control * epctrl, int n) {
 /**
  * Main method.
  * Affected by:
- *      packetIsExpected, myAddresses.
+ *      myAddresses, interfaces.
  */
 int main(int argc, char * argv[]) {
     // Args count check
     if (argc <= 1) {
-        printf("Syntax: %s [-h] [-d] <unix_socket> [MIP addresses]\n", argv[0]);
+        printf("Syntax: %s [-h] [-d] [-r] [-t] [-f] [-T timeout_ms] [-w workers] [-F hash|cpu] [-x events] [-u] [-l link]... <unix_socket> [MIP addresses]\n", argv[0]);
         return EXIT_SUCCESS;
     }
 
     // Variables
     char* sockpath = {0};
+    char **linkSpecs = calloc(argc, sizeof(char *)); // Links given with -l.
+    int linkCount = 0;
     int addrCount = 0; // Used in loop. Used to store addresses in the right spot.
 
     // Args parsing.
     int i;
     for (i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-h")) {
-            printf("Syntax: %s [-h] [-d] <unix_socket> [MIP addresses]\n", argv[0]);
+            printf("Syntax: %s [-h] [-d] [-r] [-t] [-f] [-T timeout_ms] [-w workers] [-F hash|cpu] [-x events] [-u] [-l link]... <unix_socket> [MIP addresses]\n", argv[0]);
             printf("-h: Show help and exit.\n");
             printf("-d: Debug mode.\n");
+            printf("-r: Receive frames through a memory mapped ring (TPACKET_V3).\n");
+            printf("-t: Send frames through a memory mapped ring (PACKET_TX_RING).\n");
+            printf("-f: Drop frames not addressed to one of our MIP addresses in the kernel. Disables forwarding.\n");
+            printf("-T: Time in milliseconds to wait for an ARP or data response. Default 1000.\n");
+            printf("-w: Number of threads receiving frames, spread over with PACKET_FANOUT. Default 0, single threaded.\n");
+            printf("-F: Fanout mode of the receive threads, by flow hash or by receiving CPU. Default hash.\n");
+            printf("-u: Wait for events with io_uring, receiving frames into registered buffers. Falls back to epoll.\n");
+            printf("-x: Record a binary trace of this many events in shared memory, read with mip_trace. 0 for %u.\n", TRACE_DEFAULT_EVENTS);
+            printf("-l: Use this link instead of every network interface. Repeat for more links, each gets the next\n");
+            printf("    MIP address. raw:<interface> for AF_PACKET, tap:<device> for a TAP device, or emu:<fd> for an\n");
+            printf("    emulated wire on an inherited UNIX datagram socket.\n");
             exit(EXIT_SUCCESS);
         } else if (!strcmp(argv[i], "-d")) {
             enable_debug_print();
             debug_print("Debug mode enabled.\n");
+        } else if (!strcmp(argv[i], "-r")) {
+            setting_rx_ring = 1;
+        } else if (!strcmp(argv[i], "-t")) {
+            setting_tx_ring = 1;
+        } else if (!strcmp(argv[i], "-f")) {
+            setting_filter_dest = 1;
+        } else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+            setting_timeout = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            setting_workers = atoi(argv[++i]);
+            if (setting_workers < 0) {
+                setting_workers = 0;
+            }
+        } else if (!strcmp(argv[i], "-F") && i + 1 < argc) {
+            setting_fanout = strcmp(argv[++i], "cpu") ? FANOUT_HASH : FANOUT_CPU;
+        } else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+            setting_trace_events = atoi(argv[++i]);
+            if (!setting_trace_events) {
+                setting_trace_events = TRACE_DEFAULT_EVENTS;
+            }
+        } else if (!strcmp(argv[i], "-u")) {
+            setting_uring = 1;
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            linkSpecs[linkCount++] = argv[++i];
         } else if (!sockpath) {
             sockpath = argv[i];
 
-            myAddresses = calloc(argc - i + 1, 0);
+            myAddresses = calloc(argc - i + 1, sizeof(char));
         } else {
             myAddresses[addrCount] = (char)atoi(argv[i]);
             addrCount++;
         }
     }
     if (!sockpath) {
-        printf("Syntax: %s [-h] [-d] <unix_socket> [MIP addresses]\n", argv[0]);
+        printf("Syntax: %s [-h] [-d] [-r] [-t] [-f] [-T timeout_ms] [-w workers] [-F hash|cpu] [-x events] [-u] [-l link]... <unix_socket> [MIP addresses]\n", argv[0]);
         exit(EXIT_SUCCESS);
     }
 
@@ -457,87 +1421,173 @@ int main(int argc, char * argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Create EPOLL.
+    // Non-blocking, so every pending connection can be accepted on a single edge-triggered event.
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("main: fcntl()");
+        exit(EXIT_FAILURE);
+    }
+
+    // Create io_uring if asked to, or EPOLL.
     struct epoll_control epctrl;
     epctrl.sock_fd = sock;
-    epctrl.sockaddrlen = sizeof(sockaddr);
-    memcpy(&(epctrl.sockaddr), &sockaddr, sizeof(sockaddr));
-    epctrl.epoll_fd = epoll_create(10);
+    epctrl.epoll_fd = -1;
+    epctrl.uring = NULL;
+    if (setting_uring) {
+        epctrl.uring = malloc(sizeof(struct uring));
+        if (uring_init(epctrl.uring) == -1) {
+            printf("io_uring unavailable, using epoll.\n");
+            free(epctrl.uring);
+            epctrl.uring = NULL;
+        } else {
+            uringEventsSize = URING_CQ_ENTRIES;
+            uringEvents = malloc(uringEventsSize * sizeof(struct io_uring_cqe));
+        }
+    }
 
-    epoll_add(&epctrl, epctrl.sock_fd);
+    if (epctrl.uring) {
+        uring_accept_multishot(epctrl.uring, epctrl.sock_fd, EVENT_DATA(EVENT_ACCEPT, epctrl.sock_fd));
+    } else {
+        epctrl.epoll_fd = epoll_create(10);
+        if (epctrl.epoll_fd == -1) {
+            perror("main: epoll_create()");
+            exit(EXIT_FAILURE);
+        }
+        epoll_add(&epctrl, epctrl.sock_fd);
+    }
 
-    if (epctrl.epoll_fd == -1) {
-        perror("main: epoll_create()");
+    // Create the timer driving the request timeouts.
+    epctrl.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epctrl.timer_fd == -1) {
+        perror("main: timerfd_create()");
         exit(EXIT_FAILURE);
     }
+    epctrl.timer_armed = 0;
+    event_add(&epctrl, epctrl.timer_fd);
+
+    epctrl.worker_fd = -1;
+    if (setting_workers) {
+        epctrl.worker_fd = eventfd(0, EFD_NONBLOCK);
+        if (epctrl.worker_fd == -1) {
+            perror("main: eventfd()");
+            exit(EXIT_FAILURE);
+        }
+        event_add(&epctrl, epctrl.worker_fd);
+    }
 
-    // Create sockets and save each network interface to a list.
-    struct ifaddrs * addrs, * tmp_addr;
-    struct eth_interface * tmp_interface;
-
-    getifaddrs(&addrs);
-    tmp_addr = addrs;
-
-    int tmp_addrNum = 0; // Counter used to assign MIP addresses.
-    while (tmp_addr)
-    {
-        if (
-            tmp_addr->ifa_addr
-            && tmp_addr->ifa_addr->sa_family == AF_PACKET
-            && !(tmp_addr->ifa_flags & IFF_LOOPBACK))
-        {
-            // If we have no more MIP addresses we can use, stop storing data about the interfaces,
-            // since we can't use the interfaces anyway.
-            if (!(myAddresses[tmp_addrNum])) {
-                break;
-            }
-            tmp_interface = calloc(0, sizeof(struct eth_interface));
+    timer_wheel_init(&timerWheel, timer_now());
+    pending_init(&timerWheel, pending_arp_expired, pending_data_expired);
+    fragment_init(&timerWheel, setting_timeout);
 
-            tmp_interface->name = calloc(0, strlen(tmp_addr->ifa_name));
-            strcpy(tmp_interface->name, tmp_addr->ifa_name);
+    frame_pool_init(FRAME_POOL_SIZE);
+    stats_init();
 
-            // Create socket for the interface.
-            sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-            if (sock == -1) {
-                perror("main: socket()");
-                exit(EXIT_FAILURE);
-            }
+    if (setting_trace_events) {
+        int traceFd = trace_open(setting_trace_events);
+        if (traceFd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Tracing to /proc/%d/fd/%d.\n", getpid(), traceFd);
+    }
 
-            struct sockaddr_ll sockaddr_net;
-            sockaddr_net.sll_family = AF_PACKET;
-            sockaddr_net.sll_protocol = htons(ETH_P_ALL);
-            sockaddr_net.sll_ifindex = if_nametoindex(tmp_addr->ifa_name);
-            if (bind(sock, (struct sockaddr*)&sockaddr_net, sizeof(sockaddr_net)) == -1) {
-                perror("main: bind(loop)");
-                exit(EXIT_FAILURE);
+    rxBatch = malloc(sizeof(struct rx_batch));
+    rx_batch_init(rxBatch);
+
+    // Open every link, and save each to the list of interfaces.
+    struct link_options linkOptions = {0};
+    linkOptions.receive = !setting_workers;
+    linkOptions.rxRing = setting_rx_ring;
+    linkOptions.txRing = setting_tx_ring;
+    linkOptions.localAddresses = myAddresses;
+    linkOptions.addressCount = setting_filter_dest ? addrCount : 0;
+
+    // Without any links given, use every network interface.
+    if (!linkCount) {
+        struct ifaddrs * addrs, * tmp_addr;
+        getifaddrs(&addrs);
+        for (tmp_addr = addrs; tmp_addr; tmp_addr = tmp_addr->ifa_next) {
+            if (
+                tmp_addr->ifa_addr
+                && tmp_addr->ifa_addr->sa_family == AF_PACKET
+                && !(tmp_addr->ifa_flags & IFF_LOOPBACK)
+                && linkCount < addrCount)
+            {
+                linkSpecs[linkCount] = malloc(strlen(tmp_addr->ifa_name) + 5);
+                sprintf(linkSpecs[linkCount], "raw:%s", tmp_addr->ifa_name);
+                linkCount++;
             }
+        }
+        freeifaddrs(addrs);
+    }
 
-            tmp_interface->mip_addr = myAddresses[tmp_addrNum];
+    struct eth_interface * tmp_interface;
+    int tmp_addrNum; // Counter used to assign MIP addresses.
+    for (tmp_addrNum = 0; tmp_addrNum < linkCount; tmp_addrNum++) {
+        // If we have no more MIP addresses we can use, stop storing data about the interfaces,
+        // since we can't use the interfaces anyway.
+        if (!(myAddresses[tmp_addrNum])) {
+            break;
+        }
 
-            tmp_interface->sock = sock;
-            get_mac_addr(sock, tmp_interface->mac, tmp_addr->ifa_name);
+        tmp_interface = link_open(linkSpecs[tmp_addrNum], &linkOptions);
+        if (!tmp_interface) {
+            exit(EXIT_FAILURE);
+        }
+        tmp_interface->mip_addr = myAddresses[tmp_addrNum];
+        if (interface_add(tmp_interface) == -1) {
+            printf("Too many interfaces, %s not added.\n", tmp_interface->name);
+            exit(EXIT_FAILURE);
+        }
 
-            tmp_interface->next = interfaces;
-            interfaces = tmp_interface;
+        tmp_interface->next = interfaces;
+        interfaces = tmp_interface;
 
-            epoll_add(&epctrl, sock);
+        // Workers receive on the links they can share. io_uring receives whole frames itself where it can.
+        if (setting_workers && tmp_interface->link->fanout) {
+            // Nothing to watch.
+        } else if (epctrl.uring && tmp_interface->link->datagram && !tmp_interface->ring) {
+            uring_recv_multishot(
+                epctrl.uring, tmp_interface->sock, EVENT_DATA(EVENT_FRAME, tmp_interface->sock)
+            );
+        } else {
+            event_add(&epctrl, tmp_interface->sock);
+        }
 
-            tmp_addrNum++; // Increase by one.
+        debug_print("%s added with MIP addr %u.\n", tmp_interface->name, tmp_interface->mip_addr);
+    }
 
-            debug_print("%s added with MIP addr %u.\n", tmp_addr->ifa_name, tmp_interface->mip_addr);
+    // Start the receive workers, now that the list of interfaces is complete.
+    if (setting_workers) {
+        workers = calloc(setting_workers, sizeof(struct worker));
+        for (i = 0; i < setting_workers; i++) {
+            if (worker_start(
+                &workers[i],
+                interfaces,
+                setting_fanout,
+                epctrl.worker_fd,
+                myAddresses,
+                setting_filter_dest ? addrCount : 0,
+                setting_rx_ring
+            ) == -1) {
+                printf("Receive workers unavailable.\n");
+                exit(EXIT_FAILURE);
+            }
         }
-
-        tmp_addr = tmp_addr->ifa_next;
+        debug_print("%d receive workers started.\n", setting_workers);
     }
-    freeifaddrs(addrs);
+
+    routing_init(&timerWheel, interfaces, send_routing_frame);
 
     printf("Ready to serve.\n");
 
-    // Serve. The epoll_wait timeout makes this a "pulse" loop, meaning all periodic updates in the daemon
-    // can be done from here.
+    // Serve. All periodic work is driven by the timer wheel, through the timerfd.
+    if (epctrl.uring) {
+        uring_loop(&epctrl);
+    }
+
+    arm_timer(&epctrl);
     while (1) {
         int nfds, n;
-        nfds = epoll_wait(epctrl.epoll_fd, epctrl.events, MAX_EVENTS, 1000); // Max waiting time = 1 sec.
+        nfds = epoll_wait(epctrl.epoll_fd, epctrl.events, MAX_EVENTS, -1);
         if (nfds == -1) {
             perror("main: epoll_wait()");
             exit(EXIT_FAILURE);
@@ -548,54 +1598,43 @@ int main(int argc, char * argv[]) {
             epoll_event(&epctrl, n);
         }
 
-        // Time out. If the daemon is waiting, not serving, and no events happened.
-        if (
-            (packetIsExpected == WAITING_ARP || packetIsExpected == WAITING_DATA)
-            && nfds == 0
-        ) {
-            // Defining the necessary variables to send back to the UNIX socket client.
-            char intBuffer = {0};
-            char mip_addr = 0;
-            enum info infoBuffer = TIMED_OUT;
-
-            packetIsExpected = NOT_WAITING;
-
-            struct iovec iov[3];
-            iov[0].iov_base = &mip_addr;
-            iov[0].iov_len = sizeof(mip_addr);
+        // Send everything queued while handling the events, one batch per interface.
+        flush_transmit();
 
-            iov[1].iov_base = &infoBuffer;
-            iov[1].iov_len = sizeof(infoBuffer);
+        // Wake the processes that got replies through shared memory, once each.
+        session_wake();
 
-            iov[2].iov_base = &intBuffer;
-            iov[2].iov_len = sizeof(intBuffer);
+        // Wait for room on the sockets of the sessions that had replies queued.
+        watch_blocked_sessions(&epctrl);
 
-            struct msghdr message = {0};
-            message.msg_iov = iov;
-            message.msg_iovlen = 3;
-
-            if (sendmsg(epctrl.unix_fd, &message, 0) == -1) {
-                perror("main: sendmsg()");
-                exit(EXIT_FAILURE);
-            }
+        // Make sure the timerfd fires for the next timeout.
+        arm_timer(&epctrl);
+    }
 
-            debug_print("Connection timed out.\n");
-        }
-        debug_print("Epoll timed out, 1s pulse loop done, events: %d\n", nfds);
+    // Stop the workers before the interfaces they read go away.
+    for (i = 0; i < setting_workers; i++) {
+        worker_stop(&workers[i]);
+    }
+    free(workers);
+    if (epctrl.worker_fd != -1) {
+        close(epctrl.worker_fd);
     }
 
-    // Close unix socket.
-    close(epctrl.unix_fd);
+    // Close unix sockets.
+    struct session *s;
+    while ((s = session_next(NULL))) {
+        session_close(s);
+    }
     close(epctrl.sock_fd);
+    close(epctrl.timer_fd);
 
     // Close eth sockets and clean up memory.
-    tmp_interface = interfaces;
     while (interfaces) {
-        close(tmp_interface->sock);
-        free(tmp_interface->name);
+        tmp_interface = interfaces;
         interfaces = tmp_interface->next;
-        free(tmp_interface);
+        link_close(tmp_interface);
     }
+    free(rxBatch);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
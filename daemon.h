@@ -1,49 +1,92 @@
 #ifndef _daemon_h
 #define _daemon_h
 
+#include "rx_ring.h"
+#include "tx_queue.h"
+
 #include <sys/epoll.h>
 #include <sys/socket.h>
 
 /**
- * An enum object to store the status of the daemon at this moment.
+ * An enum object to store the status of a session, or of the pending operations towards a destination.
  */
 enum packet_waiting_status {
     NOT_WAITING         = 0, // Not awaiting any packet.
-    WAITING_ARP         = 1, // Awaiting a single ARP response packet.
-    WAITING_DATA        = 2, // Awaiting a single data response packet.
-    LISTENING           = 3 // Listening to packets as a server.
+    WAITING_ARP         = 1, // Awaiting an ARP response packet.
+    WAITING_DATA        = 2, // Awaiting one or more data response packets.
+    LISTENING           = 3 // Session only: Listening to packets as a server.
 };
 
 /**
- * An enum object storing how the daemon can restore it's previous status.
+ * An enum object storing what the daemon should do after sending a payload that waited for ARP.
  */
 enum arp_restore_status {
     EXP_NO_RESP         = 0, // Don't expect a response.
-    EXP_DATA            = 1, // Wait for data response.
-    RESUME_LISTEN       = 2 // Return to listening.
+    EXP_DATA            = 1 // Wait for data response.
+};
+
+struct link_ops;
+
+/**
+ * Counters for a single interface. Frames sent are counted by its transmit queue.
+ */
+struct interface_counters {
+    uint64_t rxFrames; // MIP frames received.
+    uint64_t rxBytes;
+    uint64_t arpRequestsIn;
+    uint64_t arpRepliesIn;
+    uint64_t arpRequestsOut;
+    uint64_t arpRepliesOut;
 };
 
 /**
  * A linked list structure to store all the network interfaces in, with associated information.
+ * Also stored by ID and by socket in the tables of interface.h, for lookups on the data path.
  */
 struct eth_interface {
     struct eth_interface *next;
+    int id; // Index in interfaceTable.
+    const struct link_ops *link; // The backend the interface is opened through.
     char* name;
     uint8_t mac[6];
     char mip_addr;
     int sock;
+    struct rx_ring *ring; // Receive ring for the socket, or NULL if frames are read with recv().
+    struct tx_queue *txq; // Frames waiting to be sent on the interface.
+    struct interface_counters counters;
 };
 
 #define MAX_EVENTS 20
+
+/**
+ * What an io_uring completion is for. Stored in the upper half of its user data, with the file descriptor in the
+ * lower half, see EVENT_DATA().
+ */
+enum event_type {
+    EVENT_POLL          = 1, // The file descriptor is readable, handled as an epoll event would be.
+    EVENT_FRAME         = 2, // A frame received on an interface, in a receive buffer.
+    EVENT_ACCEPT        = 3, // A connection accepted on the UNIX socket.
+    EVENT_SEND          = 4, // A frame sent from a transmit queue.
+    EVENT_CANCEL        = 5, // Requests on a file descriptor about to be closed were cancelled.
+    EVENT_WRITABLE      = 6 // A session with queued replies has room on its socket.
+};
+
+#define EVENT_DATA(type, fd) (((uint64_t)(type) << 32) | (uint32_t)(fd))
+#define EVENT_TYPE(data) ((enum event_type)((data) >> 32))
+#define EVENT_FD(data) ((int)(uint32_t)(data))
+
+struct uring;
+
 /**
- * EPOLL control structure.
+ * EPOLL control structure. With io_uring, the same file descriptors are watched through the ring instead.
  */
 struct epoll_control {
-    int epoll_fd; // The file descriptor for the epoll.
+    struct uring *uring; // The io_uring the daemon waits on, or NULL to use the epoll.
+    int epoll_fd; // The file descriptor for the epoll. -1 with io_uring.
     int sock_fd; // The file descriptor for the socket the ping server/client connects to.
-    int unix_fd; // The file descriptor for the socket created when the ping server/client connects.
-    socklen_t sockaddrlen; // Address length for sockaddr struct.
-    struct sockaddr sockaddr; // Socket address struct for unix socket.
+    int timer_fd; // The file descriptor for the timerfd driving the timeouts.
+    uint64_t timer_armed; // The time the timerfd is armed for, in milliseconds. 0 if disarmed.
+    int worker_fd; // The eventfd the receive workers wake the dispatch thread with, or -1 without workers.
     struct epoll_event events[MAX_EVENTS];
 };
 
@@ -1,43 +1,25 @@
 #include "debug.h"
-#include "mac_utils.h"
+#include "trace.h"
 
-#include <arpa/inet.h>
 #include <stdio.h>
 
 char setting_debug = 0;
 
 /**
- * Enables the debug printing for the application.
+ * Enables the debug printing for the application. Trace events are printed as they happen as well.
  */
 void enable_debug_print() {
     setting_debug = 1;
+    trace_enable_print();
 }
 
 /**
- * Formats and prints a line of text if, and only if, debug printing is enabled.
+ * Formats and prints a line of text. Use debug_print() instead, which checks whether debug printing is enabled.
  * For arguments, see the printf documentation. It's exactly the same.
  */
-void debug_print(char * str, ...) {
-    if (!setting_debug) return;
-    
+void debug_printf(char * str, ...) {
     va_list args;
     va_start(args, str);
     vprintf(str, args);
+    va_end(args);
 }
-
-/**
- * If debug printing is enabled; format and print a single ethernet frame.
- * Input:
- *      frame - The ethernet frame struct to print.
- */
-void debug_print_frame(struct ethernet_frame * frame) {
-    if (!setting_debug) return;
-
-    printf("Source MAC:\n");
-    print_mac(frame->source);
-    printf("Destination:\n");
-    print_mac(frame->destination);
-    printf("Protocol: %d\n", ntohs(frame->protocol));
-    printf("%s\n", frame->msg);
-}
-
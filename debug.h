@@ -1,13 +1,23 @@
 #ifndef _debug_h
 #define _debug_h
 
-#include "ethernet.h"
-
 #include <stdarg.h>
 
+extern char setting_debug;
+
+/**
+ * Formats and prints a line of text if, and only if, debug printing is enabled.
+ * The arguments are not evaluated when it is not.
+ */
+#define debug_print(...) \
+    do { \
+        if (setting_debug) { \
+            debug_printf(__VA_ARGS__); \
+        } \
+    } while (0)
+
 // Debug print functions
 void enable_debug_print();
-void debug_print(char *str, ...);
-void debug_print_frame(struct ethernet_frame *frame);
+void debug_printf(char *str, ...);
 
-#endif
\ No newline at end of file
+#endif
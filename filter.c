@@ -0,0 +1,124 @@
+#include "filter.h"
+#include "ethernet.h"
+#include "mip.h"
+
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+/**
+ * Offset of the MIP header in a frame.
+ */
+#define FILTER_MIP_OFFSET sizeof(struct ethernet_frame)
+
+/**
+ * Length of the ethernet and MIP headers.
+ */
+#define FILTER_HEADER_LENGTH (sizeof(struct ethernet_frame) + 4)
+
+/**
+ * Attach a classic BPF program to a packet socket, so the kernel only hands us frames we can use:
+ * incoming MIP frames, at least as long as their headers say they are.
+ * Input:
+ *      sock - The packet socket.
+ *      localAddresses - If not NULL, also drop frames not addressed to one of these MIP addresses, or to the
+ *                       broadcast address of routing updates. Frames for other nodes can then not be forwarded.
+ *      addressCount - Number of addresses in localAddresses.
+ * Return:
+ *      0 if successful, -1 if the filter could not be attached.
+ */
+int filter_attach(int sock, char *localAddresses, int addressCount) {
+    if (!localAddresses || addressCount < 0) {
+        addressCount = 0;
+    }
+    if (addressCount > 200) { // Keep every jump within the 8 bit offset.
+        addressCount = 200;
+    }
+
+    struct sock_filter *code = calloc(25 + addressCount, sizeof(struct sock_filter));
+    if (!code) {
+        perror("filter_attach: calloc()");
+        return -1;
+    }
+
+    // Jumps to the final instructions are patched once the program length is known.
+    int n = 0;
+    int dropJumps[8];
+    int dropCount = 0;
+
+    // Drop our own outgoing frames.
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+    dropJumps[dropCount++] = n;
+    code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 0, 0);
+
+    // Drop anything but MIP.
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+    code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_MIP, 1, 0);
+    dropJumps[dropCount++] = n;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+
+    // Drop frames too short for the headers.
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+    code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, FILTER_HEADER_LENGTH, 1, 0);
+    dropJumps[dropCount++] = n;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+
+    // Drop frames shorter than the payload length in the MIP header.
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FILTER_MIP_OFFSET);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x1FF);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, FILTER_HEADER_LENGTH);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0);
+    dropJumps[dropCount++] = n;
+    code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 0, 0);
+
+    // Only accept frames addressed to one of our MIP addresses.
+    int acceptJumps = n;
+    if (addressCount) {
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FILTER_MIP_OFFSET);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 21);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xFF);
+        acceptJumps = n;
+        int i;
+        for (i = 0; i < addressCount; i++) {
+            code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint8_t)localAddresses[i], 0, 0);
+        }
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, MIP_BROADCAST, 0, 0);
+        dropJumps[dropCount++] = n;
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+    }
+
+    int accept = n;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    int drop = n;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    // Patch the jumps.
+    int i;
+    for (i = 0; i < dropCount; i++) {
+        struct sock_filter *jump = &code[dropJumps[i]];
+        uint8_t offset = drop - dropJumps[i] - 1;
+        if (BPF_OP(jump->code) == BPF_JA) {
+            jump->k = offset;
+        } else {
+            jump->jt = offset;
+        }
+    }
+    for (i = acceptJumps; i < acceptJumps + (addressCount ? addressCount + 1 : 0); i++) {
+        code[i].jt = accept - i - 1;
+    }
+
+    struct sock_fprog program = {0};
+    program.len = n;
+    program.filter = code;
+
+    int result = setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program));
+    if (result == -1) {
+        perror("filter_attach: setsockopt(SO_ATTACH_FILTER)");
+    }
+    free(code);
+    return result;
+}
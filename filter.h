@@ -0,0 +1,8 @@
+#ifndef _filter_h
+#define _filter_h
+
+#include <stdint.h>
+
+int filter_attach(int sock, char *localAddresses, int addressCount);
+
+#endif
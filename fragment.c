@@ -0,0 +1,229 @@
+#include "fragment.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Store the messages being reassembled.
+ */
+struct reassembly reassemblySlots[REASSEMBLY_SLOTS] = {0};
+
+/**
+ * Store the timer wheel the reassembly timeouts are kept in, and how long a message may take to arrive,
+ * in milliseconds.
+ */
+struct timer_wheel *fragmentWheel;
+unsigned int fragmentTimeout;
+
+/**
+ * Store the ID of the next message split into fragments.
+ */
+uint16_t fragmentNextId = 0;
+
+/**
+ * Store the counters for fragmentation and reassembly.
+ */
+struct fragment_stats fragmentStats = {0};
+
+/**
+ * Drop a message that did not complete in time.
+ * Input:
+ *      timer - The timer of the reassembly slot.
+ */
+void fragment_expired(struct timer *timer) {
+    struct reassembly *slot = timer->data;
+    slot->active = 0;
+    fragmentStats.timeouts++;
+}
+
+/**
+ * Set up the reassembly timeouts.
+ * Input:
+ *      wheel - The timer wheel to keep the timeouts in.
+ *      timeout - Time in milliseconds from the first fragment of a message until it is dropped if incomplete.
+ */
+void fragment_init(struct timer_wheel *wheel, unsigned int timeout) {
+    fragmentWheel = wheel;
+    fragmentTimeout = timeout;
+
+    int i;
+    for (i = 0; i < REASSEMBLY_SLOTS; i++) {
+        timer_init(&reassemblySlots[i].timer, fragment_expired, &reassemblySlots[i]);
+    }
+}
+
+/**
+ * Get the number of message bytes in a fragment.
+ * Input:
+ *      length - Length of the whole message.
+ *      index - Position of the fragment.
+ * Return:
+ *      The number of bytes, 0 if the message has no such fragment.
+ */
+size_t fragment_data_length(size_t length, unsigned int index) {
+    size_t offset = (size_t)index * MIP_FRAGMENT_DATA_SIZE;
+    if (offset >= length) {
+        return 0;
+    }
+    return length - offset < MIP_FRAGMENT_DATA_SIZE ? length - offset : MIP_FRAGMENT_DATA_SIZE;
+}
+
+/**
+ * Get the length of the payload of a fragment, including the fragment header.
+ * Input:
+ *      length - Length of the whole message.
+ *      index - Position of the fragment.
+ * Return:
+ *      The length in bytes, before padding.
+ */
+size_t fragment_payload_length(size_t length, unsigned int index) {
+    return MIP_FRAGMENT_HEADER_SIZE + fragment_data_length(length, index);
+}
+
+/**
+ * Split a message into fragments, each in its own frame buffer, ready to be sent as a MIP_FRAGMENT payload.
+ * Input:
+ *      message - The message.
+ *      length - Length of the message. Larger than MAX_PAYLOAD_SIZE, at most MAX_MESSAGE_SIZE.
+ * Return:
+ *      The first fragment, with a single reference. The rest follow through frame_buffer->more.
+ */
+struct frame_buffer *fragment_split(const char *message, size_t length) {
+    struct mip_fragment header;
+    header.id = htons(fragmentNextId++);
+    header.length = htonl(length);
+
+    struct frame_buffer *first = NULL, *last = NULL;
+    unsigned int index;
+    for (index = 0; index * MIP_FRAGMENT_DATA_SIZE < length; index++) {
+        struct frame_buffer *buffer = frame_alloc();
+        char *payload = buffer->data + FRAME_PAYLOAD_OFFSET;
+
+        header.index = htons(index);
+        memcpy(payload, &header, sizeof(header));
+        memcpy(
+            payload + MIP_FRAGMENT_HEADER_SIZE,
+            message + index * MIP_FRAGMENT_DATA_SIZE,
+            fragment_data_length(length, index)
+        );
+
+        if (last) {
+            last->more = buffer;
+        } else {
+            first = buffer;
+        }
+        last = buffer;
+    }
+
+    fragmentStats.split++;
+    return first;
+}
+
+/**
+ * Find the slot reassembling a message, or take one for it. Takes the oldest slot if every slot is in use.
+ * Input:
+ *      source - The MIP address the message is from.
+ *      id - The ID of the message.
+ *      length - Length of the whole message.
+ *      now - The current time, in milliseconds.
+ * Return:
+ *      The slot.
+ */
+struct reassembly *fragment_slot(uint8_t source, uint16_t id, uint32_t length, uint64_t now) {
+    struct reassembly *slot = NULL;
+    int i;
+    for (i = 0; i < REASSEMBLY_SLOTS; i++) {
+        struct reassembly *tmp = &reassemblySlots[i];
+        if (tmp->active && tmp->source == source && tmp->id == id) {
+            return tmp;
+        }
+        if (!slot || (slot->active && (!tmp->active || tmp->started < slot->started))) {
+            slot = tmp;
+        }
+    }
+
+    if (slot->active) {
+        fragmentStats.evicted++;
+    }
+    if (!slot->data) {
+        slot->data = malloc(MAX_MESSAGE_SIZE);
+        if (!slot->data) {
+            perror("fragment_slot: malloc()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    slot->active = 1;
+    slot->source = source;
+    slot->id = id;
+    slot->length = length;
+    slot->missing = (length + MIP_FRAGMENT_DATA_SIZE - 1) / MIP_FRAGMENT_DATA_SIZE;
+    slot->received = 0;
+    slot->started = now;
+    timer_add(fragmentWheel, &slot->timer, now + fragmentTimeout);
+    return slot;
+}
+
+/**
+ * Add a received fragment to its message.
+ * Input:
+ *      source - The MIP address the fragment is from.
+ *      payload - The payload of the MIP_FRAGMENT frame, starting with the fragment header.
+ *      payloadLength - Length of the payload, including padding.
+ *      now - The current time, in milliseconds.
+ *      length - Where to store the length of the message, once it is complete.
+ * Return:
+ *      The whole message if this was its last missing fragment, valid until the next call. NULL otherwise.
+ */
+char *fragment_receive(uint8_t source, char *payload, size_t payloadLength, uint64_t now, size_t *length) {
+    if (payloadLength < MIP_FRAGMENT_HEADER_SIZE) {
+        fragmentStats.invalid++;
+        return NULL;
+    }
+    struct mip_fragment header;
+    memcpy(&header, payload, sizeof(header));
+    uint16_t id = ntohs(header.id);
+    uint16_t index = ntohs(header.index);
+    uint32_t messageLength = ntohl(header.length);
+
+    size_t dataLength = fragment_data_length(messageLength, index);
+    if (
+        messageLength > MAX_MESSAGE_SIZE
+        || !dataLength
+        || payloadLength < MIP_FRAGMENT_HEADER_SIZE + dataLength
+    ) {
+        fragmentStats.invalid++;
+        return NULL;
+    }
+
+    struct reassembly *slot = fragment_slot(source, id, messageLength, now);
+    if (slot->length != messageLength) {
+        fragmentStats.invalid++;
+        return NULL;
+    }
+    if (slot->received & (1ULL << index)) { // Duplicate.
+        return NULL;
+    }
+
+    memcpy(slot->data + (size_t)index * MIP_FRAGMENT_DATA_SIZE, payload + MIP_FRAGMENT_HEADER_SIZE, dataLength);
+    slot->received |= 1ULL << index;
+    if (--slot->missing) {
+        return NULL;
+    }
+
+    timer_cancel(fragmentWheel, &slot->timer);
+    slot->active = 0;
+    fragmentStats.reassembled++;
+    *length = messageLength;
+    return slot->data;
+}
+
+/**
+ * Get the counters for fragmentation and reassembly.
+ * Return:
+ *      A pointer to the counters.
+ */
+struct fragment_stats *fragment_get_stats() {
+    return &fragmentStats;
+}
@@ -0,0 +1,76 @@
+#ifndef _fragment_h
+#define _fragment_h
+
+#include "ethernet.h"
+#include "frame_pool.h"
+#include "shared.h"
+#include "timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Size of the fragment header at the start of the payload of every MIP_FRAGMENT frame.
+ */
+#define MIP_FRAGMENT_HEADER_SIZE 8
+
+/**
+ * Max number of message bytes carried by a single fragment. A multiple of 4, so no fragment but the last is padded.
+ */
+#define MIP_FRAGMENT_DATA_SIZE (MAX_PAYLOAD_SIZE - MIP_FRAGMENT_HEADER_SIZE)
+
+/**
+ * Max number of fragments of a single message. Must fit in the bitmap of struct reassembly.
+ */
+#define FRAGMENT_MAX_COUNT ((MAX_MESSAGE_SIZE + MIP_FRAGMENT_DATA_SIZE - 1) / MIP_FRAGMENT_DATA_SIZE)
+
+/**
+ * Max number of messages being reassembled at once. The oldest is dropped to make room for a new one.
+ */
+#define REASSEMBLY_SLOTS 16
+
+/**
+ * The fragment header, in network byte order.
+ */
+struct mip_fragment {
+    uint16_t id; // Chosen by the sender, the same for every fragment of a message.
+    uint16_t index; // Position of the fragment in the message, starting at 0.
+    uint32_t length; // Length of the whole message, in bytes.
+} __attribute__((packed));
+
+/**
+ * A message being reassembled from its fragments.
+ */
+struct reassembly {
+    char active; // Whether the slot is in use.
+    uint8_t source; // The MIP address the message is from.
+    uint16_t id; // The ID of the message.
+    uint32_t length; // Length of the whole message, in bytes.
+    int missing; // Number of fragments not received yet.
+    uint64_t received; // Bitmap of the fragments received, by index.
+    uint64_t started; // When the first fragment arrived, in milliseconds.
+    struct timer timer; // Drops the message if it is not complete in time.
+    char *data; // The message. MAX_MESSAGE_SIZE bytes, kept when the slot is reused.
+};
+
+/**
+ * Counters for fragmentation and reassembly.
+ */
+struct fragment_stats {
+    uint64_t split; // Messages split into fragments.
+    uint64_t reassembled; // Messages reassembled and delivered.
+    uint64_t timeouts; // Messages dropped because a fragment did not arrive in time.
+    uint64_t evicted; // Messages dropped to make room for a newer one.
+    uint64_t invalid; // Fragments dropped for not matching their message.
+};
+
+void fragment_init(struct timer_wheel *wheel, unsigned int timeout);
+
+struct frame_buffer *fragment_split(const char *message, size_t length);
+size_t fragment_payload_length(size_t length, unsigned int index);
+
+char *fragment_receive(uint8_t source, char *payload, size_t payloadLength, uint64_t now, size_t *length);
+
+struct fragment_stats *fragment_get_stats();
+
+#endif
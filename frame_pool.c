@@ -0,0 +1,75 @@
+#include "frame_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Store the free buffers of the pool, as a linked list.
+ */
+struct frame_buffer *framePool = NULL;
+
+/**
+ * Add buffers to the pool. They are never given back to the system.
+ * Input:
+ *      count - Number of buffers to add.
+ * Error:
+ *      Will end the program if the memory cannot be allocated.
+ */
+void frame_pool_init(size_t count) {
+    struct frame_buffer *buffers = malloc(count * sizeof(struct frame_buffer));
+    if (!buffers) {
+        perror("frame_pool_init: malloc()");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        buffers[i].refs = 0;
+        buffers[i].next = framePool;
+        framePool = &buffers[i];
+    }
+}
+
+/**
+ * Take a buffer from the pool, growing the pool if it is empty. The content is not cleared.
+ * Return:
+ *      The buffer, with a single reference.
+ */
+struct frame_buffer *frame_alloc() {
+    if (!framePool) {
+        frame_pool_init(FRAME_POOL_GROW);
+    }
+    struct frame_buffer *buffer = framePool;
+    framePool = buffer->next;
+    buffer->next = NULL;
+    buffer->more = NULL;
+    buffer->refs = 1;
+    return buffer;
+}
+
+/**
+ * Take another reference to a buffer.
+ * Input:
+ *      buffer - The buffer.
+ * Return:
+ *      The buffer.
+ */
+struct frame_buffer *frame_ref(struct frame_buffer *buffer) {
+    buffer->refs++;
+    return buffer;
+}
+
+/**
+ * Drop a reference to a buffer, giving it back to the pool when it was the last one. The reference it holds to
+ * the next fragment, if any, is dropped along with it.
+ * Input:
+ *      buffer - The buffer. Must not be used again by the caller.
+ */
+void frame_unref(struct frame_buffer *buffer) {
+    while (buffer && --buffer->refs == 0) {
+        struct frame_buffer *more = buffer->more;
+        buffer->next = framePool;
+        framePool = buffer;
+        buffer = more;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef _frame_pool_h
+#define _frame_pool_h
+
+#include "ethernet.h"
+#include "mip.h"
+
+#include <stddef.h>
+
+/**
+ * Offset of the MIP payload in a frame buffer, after the ethernet and MIP headers.
+ */
+#define FRAME_PAYLOAD_OFFSET (sizeof(struct ethernet_frame) + MIP_HEADER_SIZE)
+
+/**
+ * Size of a frame buffer. Fits a full frame, or the MAX_PACKET_SIZE payload of a session message.
+ */
+#define FRAME_BUFFER_SIZE (FRAME_PAYLOAD_OFFSET + MAX_PACKET_SIZE)
+
+/**
+ * Number of buffers allocated up front.
+ */
+#define FRAME_POOL_SIZE 256
+
+/**
+ * Number of buffers allocated at a time when the pool runs dry.
+ */
+#define FRAME_POOL_GROW 64
+
+/**
+ * A reference counted frame buffer. Used by the main thread only.
+ * A payload is received into it once, and then queued and sent by reference instead of copied.
+ */
+struct frame_buffer {
+    struct frame_buffer *next; // Next free buffer, while in the pool.
+    struct frame_buffer *more; // Next fragment of a message too large for a single frame, or NULL. Owned by this buffer.
+    int refs; // Number of references. Back in the pool at 0.
+    char data[FRAME_BUFFER_SIZE];
+};
+
+void frame_pool_init(size_t count);
+struct frame_buffer *frame_alloc();
+struct frame_buffer *frame_ref(struct frame_buffer *buffer);
+void frame_unref(struct frame_buffer *buffer);
+
+#endif
@@ -0,0 +1,128 @@
+#include "histogram.h"
+
+#include <string.h>
+
+/**
+ * Get the bucket a value belongs in.
+ * Input:
+ *      value - The value.
+ * Return:
+ *      The index of the bucket.
+ */
+unsigned int histogram_index(uint64_t value) {
+    if (value < (1ULL << HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+    // Keep the HISTOGRAM_SUB_BITS most significant bits, and count how many were shifted out.
+    unsigned int shift = 64 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return (shift << (HISTOGRAM_SUB_BITS - 1)) + (value >> shift);
+}
+
+/**
+ * Get the highest value that belongs in a bucket.
+ * Input:
+ *      index - The index of the bucket.
+ * Return:
+ *      The value.
+ */
+uint64_t histogram_value(unsigned int index) {
+    if (index < (1U << HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+    unsigned int shift = (index >> (HISTOGRAM_SUB_BITS - 1)) - 1;
+    uint64_t sub = index - (shift << (HISTOGRAM_SUB_BITS - 1));
+    return (sub << shift) + ((1ULL << shift) - 1);
+}
+
+/**
+ * Prepare an empty histogram.
+ * Input:
+ *      h - The histogram.
+ */
+void histogram_init(struct histogram *h) {
+    memset(h, 0, sizeof(struct histogram));
+    h->min = UINT64_MAX;
+}
+
+/**
+ * Record a value.
+ * Input:
+ *      h - The histogram.
+ *      value - The value.
+ */
+void histogram_record(struct histogram *h, uint64_t value) {
+    h->buckets[histogram_index(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * Add every value recorded in one histogram to another.
+ * Input:
+ *      h - The histogram to add to.
+ *      other - The histogram to add.
+ */
+void histogram_merge(struct histogram *h, struct histogram *other) {
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        h->buckets[i] += other->buckets[i];
+    }
+    h->count += other->count;
+    h->sum += other->sum;
+    if (other->min < h->min) {
+        h->min = other->min;
+    }
+    if (other->max > h->max) {
+        h->max = other->max;
+    }
+}
+
+/**
+ * Get the value at a percentile.
+ * Input:
+ *      h - The histogram.
+ *      percentile - The percentile, from 0 to 100.
+ * Return:
+ *      The highest value equivalent to the one at the percentile, never above the max. 0 if empty.
+ */
+uint64_t histogram_percentile(struct histogram *h, double percentile) {
+    if (!h->count) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    if (target > h->count) {
+        target = h->count;
+    }
+
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            uint64_t value = histogram_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * Get the mean of the recorded values.
+ * Input:
+ *      h - The histogram.
+ * Return:
+ *      The mean, or 0 if empty.
+ */
+double histogram_mean(struct histogram *h) {
+    return h->count ? (double)h->sum / h->count : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef _histogram_h
+#define _histogram_h
+
+#include <stdint.h>
+
+/**
+ * Number of bits of precision kept for each value. Values are recorded with a relative error of at most
+ * 1 / 2^(HISTOGRAM_SUB_BITS - 1), under 1%.
+ */
+#define HISTOGRAM_SUB_BITS 8
+
+/**
+ * Number of buckets needed to cover every 64 bit value.
+ */
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+
+/**
+ * A log-linear histogram in the style of HdrHistogram. Every power of two range is split into the same
+ * number of linear buckets, so small and large values are recorded with the same relative precision.
+ */
+struct histogram {
+    uint64_t count; // Number of recorded values.
+    uint64_t min; // Smallest recorded value.
+    uint64_t max; // Largest recorded value.
+    uint64_t sum; // Sum of every recorded value, for the mean.
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_init(struct histogram *h);
+void histogram_record(struct histogram *h, uint64_t value);
+void histogram_merge(struct histogram *h, struct histogram *other);
+uint64_t histogram_percentile(struct histogram *h, double percentile);
+double histogram_mean(struct histogram *h);
+
+#endif
@@ -0,0 +1,29 @@
+#include "interface.h"
+
+#include <stdio.h>
+
+struct eth_interface *interfaceTable[MAX_INTERFACES] = {0};
+int interfaceCount = 0;
+struct eth_interface *interfaceByFd[INTERFACE_MAX_FD] = {0};
+uint64_t interfaceLocal[4] = {0};
+
+/**
+ * Add an opened interface to the lookup tables, giving it the next free ID. Its MIP address must be set.
+ * Input:
+ *      interface - The interface.
+ * Return:
+ *      The ID of the interface, or -1 if there are too many interfaces, or its socket does not fit in the table.
+ */
+int interface_add(struct eth_interface *interface) {
+    if (interfaceCount >= MAX_INTERFACES || interface->sock < 0 || interface->sock >= INTERFACE_MAX_FD) {
+        return -1;
+    }
+
+    interface->id = interfaceCount;
+    interfaceTable[interfaceCount++] = interface;
+    interfaceByFd[interface->sock] = interface;
+
+    uint8_t mip = interface->mip_addr;
+    interfaceLocal[mip >> 6] |= 1ULL << (mip & 63);
+    return interface->id;
+}
@@ -0,0 +1,61 @@
+#ifndef _interface_h
+#define _interface_h
+
+#include "daemon.h"
+
+#include <stdint.h>
+
+/**
+ * Max number of interfaces. IDs are 0 up to this.
+ */
+#define MAX_INTERFACES 64
+
+/**
+ * Max file descriptor of an interface socket, plus 1.
+ */
+#define INTERFACE_MAX_FD 1024
+
+/**
+ * Store every interface by ID, with no gaps, and how many there are.
+ */
+extern struct eth_interface *interfaceTable[MAX_INTERFACES];
+extern int interfaceCount;
+
+/**
+ * Store the interface of every socket, by file descriptor.
+ */
+extern struct eth_interface *interfaceByFd[INTERFACE_MAX_FD];
+
+/**
+ * Store a bitmap of our own MIP addresses.
+ */
+extern uint64_t interfaceLocal[4];
+
+int interface_add(struct eth_interface *interface);
+
+/**
+ * Find the interface a socket belongs to.
+ * Input:
+ *      fd - The socket.
+ * Return:
+ *      The interface, or NULL if the socket does not belong to an interface.
+ */
+static inline struct eth_interface *interface_by_fd(int fd) {
+    if (fd < 0 || fd >= INTERFACE_MAX_FD) {
+        return NULL;
+    }
+    return interfaceByFd[fd];
+}
+
+/**
+ * Get whether a MIP address is one of our own.
+ * Input:
+ *      mip - The MIP address.
+ * Return:
+ *      1 if it is, 0 otherwise.
+ */
+static inline int interface_is_local(uint8_t mip) {
+    return (interfaceLocal[mip >> 6] >> (mip & 63)) & 1;
+}
+
+#endif
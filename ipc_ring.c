@@ -0,0 +1,245 @@
+#include "ipc_ring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Map the shared memory of a pair of rings, and find the rings and their slots in it. Only our own constants
+ * are used, never the sizes stored in the rings.
+ * Input:
+ *      rings - Where to store the mapping.
+ *      memfd - The memfd holding the rings.
+ * Return:
+ *      0 if successful, -1 if the memory could not be mapped.
+ */
+int ipc_rings_map(struct ipc_rings *rings, int memfd) {
+    size_t ringSize = spsc_shared_size(IPC_RING_SLOTS, IPC_RING_ITEM_SIZE);
+    rings->mapLength = 2 * ringSize;
+    rings->map = mmap(NULL, rings->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (rings->map == MAP_FAILED) {
+        perror("ipc_rings_map: mmap()");
+        return -1;
+    }
+    rings->toDaemon.shared = rings->map;
+    rings->toDaemon.items = (char *)(rings->toDaemon.shared + 1);
+    rings->toClient.shared = (struct spsc_ring *)((char *)rings->map + ringSize);
+    rings->toClient.items = (char *)(rings->toClient.shared + 1);
+    return 0;
+}
+
+/**
+ * Daemon: Create a pair of empty rings in a new memfd, and the eventfds for them. The memfd is sealed at its size.
+ * Input:
+ *      rings - Where to store the rings.
+ *      memfd - Where to store the memfd, to send to the process. The caller closes it once sent.
+ * Return:
+ *      0 if successful, -1 otherwise.
+ */
+int ipc_rings_create(struct ipc_rings *rings, int *memfd) {
+    *memfd = memfd_create("mip_rings", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*memfd == -1) {
+        perror("ipc_rings_create: memfd_create()");
+        return -1;
+    }
+    if (ftruncate(*memfd, 2 * spsc_shared_size(IPC_RING_SLOTS, IPC_RING_ITEM_SIZE)) == -1) {
+        perror("ipc_rings_create: ftruncate()");
+        close(*memfd);
+        return -1;
+    }
+    if (fcntl(*memfd, F_ADD_SEALS, IPC_RING_SEALS) == -1) {
+        perror("ipc_rings_create: fcntl()");
+        close(*memfd);
+        return -1;
+    }
+    if (ipc_rings_map(rings, *memfd) == -1) {
+        close(*memfd);
+        return -1;
+    }
+    spsc_init_shared(rings->toDaemon.shared, IPC_RING_SLOTS, IPC_RING_ITEM_SIZE);
+    spsc_init_shared(rings->toClient.shared, IPC_RING_SLOTS, IPC_RING_ITEM_SIZE);
+
+    rings->daemonEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    rings->clientEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rings->daemonEvent == -1 || rings->clientEvent == -1) {
+        perror("ipc_rings_create: eventfd()");
+        ipc_rings_close(rings);
+        close(*memfd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Process: Use a pair of rings received from the daemon.
+ * Input:
+ *      rings - Where to store the rings.
+ *      memfd - The memfd holding the rings. Closed, since the mapping is all that is needed.
+ *      daemonEvent - The eventfd waking the daemon.
+ *      clientEvent - The eventfd the daemon wakes us with.
+ * Return:
+ *      0 if successful, -1 if the memory could not be used, or is not sealed like the daemon seals it.
+ */
+int ipc_rings_attach(struct ipc_rings *rings, int memfd, int daemonEvent, int clientEvent) {
+    rings->daemonEvent = daemonEvent;
+    rings->clientEvent = clientEvent;
+
+    struct stat st;
+    if (
+        fstat(memfd, &st) == -1
+        || (size_t)st.st_size != 2 * spsc_shared_size(IPC_RING_SLOTS, IPC_RING_ITEM_SIZE)
+        || fcntl(memfd, F_GET_SEALS) != IPC_RING_SEALS
+        || ipc_rings_map(rings, memfd) == -1
+    ) {
+        close(memfd);
+        rings->map = MAP_FAILED;
+        ipc_rings_close(rings);
+        return -1;
+    }
+    close(memfd);
+    return 0;
+}
+
+/**
+ * Process: Use the rings carried by a SHM_RINGS reply from the daemon. A reply without them means the daemon
+ * refused, and every message keeps going through the socket.
+ * Input:
+ *      message - The reply, as received with recvmsg(), with room for three file descriptors of control data.
+ *      rings - Where to store the rings.
+ * Return:
+ *      0 if successful, -1 if the reply carried no usable rings.
+ */
+int ipc_rings_receive(struct msghdr *message, struct ipc_rings *rings) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(message);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    int fds[3];
+    if (cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        // Close whatever was passed, rather than leak it.
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        while (n-- > 0) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + n * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    return ipc_rings_attach(rings, fds[0], fds[1], fds[2]);
+}
+
+/**
+ * Unmap a pair of rings, and close the eventfds.
+ * Input:
+ *      rings - The rings.
+ */
+void ipc_rings_close(struct ipc_rings *rings) {
+    if (rings->map != MAP_FAILED && rings->map) {
+        munmap(rings->map, rings->mapLength);
+    }
+    rings->map = NULL;
+    if (rings->daemonEvent != -1) {
+        close(rings->daemonEvent);
+    }
+    if (rings->clientEvent != -1) {
+        close(rings->clientEvent);
+    }
+    rings->daemonEvent = -1;
+    rings->clientEvent = -1;
+}
+
+/**
+ * Daemon: Check that the process has not broken a ring, by holding more messages than it has slots. This is only
+ * to stop talking to a broken process: whatever it writes, the indexes are masked with our own slot count, and
+ * every length is checked, so the daemon never reads or writes outside the slots. The seals on the memfd keep
+ * the process from shrinking the memory under the mapping.
+ * Input:
+ *      ring - The ring.
+ * Return:
+ *      1 if the ring is still usable, 0 otherwise.
+ */
+int ipc_rings_valid(struct ipc_ring *ring) {
+    size_t head = __atomic_load_n(&ring->shared->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&ring->shared->tail, __ATOMIC_ACQUIRE);
+    return tail - head <= IPC_RING_SLOTS;
+}
+
+/**
+ * Producer: Push a message to a ring. The other side is not woken, see ipc_rings_wake().
+ * Input:
+ *      ring - The ring.
+ *      header - The header of the message. Its length must be at most IPC_RING_MAX_PAYLOAD.
+ *      payload - The payload, header->length bytes.
+ * Return:
+ *      0 if successful, -1 if the ring is full.
+ */
+int ipc_rings_push(struct ipc_ring *ring, struct ipc_header *header, const char *payload) {
+    char *slot = spsc_reserve_slots(ring->shared, ring->items, IPC_RING_SLOTS, IPC_RING_ITEM_SIZE);
+    if (!slot) {
+        return -1;
+    }
+    memcpy(slot, header, sizeof(*header));
+    if (header->length) {
+        memcpy(slot + sizeof(*header), payload, header->length);
+    }
+    spsc_push(ring->shared);
+    return 0;
+}
+
+/**
+ * Consumer: Get the oldest message in a ring, in place. Pop it with ipc_rings_pop() once done with it.
+ * Input:
+ *      ring - The ring.
+ *      header - Where to store a copy of the header of the message. Its length is as written by the producer:
+ *               check it against IPC_RING_MAX_PAYLOAD before reading the payload.
+ * Return:
+ *      A pointer to the payload, or NULL if the ring is empty.
+ */
+char *ipc_rings_peek(struct ipc_ring *ring, struct ipc_header *header) {
+    char *slot = spsc_peek_slots(ring->shared, ring->items, IPC_RING_SLOTS, IPC_RING_ITEM_SIZE);
+    if (!slot) {
+        return NULL;
+    }
+    memcpy(header, slot, sizeof(*header));
+    return slot + sizeof(*header);
+}
+
+/**
+ * Consumer: Remove the oldest message in a ring, giving its slot back to the producer.
+ * Input:
+ *      ring - The ring.
+ */
+void ipc_rings_pop(struct ipc_ring *ring) {
+    spsc_pop(ring->shared);
+}
+
+/**
+ * Wake the other side of a ring, after pushing one or more messages.
+ * Input:
+ *      eventFd - The eventfd of the other side.
+ */
+void ipc_rings_wake(int eventFd) {
+    uint64_t one = 1;
+    if (write(eventFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("ipc_rings_wake: write()");
+    }
+}
+
+/**
+ * Reset our own eventfd, before popping every message in the ring. Messages pushed after this wake us again.
+ * Input:
+ *      eventFd - Our eventfd.
+ */
+void ipc_rings_clear(int eventFd) {
+    uint64_t value;
+    if (read(eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("ipc_rings_clear: read()");
+    }
+}
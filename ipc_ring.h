@@ -0,0 +1,72 @@
+#ifndef _ipc_ring_h
+#define _ipc_ring_h
+
+#include "ethernet.h"
+#include "shared.h"
+#include "spsc.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Number of messages each ring holds.
+ */
+#define IPC_RING_SLOTS 256
+
+/**
+ * Size of a slot: a struct ipc_header followed by the payload. Larger messages go through the socket.
+ */
+#define IPC_RING_ITEM_SIZE (sizeof(struct ipc_header) + MAX_PACKET_SIZE)
+
+/**
+ * Max payload of a message sent through a ring.
+ */
+#define IPC_RING_MAX_PAYLOAD MAX_PACKET_SIZE
+
+/**
+ * Seals on the memfd holding the rings. Its size is fixed, so the process cannot shrink it under the daemon's
+ * mapping and have the daemon killed by SIGBUS.
+ */
+#define IPC_RING_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/**
+ * One of the rings in shared memory, as seen by one side. Where the slots are and how large they are is kept
+ * here, out of reach of the other process: only the indexes are read from the shared memory.
+ */
+struct ipc_ring {
+    struct spsc_ring *shared; // The ring in the shared memory.
+    char *items; // Its IPC_RING_SLOTS slots of IPC_RING_ITEM_SIZE, right after it.
+};
+
+/**
+ * A pair of rings in shared memory between the daemon and a process, and the eventfds waking each side.
+ * Requested with SHM_RINGS once a session uses the length prefixed format. The daemon answers with SHM_RINGS
+ * and three file descriptors (SCM_RIGHTS): the memfd holding the rings, daemonEvent and clientEvent. SHM_RINGS
+ * without them means the daemon refused.
+ * A producer pushes any number of messages before writing 1 to the eventfd of the other side, once.
+ * Every message can also still be sent through the socket, for instance when a ring is full.
+ */
+struct ipc_rings {
+    void *map; // The shared memory: toDaemon and its slots, then toClient and its slots.
+    size_t mapLength;
+    struct ipc_ring toDaemon; // Messages from the process. Popped by the daemon.
+    struct ipc_ring toClient; // Messages to the process. Pushed by the daemon.
+    int daemonEvent; // Written by the process after pushing to toDaemon.
+    int clientEvent; // Written by the daemon after pushing to toClient.
+};
+
+int ipc_rings_create(struct ipc_rings *rings, int *memfd);
+int ipc_rings_attach(struct ipc_rings *rings, int memfd, int daemonEvent, int clientEvent);
+int ipc_rings_receive(struct msghdr *message, struct ipc_rings *rings);
+void ipc_rings_close(struct ipc_rings *rings);
+int ipc_rings_valid(struct ipc_ring *ring);
+
+int ipc_rings_push(struct ipc_ring *ring, struct ipc_header *header, const char *payload);
+char *ipc_rings_peek(struct ipc_ring *ring, struct ipc_header *header);
+void ipc_rings_pop(struct ipc_ring *ring);
+void ipc_rings_wake(int eventFd);
+void ipc_rings_clear(int eventFd);
+
+#endif
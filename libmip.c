@@ -0,0 +1,698 @@
+#include "libmip.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Add a file descriptor to the epoll instance of a connection, or change what it is waited for.
+ * Input:
+ *      client - The connection.
+ *      op - EPOLL_CTL_ADD or EPOLL_CTL_MOD.
+ *      fd - The file descriptor.
+ *      events - The events to wait for.
+ * Return:
+ *      0 if successful, -1 otherwise.
+ */
+int mip_client_watch(struct mip_client *client, int op, int fd, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(client->epollFd, op, fd, &ev);
+}
+
+/**
+ * Give up on a connection. Every later call fails, until it is closed with mip_close().
+ * Input:
+ *      client - The connection.
+ *      error - The errno to fail with.
+ * Return:
+ *      -1, for the caller to return.
+ */
+int mip_client_fail(struct mip_client *client, int error) {
+    client->state = MIP_CLIENT_CLOSED;
+    errno = error;
+    return -1;
+}
+
+/**
+ * Queue a message to be sent through the socket by mip_flush(). Sends the queued messages first if full.
+ * Input:
+ *      client - The connection.
+ *      header - The header of the message.
+ *      payload - The payload, header->length bytes.
+ * Return:
+ *      0 if successful, -1 if there is no room until the socket is writable again (errno EAGAIN).
+ */
+int mip_client_queue(struct mip_client *client, struct ipc_header *header, const char *payload) {
+    size_t length = sizeof(*header) + header->length;
+    if (client->sendCount == MIP_CLIENT_BATCH_SIZE || client->sendUsed + length > MIP_CLIENT_SEND_BUFFER) {
+        if (mip_flush(client) == -1) {
+            return -1;
+        }
+        if (client->sendCount == MIP_CLIENT_BATCH_SIZE || client->sendUsed + length > MIP_CLIENT_SEND_BUFFER) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    char *message = client->sendBuffer + client->sendUsed;
+    memcpy(message, header, sizeof(*header));
+    if (header->length) {
+        memcpy(message + sizeof(*header), payload, header->length);
+    }
+    client->sendUsed += length;
+
+    struct iovec *iov = &client->sendIovs[client->sendCount];
+    iov->iov_base = message;
+    iov->iov_len = length;
+    struct mmsghdr *msg = &client->sendMsgs[client->sendCount];
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_hdr.msg_iov = iov;
+    msg->msg_hdr.msg_iovlen = 1;
+    client->sendCount++;
+    return 0;
+}
+
+/**
+ * Send a message to the daemon: through shared memory if it fits, queued for the socket otherwise.
+ * Input:
+ *      client - The connection.
+ *      mip - The MIP address of the message.
+ *      info - The info/action of the message.
+ *      requestId - The request ID, or 0.
+ *      payload - The payload.
+ *      length - Length of the payload, at most MAX_MESSAGE_SIZE.
+ * Return:
+ *      0 if successful, -1 otherwise.
+ */
+int mip_client_submit(
+    struct mip_client *client,
+    uint8_t mip,
+    enum info info,
+    uint32_t requestId,
+    const char *payload,
+    size_t length
+) {
+    if (client->state == MIP_CLIENT_CLOSED) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (length > MAX_MESSAGE_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    struct ipc_header header = {0};
+    header.version = IPC_VERSION;
+    header.mip = mip;
+    header.info = info;
+    header.requestId = requestId;
+    header.length = length;
+
+    if (client->hasRings && length <= IPC_RING_MAX_PAYLOAD && ipc_rings_push(&client->rings.toDaemon, &header, payload) == 0) {
+        client->pushed = 1;
+        return 0;
+    }
+    return mip_client_queue(client, &header, payload);
+}
+
+/**
+ * Claim a slot for a request waiting for a reply.
+ * Input:
+ *      client - The connection.
+ *      callback - Called with the reply.
+ *      arg - Passed to the callback.
+ * Return:
+ *      The request ID of the request, or 0 if too many requests are waiting already (errno EBUSY).
+ */
+uint32_t mip_client_track(struct mip_client *client, mip_reply_callback callback, void *arg) {
+    uint32_t requestId = client->nextId;
+    struct mip_request *request = &client->requests[requestId & client->requestMask];
+    if (request->requestId) {
+        errno = EBUSY;
+        return 0;
+    }
+    request->requestId = requestId;
+    request->callback = callback;
+    request->arg = arg;
+    client->inFlight++;
+
+    client->nextId++;
+    if (!client->nextId) {
+        client->nextId = 1;
+    }
+    return requestId;
+}
+
+/**
+ * Forget a request, because it was answered or never sent.
+ * Input:
+ *      client - The connection.
+ *      requestId - The request ID.
+ */
+void mip_client_untrack(struct mip_client *client, uint32_t requestId) {
+    client->requests[requestId & client->requestMask].requestId = 0;
+    client->inFlight--;
+}
+
+/**
+ * Pass a message from the daemon to the callback it belongs to.
+ * Input:
+ *      client - The connection.
+ *      header - The header of the message.
+ *      payload - The payload.
+ *      length - Length of the payload.
+ * Return:
+ *      1 if a callback was called, 0 otherwise.
+ */
+int mip_client_dispatch(struct mip_client *client, struct ipc_header *header, char *payload, size_t length) {
+    if (header->requestId) {
+        struct mip_request *request = &client->requests[header->requestId & client->requestMask];
+        if (request->requestId != header->requestId) { // Not ours, or answered already.
+            return 0;
+        }
+        mip_reply_callback callback = request->callback;
+        void *arg = request->arg;
+        mip_client_untrack(client, header->requestId);
+        if (callback) {
+            callback(client, header->requestId, header->info, header->mip, payload, length, arg);
+        }
+        return 1;
+    }
+    if (header->info == NO_ERROR && client->listen) {
+        client->listen(client, header->mip, payload, length, client->listenArg);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Handle the daemon confirming the length prefixed format, in the legacy format, and ask for the rings next.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      0 if successful, or nothing arrived yet. -1 if the connection failed.
+ */
+int mip_client_upgraded(struct mip_client *client) {
+    unsigned char mip = 0;
+    enum info info = NO_ERROR;
+
+    struct iovec iov[3];
+    iov[0].iov_base = &mip;
+    iov[0].iov_len = sizeof(mip);
+    iov[1].iov_base = &info;
+    iov[1].iov_len = sizeof(info);
+    iov[2].iov_base = client->recvBuffer;
+    iov[2].iov_len = MAX_PACKET_SIZE;
+
+    struct msghdr message = {0};
+    message.msg_iov = iov;
+    message.msg_iovlen = 3;
+
+    ssize_t received = recvmsg(client->sock, &message, MSG_DONTWAIT);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    if (received <= 0) {
+        return mip_client_fail(client, received ? errno : ECONNRESET);
+    }
+    if (info != UPGRADE) { // The daemon only knows the legacy format.
+        return mip_client_fail(client, EPROTONOSUPPORT);
+    }
+
+    if (!(client->flags & MIP_CLIENT_RINGS)) {
+        client->state = MIP_CLIENT_READY;
+        return 0;
+    }
+    // Sent by mip_flush(), ahead of the queue, which may be full.
+    client->state = MIP_CLIENT_RINGS_WAIT;
+    client->requestRings = 1;
+    return 0;
+}
+
+/**
+ * Receive a single message while waiting for the rings, with room for the file descriptors carrying them.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      Number of callbacks called, 0 if nothing arrived, or -1 if the connection failed.
+ */
+int mip_client_receive_rings(struct mip_client *client) {
+    struct ipc_header header = {0};
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = client->recvBuffer;
+    iov[1].iov_len = MAX_MESSAGE_SIZE;
+
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message = {0};
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received = recvmsg(client->sock, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    if (received <= 0) {
+        return mip_client_fail(client, received ? errno : ECONNRESET);
+    }
+    if ((size_t)received < sizeof(header)) {
+        return 0;
+    }
+
+    if (header.info != SHM_RINGS) {
+        size_t length = received - sizeof(header);
+        return mip_client_dispatch(client, &header, client->recvBuffer, length < header.length ? length : header.length);
+    }
+    // Keep using the socket alone if the daemon refused.
+    if (ipc_rings_receive(&message, &client->rings) == 0) {
+        if (mip_client_watch(client, EPOLL_CTL_ADD, client->rings.clientEvent, EPOLLIN) == -1) {
+            ipc_rings_close(&client->rings);
+        } else {
+            client->hasRings = 1;
+        }
+    }
+    client->state = MIP_CLIENT_READY;
+    return 0;
+}
+
+/**
+ * Receive every message waiting on the socket, a batch at a time.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      Number of callbacks called, or -1 if the connection failed.
+ */
+int mip_client_receive(struct mip_client *client) {
+    struct iovec iovs[MIP_CLIENT_BATCH_SIZE][2];
+    struct mmsghdr msgs[MIP_CLIENT_BATCH_SIZE];
+    int called = 0;
+
+    while (1) {
+        int i;
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < MIP_CLIENT_BATCH_SIZE; i++) {
+            iovs[i][0].iov_base = &client->recvHeaders[i];
+            iovs[i][0].iov_len = sizeof(struct ipc_header);
+            iovs[i][1].iov_base = client->recvBuffer + (size_t)i * MAX_MESSAGE_SIZE;
+            iovs[i][1].iov_len = MAX_MESSAGE_SIZE;
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        int received = recvmmsg(client->sock, msgs, MIP_CLIENT_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return called;
+            }
+            return mip_client_fail(client, errno);
+        }
+        if (received == 0 || msgs[0].msg_len == 0) {
+            return mip_client_fail(client, ECONNRESET);
+        }
+
+        for (i = 0; i < received; i++) {
+            struct ipc_header *header = &client->recvHeaders[i];
+            if (msgs[i].msg_len < sizeof(*header) || header->version != IPC_VERSION) {
+                continue;
+            }
+            size_t length = msgs[i].msg_len - sizeof(*header);
+            if (header->length < length) {
+                length = header->length;
+            }
+            called += mip_client_dispatch(client, header, iovs[i][1].iov_base, length);
+        }
+        if (received < MIP_CLIENT_BATCH_SIZE) {
+            return called;
+        }
+    }
+}
+
+/**
+ * Handle every message waiting in the shared memory ring. Each payload is passed to its callback in place.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      Number of callbacks called.
+ */
+int mip_client_receive_ring(struct mip_client *client) {
+    int called = 0;
+    ipc_rings_clear(client->rings.clientEvent);
+
+    struct ipc_header header;
+    char *payload;
+    while ((payload = ipc_rings_peek(&client->rings.toClient, &header))) {
+        if (header.length > IPC_RING_MAX_PAYLOAD) {
+            header.length = IPC_RING_MAX_PAYLOAD;
+        }
+        called += mip_client_dispatch(client, &header, payload, header.length);
+        ipc_rings_pop(&client->rings.toClient);
+    }
+    return called;
+}
+
+/**
+ * Connect to the daemon, without waiting for it. The connection switches to the length prefixed format, and
+ * sets up the shared memory rings if asked to, as mip_process() handles the answers. Requests can be sent
+ * right away, and go out once the daemon has confirmed the format.
+ * Input:
+ *      path - Path of the Unix socket of the daemon.
+ *      slots - Max number of requests waiting for a reply at a time. Rounded up to a power of two.
+ *              0 for MIP_CLIENT_DEFAULT_SLOTS.
+ *      flags - MIP_CLIENT_RINGS or 0.
+ * Return:
+ *      The connection, or NULL if the daemon could not be reached (errno set).
+ */
+struct mip_client *mip_connect(const char *path, unsigned int slots, int flags) {
+    struct sockaddr_un sockaddr = {0};
+    if (strlen(path) >= sizeof(sockaddr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    sockaddr.sun_family = AF_UNIX;
+    strcpy(sockaddr.sun_path, path);
+
+    uint32_t size = 1;
+    while (size < (slots ? slots : MIP_CLIENT_DEFAULT_SLOTS)) {
+        size <<= 1;
+    }
+
+    struct mip_client *client = calloc(1, sizeof(struct mip_client));
+    if (!client) {
+        return NULL;
+    }
+    client->flags = flags;
+    client->nextId = 1;
+    client->requestMask = size - 1;
+    client->rings.daemonEvent = -1;
+    client->rings.clientEvent = -1;
+    client->requests = calloc(size, sizeof(struct mip_request));
+    client->sendBuffer = malloc(MIP_CLIENT_SEND_BUFFER);
+    client->recvBuffer = malloc((size_t)MIP_CLIENT_BATCH_SIZE * MAX_MESSAGE_SIZE);
+    client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    client->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (
+        !client->requests
+        || !client->sendBuffer
+        || !client->recvBuffer
+        || client->sock == -1
+        || client->epollFd == -1
+        || connect(client->sock, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1
+        || mip_client_watch(client, EPOLL_CTL_ADD, client->sock, EPOLLIN) == -1
+    ) {
+        int error = errno;
+        mip_close(client);
+        errno = error;
+        return NULL;
+    }
+
+    // The upgrade is the only message in the legacy format: MIP address, info, and a fixed size buffer.
+    char buffer[MAX_PACKET_SIZE] = {0};
+    unsigned char mip = 0;
+    enum info info = UPGRADE;
+
+    struct iovec iov[3];
+    iov[0].iov_base = &mip;
+    iov[0].iov_len = sizeof(mip);
+    iov[1].iov_base = &info;
+    iov[1].iov_len = sizeof(info);
+    iov[2].iov_base = buffer;
+    iov[2].iov_len = sizeof(buffer);
+
+    struct msghdr message = {0};
+    message.msg_iov = iov;
+    message.msg_iovlen = 3;
+
+    // Nothing else has been sent, so there is room for it.
+    if (sendmsg(client->sock, &message, MSG_NOSIGNAL) == -1) {
+        int error = errno;
+        mip_close(client);
+        errno = error;
+        return NULL;
+    }
+    client->state = MIP_CLIENT_UPGRADING;
+    return client;
+}
+
+/**
+ * Close a connection. Requests still waiting for a reply are forgotten, without calling their callbacks.
+ * Must not be called from a callback.
+ * Input:
+ *      client - The connection.
+ */
+void mip_close(struct mip_client *client) {
+    if (client->hasRings) {
+        ipc_rings_close(&client->rings);
+    }
+    if (client->sock != -1) {
+        close(client->sock);
+    }
+    if (client->epollFd != -1) {
+        close(client->epollFd);
+    }
+    free(client->requests);
+    free(client->sendBuffer);
+    free(client->recvBuffer);
+    free(client);
+}
+
+/**
+ * Get the file descriptor to wait for, with poll() or epoll, before calling mip_process(). It is readable
+ * whenever there is something to receive, or queued messages can be sent.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      The file descriptor.
+ */
+int mip_client_fd(struct mip_client *client) {
+    return client->epollFd;
+}
+
+/**
+ * Send a payload to a MIP address, and expect a response.
+ * Input:
+ *      client - The connection.
+ *      mip - The destination.
+ *      payload - The payload.
+ *      length - Length of the payload, at most MAX_MESSAGE_SIZE.
+ *      callback - Called with the response, or the error, from mip_process(). May be NULL.
+ *      arg - Passed to the callback.
+ * Return:
+ *      The request ID, or 0 if the request could not be sent (errno set). EBUSY if too many requests are
+ *      waiting for a reply, EAGAIN if the queue is full until the socket is writable again.
+ */
+uint32_t mip_send(
+    struct mip_client *client,
+    uint8_t mip,
+    const char *payload,
+    size_t length,
+    mip_reply_callback callback,
+    void *arg
+) {
+    uint32_t requestId = mip_client_track(client, callback, arg);
+    if (!requestId) {
+        return 0;
+    }
+    if (mip_client_submit(client, mip, NO_ERROR, requestId, payload, length) == -1) {
+        int error = errno;
+        mip_client_untrack(client, requestId);
+        errno = error;
+        return 0;
+    }
+    return requestId;
+}
+
+/**
+ * Answer a payload passed to the listen callback, without expecting anything back.
+ * Input:
+ *      client - The connection.
+ *      mip - The MIP address the payload came from.
+ *      payload - The response.
+ *      length - Length of the response, at most MAX_MESSAGE_SIZE.
+ * Return:
+ *      0 if successful, -1 otherwise (errno set, as mip_send()).
+ */
+int mip_reply(struct mip_client *client, uint8_t mip, const char *payload, size_t length) {
+    return mip_client_submit(client, mip, NO_RESPONSE, 0, payload, length);
+}
+
+/**
+ * Ask the daemon for a snapshot of its statistics, see stats.h.
+ * Input:
+ *      client - The connection.
+ *      callback - Called with STATS and the snapshot.
+ *      arg - Passed to the callback.
+ * Return:
+ *      The request ID, or 0 if the request could not be sent (errno set, as mip_send()).
+ */
+uint32_t mip_request_stats(struct mip_client *client, mip_reply_callback callback, void *arg) {
+    uint32_t requestId = mip_client_track(client, callback, arg);
+    if (!requestId) {
+        return 0;
+    }
+    if (mip_client_submit(client, 0, STATS, requestId, NULL, 0) == -1) {
+        int error = errno;
+        mip_client_untrack(client, requestId);
+        errno = error;
+        return 0;
+    }
+    return requestId;
+}
+
+/**
+ * Serve incoming payloads: ask the daemon to pass on every payload sent to us.
+ * Input:
+ *      client - The connection.
+ *      callback - Called with each payload, from mip_process().
+ *      arg - Passed to the callback.
+ * Return:
+ *      0 if successful, -1 otherwise (errno set).
+ */
+int mip_listen(struct mip_client *client, mip_listen_callback callback, void *arg) {
+    client->listen = callback;
+    client->listenArg = arg;
+    return mip_client_submit(client, 0, LISTEN, 0, NULL, 0);
+}
+
+/**
+ * Send the queued messages, and wake the daemon once for everything pushed to shared memory. Whatever the
+ * socket has no room for is sent once the file descriptor says it is writable.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      0 if successful, -1 if the connection failed.
+ */
+int mip_flush(struct mip_client *client) {
+    if (client->state == MIP_CLIENT_CLOSED) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (client->pushed) {
+        ipc_rings_wake(client->rings.daemonEvent);
+        client->pushed = 0;
+    }
+    // Only messages in the length prefixed format are queued, so they wait for the daemon to switch.
+    if (client->state == MIP_CLIENT_UPGRADING) {
+        return 0;
+    }
+
+    if (client->requestRings) {
+        struct ipc_header header = {0};
+        header.version = IPC_VERSION;
+        header.info = SHM_RINGS;
+        if (send(client->sock, &header, sizeof(header), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return mip_client_fail(client, errno);
+            }
+        } else {
+            client->requestRings = 0;
+        }
+    }
+
+    while (!client->requestRings && client->sendDone < client->sendCount) {
+        int sent = sendmmsg(
+            client->sock,
+            &client->sendMsgs[client->sendDone],
+            client->sendCount - client->sendDone,
+            MSG_DONTWAIT | MSG_NOSIGNAL
+        );
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return mip_client_fail(client, errno);
+            }
+            break;
+        }
+        client->sendDone += sent;
+    }
+    // Wait for the socket to have room for the rest.
+    if (client->requestRings || client->sendDone < client->sendCount) {
+        if (!client->waitWritable) {
+            mip_client_watch(client, EPOLL_CTL_MOD, client->sock, EPOLLIN | EPOLLOUT);
+            client->waitWritable = 1;
+        }
+        return 0;
+    }
+
+    client->sendCount = 0;
+    client->sendDone = 0;
+    client->sendUsed = 0;
+    if (client->waitWritable) {
+        mip_client_watch(client, EPOLL_CTL_MOD, client->sock, EPOLLIN);
+        client->waitWritable = 0;
+    }
+    return 0;
+}
+
+/**
+ * Do everything the connection is ready for, without blocking: receive every waiting message and call its
+ * callback, then send whatever was queued, including the messages sent by the callbacks.
+ * Input:
+ *      client - The connection.
+ * Return:
+ *      Number of callbacks called, or -1 if the connection failed (errno set). EPROTONOSUPPORT if the daemon
+ *      only knows the legacy format.
+ */
+int mip_process(struct mip_client *client) {
+    int called = 0, result = 0;
+
+    if (client->state == MIP_CLIENT_UPGRADING) {
+        result = mip_client_upgraded(client);
+    }
+    while (result != -1 && client->state == MIP_CLIENT_RINGS_WAIT) {
+        if (mip_flush(client) == -1) {
+            return -1;
+        }
+        result = mip_client_receive_rings(client);
+        if (result <= 0) {
+            break;
+        }
+        called += result;
+    }
+    if (result != -1 && client->state == MIP_CLIENT_READY) {
+        if (client->hasRings) {
+            called += mip_client_receive_ring(client);
+        }
+        result = mip_client_receive(client);
+        called += result;
+    }
+    if (result == -1 || mip_flush(client) == -1) {
+        return -1;
+    }
+    return called;
+}
+
+/**
+ * Wait until the connection has something to do, or for a timeout, and do it. For processes without an
+ * event loop of their own.
+ * Input:
+ *      client - The connection.
+ *      timeout - Max time to wait, in milliseconds. -1 to wait as long as it takes.
+ * Return:
+ *      As mip_process(). 0 if nothing happened before the timeout.
+ */
+int mip_wait(struct mip_client *client, int timeout) {
+    if (mip_flush(client) == -1) {
+        return -1;
+    }
+    struct epoll_event ev;
+    if (epoll_wait(client->epollFd, &ev, 1, timeout) == -1 && errno != EINTR) {
+        return mip_client_fail(client, errno);
+    }
+    return mip_process(client);
+}
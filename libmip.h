@@ -0,0 +1,127 @@
+#ifndef _libmip_h
+#define _libmip_h
+
+#include "ethernet.h"
+#include "ipc_ring.h"
+#include "shared.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Ask the daemon for shared memory rings once connected, see ipc_ring.h. Falls back to the socket if refused.
+ */
+#define MIP_CLIENT_RINGS 1
+
+/**
+ * Default max number of requests waiting for a reply on a connection.
+ */
+#define MIP_CLIENT_DEFAULT_SLOTS 4096
+
+/**
+ * Max number of messages received or sent through the socket with a single syscall.
+ */
+#define MIP_CLIENT_BATCH_SIZE 16
+
+/**
+ * Room for messages waiting to be sent through the socket, headers included.
+ */
+#define MIP_CLIENT_SEND_BUFFER (4 * (sizeof(struct ipc_header) + MAX_MESSAGE_SIZE))
+
+struct mip_client;
+
+/**
+ * Called with the reply to a request: NO_ERROR and the payload of the response, STATS and a snapshot,
+ * or an error such as TIMED_OUT. The payload is only valid during the call.
+ */
+typedef void (*mip_reply_callback)(
+    struct mip_client *client,
+    uint32_t requestId,
+    enum info info,
+    uint8_t mip,
+    char *payload,
+    size_t length,
+    void *arg
+);
+
+/**
+ * Called with a payload sent to us by another node, once listening. Answer it with mip_reply().
+ * The payload is only valid during the call.
+ */
+typedef void (*mip_listen_callback)(struct mip_client *client, uint8_t mip, char *payload, size_t length, void *arg);
+
+enum mip_client_state {
+    MIP_CLIENT_UPGRADING, // Waiting for the daemon to confirm the length prefixed format.
+    MIP_CLIENT_RINGS_WAIT, // Upgraded, waiting for the shared memory rings.
+    MIP_CLIENT_READY, // Upgraded, and done setting up.
+    MIP_CLIENT_CLOSED // The connection is lost, or the daemon only knows the legacy format.
+};
+
+/**
+ * A request waiting for a reply.
+ */
+struct mip_request {
+    uint32_t requestId; // 0 if the slot is free.
+    mip_reply_callback callback;
+    void *arg;
+};
+
+/**
+ * A connection to the daemon, with any number of requests on their way. Nothing blocks: messages are
+ * queued, and sent and received by mip_flush() and mip_process(), when the file descriptor is ready.
+ */
+struct mip_client {
+    int sock; // The connection to the daemon.
+    int epollFd; // Readable when mip_process() has something to do. Given to the application.
+    enum mip_client_state state;
+    int flags; // MIP_CLIENT_RINGS or 0.
+
+    struct ipc_rings rings; // Shared memory rings, used if hasRings.
+    char hasRings;
+    char requestRings; // Whether SHM_RINGS is still to be sent.
+    char pushed; // Whether messages were pushed to toDaemon since the daemon was last woken.
+
+    struct mip_request *requests; // Requests waiting for a reply, by request ID masked with requestMask.
+    uint32_t requestMask;
+    uint32_t nextId; // Request ID of the next request. Never 0.
+    unsigned int inFlight; // Number of requests waiting for a reply.
+
+    mip_listen_callback listen; // Called with payloads from other nodes, or NULL.
+    void *listenArg;
+
+    // Messages waiting to be sent through the socket, each a header and a payload in sendBuffer.
+    char *sendBuffer;
+    size_t sendUsed;
+    struct iovec sendIovs[MIP_CLIENT_BATCH_SIZE];
+    struct mmsghdr sendMsgs[MIP_CLIENT_BATCH_SIZE];
+    unsigned int sendCount; // Number of messages waiting.
+    unsigned int sendDone; // Number of them sent already.
+    char waitWritable; // Whether epollFd also waits for the socket to be writable.
+
+    // Messages received through the socket, a batch at a time.
+    struct ipc_header recvHeaders[MIP_CLIENT_BATCH_SIZE];
+    char *recvBuffer; // MIP_CLIENT_BATCH_SIZE payloads of MAX_MESSAGE_SIZE.
+};
+
+struct mip_client *mip_connect(const char *path, unsigned int slots, int flags);
+void mip_close(struct mip_client *client);
+int mip_client_fd(struct mip_client *client);
+
+uint32_t mip_send(
+    struct mip_client *client,
+    uint8_t mip,
+    const char *payload,
+    size_t length,
+    mip_reply_callback callback,
+    void *arg
+);
+int mip_reply(struct mip_client *client, uint8_t mip, const char *payload, size_t length);
+uint32_t mip_request_stats(struct mip_client *client, mip_reply_callback callback, void *arg);
+int mip_listen(struct mip_client *client, mip_listen_callback callback, void *arg);
+
+int mip_flush(struct mip_client *client);
+int mip_process(struct mip_client *client);
+int mip_wait(struct mip_client *client, int timeout);
+
+#endif
@@ -0,0 +1,107 @@
+#include "link.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Store every available backend.
+ */
+const struct link_ops *linkBackends[] = {&linkRaw, &linkTap, &linkEmu};
+
+/**
+ * Open an interface from a link spec, and set up its transmit queue.
+ * Input:
+ *      spec - The link spec, "<backend>:<argument>". Like "raw:eth0", "tap:tap0" or "emu:3".
+ *      options - Settings for the link.
+ * Return:
+ *      The interface, or NULL if the spec is invalid or the link cannot be opened.
+ */
+struct eth_interface *link_open(char *spec, struct link_options *options) {
+    char *arg = strchr(spec, ':');
+    if (!arg) {
+        printf("%s: Link spec must be <backend>:<argument>.\n", spec);
+        return NULL;
+    }
+
+    const struct link_ops *link = NULL;
+    size_t i;
+    for (i = 0; i < sizeof(linkBackends) / sizeof(linkBackends[0]); i++) {
+        if (strlen(linkBackends[i]->name) == (size_t)(arg - spec) && !strncmp(spec, linkBackends[i]->name, arg - spec)) {
+            link = linkBackends[i];
+        }
+    }
+    if (!link) {
+        printf("%s: Unknown link backend.\n", spec);
+        return NULL;
+    }
+
+    struct eth_interface *interface = calloc(1, sizeof(struct eth_interface));
+    if (!interface) {
+        perror("link_open: calloc()");
+        exit(EXIT_FAILURE);
+    }
+    interface->link = link;
+    interface->sock = -1;
+    if (link->open(interface, arg + 1, options) == -1) {
+        free(interface->name);
+        free(interface);
+        return NULL;
+    }
+    link->get_mac(interface, interface->mac);
+
+    interface->txq = malloc(sizeof(struct tx_queue));
+    if (!interface->txq) {
+        perror("link_open: malloc()");
+        exit(EXIT_FAILURE);
+    }
+    tx_queue_init(interface->txq, interface->sock, link->send_batch);
+    if (link->setup_tx) {
+        link->setup_tx(interface, options);
+    }
+    return interface;
+}
+
+/**
+ * Send everything left on an interface, close it and free it.
+ * Input:
+ *      interface - The interface. Must not be used again.
+ */
+void link_close(struct eth_interface *interface) {
+    tx_queue_close(interface->txq);
+    free(interface->txq);
+    interface->link->close(interface);
+    free(interface->name);
+    free(interface);
+}
+
+/**
+ * Read every frame waiting on a socket link with recvmmsg(). Shared by the backends based on sockets.
+ * Input:
+ *      interface - The interface.
+ *      batch - Buffers to read into.
+ *      handler - Function called for each frame.
+ * Return:
+ *      The number of frames read.
+ */
+int link_recv_mmsg(struct eth_interface *interface, struct rx_batch *batch, rx_ring_handler handler) {
+    return rx_batch_read(batch, interface->sock, handler);
+}
+
+/**
+ * Make up a locally administered MAC address for a link without one of its own. Unique for each link of
+ * each process on the host.
+ * Input:
+ *      interface - The interface. Must be open.
+ *      mac - Where to store the address. At least 6 bytes.
+ */
+void link_generate_mac(struct eth_interface *interface, uint8_t mac[6]) {
+    pid_t pid = getpid();
+    mac[0] = 0x02; // Locally administered, unicast.
+    mac[1] = (pid >> 16) & 0xFF;
+    mac[2] = (pid >> 8) & 0xFF;
+    mac[3] = pid & 0xFF;
+    mac[4] = (interface->sock >> 8) & 0xFF;
+    mac[5] = interface->sock & 0xFF;
+}
@@ -0,0 +1,89 @@
+#ifndef _link_h
+#define _link_h
+
+#include "daemon.h"
+#include "rx_batch.h"
+#include "rx_ring.h"
+#include "tx_queue.h"
+
+#include <stdint.h>
+
+/**
+ * Settings for opening a link. Backends ignore the ones they do not support.
+ */
+struct link_options {
+    char receive; // Whether frames are received on the link. 0 if receive workers do it instead.
+    char rxRing; // Whether to receive through a memory mapped ring.
+    char txRing; // Whether to send through a memory mapped ring.
+    char *localAddresses; // Our MIP addresses, for the socket filter.
+    int addressCount; // Number of addresses the filter should accept, or 0 to accept every destination.
+};
+
+/**
+ * A link layer backend. Every interface is opened through one, and frames are read and written through it.
+ */
+struct link_ops {
+    const char *name; // Name of the backend, used in link specs.
+    char fanout; // Whether receive workers can share the link through PACKET_FANOUT.
+    char datagram; // Whether every recv() on the socket returns a single frame, so io_uring can receive for us.
+
+    /**
+     * Open a link, setting the name, sock and ring of the interface.
+     * Input:
+     *      interface - The interface to open.
+     *      arg - The backend specific part of the link spec.
+     *      options - Settings for the link.
+     * Return:
+     *      0 if successful, -1 otherwise.
+     */
+    int (*open)(struct eth_interface *interface, char *arg, struct link_options *options);
+
+    /**
+     * Read every frame waiting on the link.
+     * Input:
+     *      interface - The interface.
+     *      batch - Buffers to read into.
+     *      handler - Function called for each frame.
+     * Return:
+     *      The number of frames read.
+     */
+    int (*recv_batch)(struct eth_interface *interface, struct rx_batch *batch, rx_ring_handler handler);
+
+    tx_queue_sender send_batch; // Send a batch of frames, see tx_queue_sender.
+
+    /**
+     * Set up the transmit side, once the transmit queue of the interface exists. NULL if there is nothing to
+     * set up.
+     * Input:
+     *      interface - The interface.
+     *      options - Settings for the link.
+     */
+    void (*setup_tx)(struct eth_interface *interface, struct link_options *options);
+
+    /**
+     * Get the MAC address the daemon uses on the link.
+     * Input:
+     *      interface - The interface.
+     *      mac - Where to store the address. At least 6 bytes.
+     */
+    void (*get_mac)(struct eth_interface *interface, uint8_t mac[6]);
+
+    /**
+     * Close the link.
+     * Input:
+     *      interface - The interface.
+     */
+    void (*close)(struct eth_interface *interface);
+};
+
+extern const struct link_ops linkRaw;
+extern const struct link_ops linkTap;
+extern const struct link_ops linkEmu;
+
+struct eth_interface *link_open(char *spec, struct link_options *options);
+void link_close(struct eth_interface *interface);
+
+int link_recv_mmsg(struct eth_interface *interface, struct rx_batch *batch, rx_ring_handler handler);
+void link_generate_mac(struct eth_interface *interface, uint8_t mac[6]);
+
+#endif
@@ -0,0 +1,62 @@
+#include "link.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Attach to one end of an emulated wire: a UNIX datagram socket inherited from the parent process, with a
+ * frame per datagram. Whatever is on the other end, like the wire of bench_wire, decides where the frames
+ * go, and adds any delay or loss. Needs no privileges.
+ * Input:
+ *      interface - The interface to open.
+ *      arg - The file descriptor of the socket.
+ *      options - Settings for the link. Unused.
+ * Return:
+ *      0 if successful, -1 if the file descriptor is not a datagram socket.
+ */
+int link_emu_open(struct eth_interface *interface, char *arg, struct link_options *options) {
+    int fd = atoi(arg);
+    int type;
+    socklen_t length = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == -1 || type != SOCK_DGRAM) {
+        printf("emu:%s: Not a datagram socket.\n", arg);
+        return -1;
+    }
+
+    // Not inherited by anything we start. The socket itself stays blocking, so sends wait for room on the wire;
+    // reads never block because every receive passes MSG_DONTWAIT.
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    interface->name = malloc(strlen(arg) + 4);
+    sprintf(interface->name, "emu%s", arg);
+    interface->sock = fd;
+    return 0;
+}
+
+/**
+ * Close an emulated wire.
+ * Input:
+ *      interface - The interface.
+ */
+void link_emu_close(struct eth_interface *interface) {
+    close(interface->sock);
+}
+
+/**
+ * Links on an emulated wire, over UNIX datagram sockets.
+ */
+const struct link_ops linkEmu = {
+    .name = "emu",
+    .fanout = 0,
+    .datagram = 1,
+    .open = link_emu_open,
+    .recv_batch = link_recv_mmsg,
+    .send_batch = tx_queue_sendmmsg,
+    .setup_tx = NULL,
+    .get_mac = link_generate_mac,
+    .close = link_emu_close,
+};
@@ -0,0 +1,135 @@
+#include "link.h"
+#include "filter.h"
+#include "mac_utils.h"
+#include "mip.h"
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Open an AF_PACKET socket on a network interface.
+ * Input:
+ *      interface - The interface to open.
+ *      arg - The name of the network interface.
+ *      options - Settings for the link.
+ * Return:
+ *      0 if successful, -1 if the network interface does not exist.
+ * Error:
+ *      Will end the program if the socket cannot be set up.
+ */
+int link_raw_open(struct eth_interface *interface, char *arg, struct link_options *options) {
+    unsigned int ifindex = if_nametoindex(arg);
+    if (!ifindex) {
+        printf("%s: No such network interface.\n", arg);
+        return -1;
+    }
+    interface->name = strdup(arg);
+
+    // Create socket for the interface. Protocol 0 until bound, so nothing is received before the
+    // filter is in place.
+    int sock = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("link_raw_open: socket()");
+        exit(EXIT_FAILURE);
+    }
+
+    // Without receiving, the socket of the interface is only used to send.
+    if (options->rxRing && options->receive) {
+        interface->ring = calloc(1, sizeof(struct rx_ring));
+        if (rx_ring_setup(interface->ring, sock) == -1) {
+            printf("%s: RX ring unavailable, using recvmmsg().\n", arg);
+            free(interface->ring);
+            interface->ring = NULL;
+        }
+    }
+
+    if (filter_attach(sock, options->localAddresses, options->addressCount) == -1) {
+        printf("%s: Socket filter unavailable, filtering in the daemon.\n", arg);
+    }
+
+    struct sockaddr_ll sockaddr_net = {0};
+    sockaddr_net.sll_family = AF_PACKET;
+    sockaddr_net.sll_protocol = options->receive ? htons(ETH_P_MIP) : 0;
+    sockaddr_net.sll_ifindex = ifindex;
+    if (bind(sock, (struct sockaddr*)&sockaddr_net, sizeof(sockaddr_net)) == -1) {
+        perror("link_raw_open: bind()");
+        exit(EXIT_FAILURE);
+    }
+
+    interface->sock = sock;
+    return 0;
+}
+
+/**
+ * Set up the transmit ring of an AF_PACKET link, if asked for.
+ * Input:
+ *      interface - The interface.
+ *      options - Settings for the link.
+ */
+void link_raw_setup_tx(struct eth_interface *interface, struct link_options *options) {
+    if (options->txRing && tx_queue_setup_ring(interface->txq, if_nametoindex(interface->name)) == -1) {
+        printf("%s: TX ring unavailable, using sendmmsg().\n", interface->name);
+    }
+}
+
+/**
+ * Read every frame waiting on an AF_PACKET link, from its ring if it has one.
+ * Input:
+ *      interface - The interface.
+ *      batch - Buffers to read into, without a ring.
+ *      handler - Function called for each frame.
+ * Return:
+ *      The number of frames read.
+ */
+int link_raw_recv_batch(struct eth_interface *interface, struct rx_batch *batch, rx_ring_handler handler) {
+    // Walk every frame the kernel has placed in the ring, without any copies or syscalls.
+    if (interface->ring) {
+        return rx_ring_read(interface->ring, handler);
+    }
+    return rx_batch_read(batch, interface->sock, handler);
+}
+
+/**
+ * Get the MAC address of the network interface.
+ * Input:
+ *      interface - The interface.
+ *      mac - Where to store the address. At least 6 bytes.
+ */
+void link_raw_get_mac(struct eth_interface *interface, uint8_t mac[6]) {
+    get_mac_addr(interface->sock, mac, interface->name);
+}
+
+/**
+ * Close an AF_PACKET link and its ring.
+ * Input:
+ *      interface - The interface.
+ */
+void link_raw_close(struct eth_interface *interface) {
+    if (interface->ring) {
+        rx_ring_close(interface->ring);
+        free(interface->ring);
+        interface->ring = NULL;
+    }
+    close(interface->sock);
+}
+
+/**
+ * Links on network interfaces, through AF_PACKET sockets. Needs CAP_NET_RAW.
+ */
+const struct link_ops linkRaw = {
+    .name = "raw",
+    .fanout = 1,
+    .datagram = 1,
+    .open = link_raw_open,
+    .recv_batch = link_raw_recv_batch,
+    .send_batch = tx_queue_sendmmsg,
+    .setup_tx = link_raw_setup_tx,
+    .get_mac = link_raw_get_mac,
+    .close = link_raw_close,
+};
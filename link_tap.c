@@ -0,0 +1,140 @@
+#include "link.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Attach to a TAP device, creating it if it does not exist. The daemon is the station on the far end of
+ * the device, so the host sees our frames as received on it.
+ * Input:
+ *      interface - The interface to open.
+ *      arg - The name of the TAP device.
+ *      options - Settings for the link. Unused.
+ * Return:
+ *      0 if successful, -1 if the device cannot be attached to.
+ */
+int link_tap_open(struct eth_interface *interface, char *arg, struct link_options *options) {
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        perror("link_tap_open: open()");
+        return -1;
+    }
+
+    struct ifreq ifr = {0};
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, arg, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) == -1) {
+        perror("link_tap_open: ioctl(TUNSETIFF)");
+        close(fd);
+        return -1;
+    }
+
+    // Bring the device up, if we are allowed to. It may also be managed by someone else.
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock != -1) {
+        if (ioctl(sock, SIOCGIFFLAGS, &ifr) != -1 && !(ifr.ifr_flags & IFF_UP)) {
+            ifr.ifr_flags |= IFF_UP;
+            ioctl(sock, SIOCSIFFLAGS, &ifr);
+        }
+        close(sock);
+    }
+
+    interface->name = strdup(ifr.ifr_name);
+    interface->sock = fd;
+    return 0;
+}
+
+/**
+ * Read every frame waiting on a TAP device. A TAP device gives a single frame per read().
+ * Input:
+ *      interface - The interface.
+ *      batch - Buffers to read into.
+ *      handler - Function called for each frame.
+ * Return:
+ *      The number of frames read.
+ * Error:
+ *      Will end the program if the device cannot be read.
+ */
+int link_tap_recv_batch(struct eth_interface *interface, struct rx_batch *batch, rx_ring_handler handler) {
+    int frames = 0;
+    while (1) {
+        ssize_t received = read(interface->sock, batch->frames[0], RX_BATCH_FRAME_SIZE);
+        if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return frames;
+            }
+            perror("link_tap_recv_batch: read()");
+            exit(EXIT_FAILURE);
+        }
+        handler(interface->sock, batch->frames[0], received);
+        frames++;
+    }
+}
+
+/**
+ * Write a batch of frames to a TAP device, a frame per writev().
+ * Input:
+ *      sock - The file descriptor of the device.
+ *      msgs - The frames, one per message.
+ *      count - Number of frames.
+ * Return:
+ *      The number of frames written. Frames the device has no room for are dropped, like on a wire.
+ * Error:
+ *      Will end the program if the device cannot be written.
+ */
+int link_tap_send_batch(int sock, struct mmsghdr *msgs, unsigned int count) {
+    unsigned int i = 0;
+    int sent = 0;
+    while (i < count) {
+        if (writev(sock, msgs[i].msg_hdr.msg_iov, msgs[i].msg_hdr.msg_iovlen) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Dropped when the device is full, or down.
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EIO) {
+                perror("link_tap_send_batch: writev()");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            sent++;
+        }
+        i++;
+    }
+    return sent;
+}
+
+/**
+ * Close a TAP device. A device we created goes away with it.
+ * Input:
+ *      interface - The interface.
+ */
+void link_tap_close(struct eth_interface *interface) {
+    close(interface->sock);
+}
+
+/**
+ * Links on TAP devices. Needs CAP_NET_ADMIN, unless the device is persistent and owned by the user.
+ */
+const struct link_ops linkTap = {
+    .name = "tap",
+    .fanout = 0,
+    .datagram = 0,
+    .open = link_tap_open,
+    .recv_batch = link_tap_recv_batch,
+    .send_batch = link_tap_send_batch,
+    .setup_tx = NULL,
+    .get_mac = link_generate_mac,
+    .close = link_tap_close,
+};
@@ -1,7 +1,6 @@
 #include "mip.h"
 
 #include <arpa/inet.h>
-#include <math.h>
 #include <string.h>
 
 /**
@@ -14,6 +13,7 @@
 uint8_t mip_is_transport(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
     return (uint8_t)((temp >> 31) & 1);
 }
 
@@ -27,6 +27,7 @@ uint8_t mip_is_transport(char *packetHeader) {
 uint8_t mip_is_routing(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
     return (uint8_t)((temp >> 30) & 1);
 }
 
@@ -40,6 +41,7 @@ uint8_t mip_is_routing(char *packetHeader) {
 uint8_t mip_is_arp(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
     return (uint8_t)((temp >> 29) & 1);
 }
 
@@ -53,6 +55,7 @@ uint8_t mip_is_arp(char *packetHeader) {
 uint8_t mip_get_dest(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
     return (uint8_t)((temp >> 21) & 0xFF);
 }
 
@@ -66,20 +69,36 @@ uint8_t mip_get_dest(char *packetHeader) {
 uint8_t mip_get_src(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
     return (uint8_t)((temp >> 13) & 0xFF);
 }
 
+/**
+ * Get the time to live from a MIP header.
+ * Input:
+ *      packetHeader - A pointer to the packet header.
+ * Return:
+ *      The number of hops the packet may still be forwarded.
+ */
+uint8_t mip_get_ttl(char *packetHeader) {
+    uint32_t temp;
+    memcpy(&temp, packetHeader, 4);
+    temp = ntohl(temp);
+    return (uint8_t)(temp & 0xF);
+}
+
 /**
  * Get the payload length of a MIP packet.
  * Input:
  *      packetHeader - A pointer to the packet header.
  * Return:
- *      The location to output the length, in number of bytes.
+ *      The length of the payload, in number of bytes.
  */
 uint32_t mip_get_payload_length(char *packetHeader) {
     uint32_t temp;
     memcpy(&temp, packetHeader, 4);
-    return ntohs((*packetHeader >> 4) & 0x000001FF) * 4;
+    temp = ntohl(temp);
+    return ((temp >> 4) & 0x000001FF) * 4;
 }
 
 /**
@@ -88,7 +107,7 @@ uint32_t mip_get_payload_length(char *packetHeader) {
  *      length - The length in bytes.
  */
 uint16_t mip_calc_payload_length(int length) {
-    return (uint16_t)ceilf(length / 4);
+    return (uint16_t)((length + 3) / 4);
 }
 
 /**
@@ -99,8 +118,7 @@ uint16_t mip_calc_payload_length(int length) {
  *      isArp - 1 if arp, 0 otherwise.
  *      destination - Destination MIP address.
  *      source - source MIP address.
- *      payloadLength - Length of the payload.
- *      ttl - The time to live (15).
+ *      payloadLength - Length of the payload, in 4 byte groups.
  *      output - Pointer to a location to store the result. Must be at least 4 bytes.
  */
 void mip_build_header(
@@ -112,35 +130,25 @@ void mip_build_header(
     uint32_t payloadLength,
     char *output
 ) {
-    uint32_t result = 0;
-
-    // For each: Add relevant bits, then shift far enough to make space for the next field.
-
-    if (isTransport) {
-        result = result | 1; // Transport bit.
-    }
-    result = result << 1;
-
-    if (isRouting) {
-        result = result | 1; // Routing bit.
-    }
-    result = result << 1;
+    struct mip_header header = {0};
+    header.type = (!!isTransport << 2) | (!!isRouting << 1) | !!isArp;
+    header.destination = destination;
+    header.source = source;
+    header.length = (payloadLength & 0x1FF) * 4;
+    header.ttl = MIP_DEFAULT_TTL;
+    mip_encode(&header, output);
+}
 
-    if (isArp) {
-        result = result | 1; // ARP bit.
+/**
+ * Decode the headers of a batch of frames in one pass.
+ * Input:
+ *      packetHeaders - Pointers to the packet headers.
+ *      headers - Where to store the decoded headers. Must have room for count headers.
+ *      count - Number of headers.
+ */
+void mip_decode_batch(char **packetHeaders, struct mip_header *headers, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        mip_decode(packetHeaders[i], &headers[i]);
     }
-    result = result << 8;
-
-    result = (result | destination) << 8; // Destination MIP addr.
-
-    result = (result | source) << 9; // Source MIP addr.
-
-    result = (result | htons(payloadLength & 0x01FF)) << 4; // Payload Length.
-
-    result = result | 0xF; // TTL.
-
-    // Ensure the bytes are in the right order, not swapped due to endian-ness.
-    result = htonl(result);
-
-    memcpy(output, &result, 4);
-}
\ No newline at end of file
+}
@@ -1,19 +1,60 @@
 #ifndef _mip_h
 #define _mip_h
 
+#include <arpa/inet.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 /**
  * Ethernet protocol number.
  */
 #define ETH_P_MIP 0x88B5
 
+/**
+ * Size of the MIP header, in bytes.
+ */
+#define MIP_HEADER_SIZE 4
+
+/**
+ * Time to live of a new MIP packet. The max the 4 bit field holds.
+ */
+#define MIP_DEFAULT_TTL 0xF
+
+/**
+ * Destination MIP address of frames for every neighbour, such as routing updates.
+ */
+#define MIP_BROADCAST 0xFF
+
+/**
+ * The kind of a MIP packet. The value is the transport, routing and ARP bits of the header, in that order.
+ */
+enum mip_type {
+    MIP_ARP_RESPONSE    = 0, // No bits set.
+    MIP_ARP_REQUEST     = 1, // ARP bit.
+    MIP_ROUTING         = 2, // Routing bit.
+    MIP_DATA            = 4, // Transport bit.
+    MIP_FRAGMENT        = 5 // Transport and ARP bits. A part of a message too large for a single frame.
+};
+
+/**
+ * A decoded MIP header.
+ */
+struct mip_header {
+    uint8_t type; // The transport, routing and ARP bits, see enum mip_type.
+    uint8_t destination; // Destination MIP address.
+    uint8_t source; // Source MIP address.
+    uint8_t ttl; // Time to live.
+    uint16_t length; // Length of the payload, in bytes. Always a multiple of 4.
+};
+
 // MIP packet functions.
 uint8_t mip_is_transport(char *packetHeader);
 uint8_t mip_is_routing(char *packetHeader);
 uint8_t mip_is_arp(char *packetHeader);
 uint8_t mip_get_dest(char *packetHeader);
 uint8_t mip_get_src(char *packetHeader);
+uint8_t mip_get_ttl(char *packetHeader);
 uint32_t mip_get_payload_length(char *packetHeader);
 
 uint16_t mip_calc_payload_length(int length);
@@ -27,4 +68,40 @@ void mip_build_header(
     uint32_t payloadLength,
     char *output);
 
-#endif
\ No newline at end of file
+void mip_decode_batch(char **packetHeaders, struct mip_header *headers, size_t count);
+
+/**
+ * Decode every field of a MIP header, with a single load and byte swap.
+ * Input:
+ *      packetHeader - A pointer to the packet header. Does not need to be aligned.
+ *      header - Where to store the decoded fields.
+ */
+static inline void mip_decode(const char *packetHeader, struct mip_header *header) {
+    uint32_t word;
+    memcpy(&word, packetHeader, MIP_HEADER_SIZE);
+    word = ntohl(word);
+
+    header->type = word >> 29;
+    header->destination = (word >> 21) & 0xFF;
+    header->source = (word >> 13) & 0xFF;
+    header->length = ((word >> 4) & 0x1FF) * 4;
+    header->ttl = word & 0xF;
+}
+
+/**
+ * Encode a MIP header, with a single byte swap and store.
+ * Input:
+ *      header - The fields to encode. The length is rounded up to a multiple of 4 bytes.
+ *      packetHeader - Where to store the header. Must be at least 4 bytes, does not need to be aligned.
+ */
+static inline void mip_encode(const struct mip_header *header, char *packetHeader) {
+    uint32_t word = ((uint32_t)(header->type & 0x7) << 29)
+        | ((uint32_t)header->destination << 21)
+        | ((uint32_t)header->source << 13)
+        | ((uint32_t)(((header->length + 3) / 4) & 0x1FF) << 4)
+        | (header->ttl & 0xF);
+    word = htonl(word);
+    memcpy(packetHeader, &word, MIP_HEADER_SIZE);
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "ethernet.h"
+#include "shared.h"
+#include "stats.h"
+#include "libmip.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYNTAX "Syntax: %s [-h] [-i seconds] <Unix socket>\n"
+
+/**
+ * Name of every drop reason, by enum stats_drop.
+ */
+const char *dropNames[STATS_DROP_COUNT] = {
+    "too short",
+    "not MIP",
+    "truncated",
+    "not for us",
+    "no session",
+    "no egress interface",
+    "queue full",
+    "host unreachable",
+    "payload too long",
+    "bad fragment",
+    "unknown type",
+    "reply failed",
+    "no route",
+    "TTL expired",
+};
+
+/**
+ * Store the snapshot received from the daemon.
+ */
+char snapshot[MAX_MESSAGE_SIZE];
+
+/**
+ * Store the length of the snapshot received, or 0 while waiting for it.
+ */
+size_t snapshotLength = 0;
+
+/**
+ * Store a snapshot received from the daemon.
+ * Input:
+ *      client - The connection.
+ *      requestId - The request ID of the request.
+ *      info - STATS if the daemon supports statistics.
+ *      mip - Unused.
+ *      payload - The snapshot.
+ *      length - Length of the snapshot.
+ *      arg - Unused.
+ */
+void snapshot_reply(
+    struct mip_client *client,
+    uint32_t requestId,
+    enum info info,
+    uint8_t mip,
+    char *payload,
+    size_t length,
+    void *arg
+) {
+    if (length < sizeof(struct stats_global) || info != STATS) {
+        printf("The daemon does not support statistics.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(snapshot, payload, length);
+    snapshotLength = length;
+}
+
+/**
+ * Ask the daemon for a snapshot of its statistics.
+ * Input:
+ *      client - The connection to the daemon.
+ * Return:
+ *      The length of the snapshot, stored in snapshot.
+ */
+size_t request_snapshot(struct mip_client *client) {
+    snapshotLength = 0;
+    if (!mip_request_stats(client, snapshot_reply, NULL)) {
+        perror("mip_request_stats()");
+        exit(EXIT_FAILURE);
+    }
+    while (!snapshotLength) {
+        if (mip_wait(client, -1) == -1) {
+            if (errno == EPROTONOSUPPORT) {
+                printf("Statistics need a daemon supporting the length prefixed format.\n");
+            } else {
+                printf("Connection to the daemon lost.\n");
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+    return snapshotLength;
+}
+
+/**
+ * Print a latency distribution.
+ * Input:
+ *      name - What the latencies are of.
+ *      latency - The distribution, in nanoseconds.
+ */
+void print_latency(char *name, struct stats_latency *latency) {
+    printf(
+        "%s (us): count %llu, min %.1f, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p999 %.1f, max %.1f.\n",
+        name,
+        (unsigned long long)latency->count,
+        latency->min / 1e3,
+        latency->mean / 1e3,
+        latency->p50 / 1e3,
+        latency->p90 / 1e3,
+        latency->p99 / 1e3,
+        latency->p999 / 1e3,
+        latency->max / 1e3
+    );
+}
+
+/**
+ * Print a snapshot.
+ * Input:
+ *      length - Length of the snapshot in snapshot.
+ */
+void print_snapshot(size_t length) {
+    struct stats_global global;
+    memcpy(&global, snapshot, sizeof(global));
+    if (global.version != STATS_VERSION) {
+        printf("Unknown snapshot version %u.\n", global.version);
+        exit(EXIT_FAILURE);
+    }
+    size_t needed = sizeof(global)
+        + global.interfaceCount * sizeof(struct stats_interface)
+        + global.sessionCount * sizeof(struct stats_session);
+    if (needed > length) {
+        printf("Truncated snapshot.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Uptime: %.1f s.\n", global.uptime / 1e3);
+    printf(
+        "Neighbours: %llu hits, %llu misses, %llu probes.\n",
+        (unsigned long long)global.neighHits,
+        (unsigned long long)global.neighMisses,
+        (unsigned long long)global.neighProbes
+    );
+    printf(
+        "Timeouts: %llu waiting for ARP, %llu waiting for a response.\n",
+        (unsigned long long)global.arpTimeouts,
+        (unsigned long long)global.dataTimeouts
+    );
+    printf(
+        "Fragmentation: %llu split, %llu reassembled, %llu timed out, %llu evicted.\n",
+        (unsigned long long)global.fragmentsSplit,
+        (unsigned long long)global.fragmentsReassembled,
+        (unsigned long long)global.fragmentsTimedOut,
+        (unsigned long long)global.fragmentsEvicted
+    );
+    printf("Forwarded: %llu frames.\n", (unsigned long long)global.forwarded);
+    printf("Drops:");
+    int i, dropped = 0;
+    for (i = 0; i < STATS_DROP_COUNT; i++) {
+        if (global.drops[i]) {
+            printf("%s %s %llu", dropped ? "," : "", dropNames[i], (unsigned long long)global.drops[i]);
+            dropped = 1;
+        }
+    }
+    printf("%s.\n", dropped ? "" : " none");
+    print_latency("ARP resolution", &global.arpResolution);
+    print_latency("Round trip", &global.roundTrip);
+
+    size_t offset = sizeof(global);
+    unsigned int n;
+    for (n = 0; n < global.interfaceCount; n++) {
+        struct stats_interface entry;
+        memcpy(&entry, snapshot + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        printf(
+            "Interface %s, MIP %u, MAC %02x:%02x:%02x:%02x:%02x:%02x:\n",
+            entry.name,
+            entry.mip,
+            entry.mac[0], entry.mac[1], entry.mac[2], entry.mac[3], entry.mac[4], entry.mac[5]
+        );
+        printf(
+            "    rx %llu frames, %llu bytes. tx %llu frames, %llu bytes.\n",
+            (unsigned long long)entry.rxFrames,
+            (unsigned long long)entry.rxBytes,
+            (unsigned long long)entry.txFrames,
+            (unsigned long long)entry.txBytes
+        );
+        printf(
+            "    ARP in %llu requests, %llu replies. ARP out %llu requests, %llu replies.\n",
+            (unsigned long long)entry.arpRequestsIn,
+            (unsigned long long)entry.arpRepliesIn,
+            (unsigned long long)entry.arpRequestsOut,
+            (unsigned long long)entry.arpRepliesOut
+        );
+    }
+
+    printf("Sessions: %u", global.sessionTotal);
+    if (global.sessionCount < global.sessionTotal) {
+        printf(", %u shown", global.sessionCount);
+    }
+    printf(".\n");
+    for (n = 0; n < global.sessionCount; n++) {
+        struct stats_session entry;
+        memcpy(&entry, snapshot + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        printf(
+            "    Session %d%s: in %llu messages, %llu bytes. out %llu messages, %llu bytes. %llu errors, %llu timeouts.\n",
+            entry.fd,
+            entry.status == 3 ? " (listening)" : "",
+            (unsigned long long)entry.messagesIn,
+            (unsigned long long)entry.bytesIn,
+            (unsigned long long)entry.messagesOut,
+            (unsigned long long)entry.bytesOut,
+            (unsigned long long)entry.errors,
+            (unsigned long long)entry.timeouts
+        );
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 1) { //Not enough args
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    unsigned int interval = 0;
+
+    // Options.
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h")) { // Show help.
+            printf(SYNTAX, argv[0]);
+            printf("-h: Show help and exit.\n");
+            printf("-i: Print the statistics again every this many seconds. Default once.\n");
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interval = atoi(argv[++i]);
+        } else {
+            break;
+        }
+    }
+
+    if (i >= argc) {
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    // Socket path:
+    char *sockpath = argv[i];
+
+    // Connect, in the length prefixed format.
+    struct mip_client *client = mip_connect(sockpath, 0, 0);
+    if (!client) {
+        perror("mip_connect()");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        print_snapshot(request_snapshot(client));
+        if (!interval) {
+            break;
+        }
+        printf("\n");
+        fflush(stdout);
+        sleep(interval);
+    }
+
+    mip_close(client);
+    return EXIT_SUCCESS;
+}
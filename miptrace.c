@@ -0,0 +1,124 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SYNTAX "Syntax: %s [-h] [-f] <trace file>\n"
+
+/**
+ * Print every complete event in a ring from a position on, up to the head.
+ * Input:
+ *      ring - The trace ring.
+ *      from - Sequence of the first event to print. Moved forward if it has been overwritten.
+ * Return:
+ *      The sequence of the next event to print.
+ */
+uint64_t print_events(struct trace_header *ring, uint64_t from) {
+    struct trace_event *events = (struct trace_event *)(ring + 1);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head - from > ring->eventCount) {
+        printf("... %llu events lost.\n", (unsigned long long)(head - ring->eventCount - from));
+        from = head - ring->eventCount;
+    }
+
+    for (; from < head; from++) {
+        struct trace_event *slot = &events[from & (ring->eventCount - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != from + 1) {
+            break; // Still being written.
+        }
+        struct trace_event event = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != from + 1) {
+            continue; // Overwritten while copied.
+        }
+
+        char line[128];
+        trace_format(&event, line, sizeof(line));
+        puts(line);
+    }
+    return from;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 1) { //Not enough args
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    char follow = 0;
+
+    // Options.
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h")) { // Show help.
+            printf(SYNTAX, argv[0]);
+            printf("-h: Show help and exit.\n");
+            printf("-f: Keep printing new events, for the trace of a running daemon.\n");
+            printf("The trace file is the path printed by mip_daemon -x, or a copy of it.\n");
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "-f")) {
+            follow = 1;
+        } else {
+            break;
+        }
+    }
+
+    if (i >= argc) {
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    int fd = open(argv[i], O_RDONLY);
+    if (fd == -1) {
+        perror("open()");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat()");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < sizeof(struct trace_header)) {
+        printf("Not a MIP trace.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct trace_header *ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap()");
+        exit(EXIT_FAILURE);
+    }
+    if (ring->magic != TRACE_MAGIC || ring->version != TRACE_VERSION) {
+        printf("Not a MIP trace, or of an unknown version.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (
+        !ring->eventCount
+        || ring->eventCount & (ring->eventCount - 1)
+        || sizeof(struct trace_header) + (size_t)ring->eventCount * sizeof(struct trace_event) > (size_t)st.st_size
+    ) {
+        printf("Truncated trace.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Start at the oldest event still in the ring.
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t next = head > ring->eventCount ? head - ring->eventCount : 0;
+    next = print_events(ring, next);
+
+    while (follow) {
+        fflush(stdout);
+        usleep(100000);
+        next = print_events(ring, next);
+    }
+
+    munmap(ring, st.st_size);
+    close(fd);
+    return EXIT_SUCCESS;
+}
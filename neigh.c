@@ -0,0 +1,191 @@
+#include "neigh.h"
+
+#include <string.h>
+
+/**
+ * Store what we know about every MIP address.
+ * Format:
+ *      neighTable[Mip Address] = Neighbour.
+ */
+struct neigh_entry neighTable[256] = {0};
+
+/**
+ * Store the counters for the table.
+ */
+struct neigh_stats neighStats = {0};
+
+/**
+ * Change the state of a neighbour.
+ * Input:
+ *      entry - The neighbour.
+ *      state - The new state.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_set_state(struct neigh_entry *entry, enum neigh_state state, uint64_t now) {
+    entry->state = state;
+    entry->updated = now;
+}
+
+/**
+ * Age a neighbour, based on when it was last confirmed.
+ * Input:
+ *      entry - The neighbour.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_age(struct neigh_entry *entry, uint64_t now) {
+    if (entry->state == NEIGH_REACHABLE && now - entry->confirmed >= NEIGH_REACHABLE_TIME) {
+        neigh_set_state(entry, NEIGH_STALE, now);
+    }
+    if (entry->state == NEIGH_STALE && now - entry->confirmed >= NEIGH_STALE_TIME) {
+        neigh_set_state(entry, NEIGH_NONE, now);
+        entry->interface = NULL;
+    }
+    if (entry->state == NEIGH_FAILED && now - entry->updated >= NEIGH_FAILED_TIME) {
+        neigh_set_state(entry, NEIGH_NONE, now);
+    }
+}
+
+/**
+ * Look up the neighbour with a MIP address, counting hits and misses.
+ * Input:
+ *      mip - The MIP address.
+ *      now - The current time, in milliseconds.
+ * Return:
+ *      The neighbour if its MAC address can be used, NULL otherwise.
+ */
+struct neigh_entry *neigh_lookup(uint8_t mip, uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+    neigh_age(entry, now);
+
+    if (entry->state == NEIGH_REACHABLE || entry->state == NEIGH_STALE) {
+        neighStats.hits++;
+        return entry;
+    }
+    neighStats.misses++;
+    return NULL;
+}
+
+/**
+ * Check whether a stale neighbour should be confirmed with a new ARP request. Counts the request.
+ * Input:
+ *      entry - The neighbour.
+ *      now - The current time, in milliseconds.
+ * Return:
+ *      1 if an ARP request should be sent, 0 otherwise.
+ */
+int neigh_needs_probe(struct neigh_entry *entry, uint64_t now) {
+    if (entry->state != NEIGH_STALE || now - entry->probed < NEIGH_PROBE_INTERVAL) {
+        return 0;
+    }
+    entry->probed = now;
+    neighStats.probes++;
+    return 1;
+}
+
+/**
+ * Check whether a MIP address recently failed to answer ARP. Counts the suppressed request.
+ * Input:
+ *      mip - The MIP address.
+ *      now - The current time, in milliseconds.
+ * Return:
+ *      1 if the neighbour should be considered unreachable, 0 otherwise.
+ */
+int neigh_is_failed(uint8_t mip, uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+    neigh_age(entry, now);
+
+    if (entry->state == NEIGH_FAILED) {
+        neighStats.suppressed++;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Store the MAC address and interface of a neighbour that has proven it is reachable.
+ * Input:
+ *      mip - The MIP address.
+ *      mac - The MAC address.
+ *      interface - The interface the neighbour was seen on.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_confirm(uint8_t mip, uint8_t mac[6], struct eth_interface *interface, uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+
+    if (
+        (entry->state == NEIGH_REACHABLE || entry->state == NEIGH_STALE)
+        && (memcmp(entry->mac, mac, 6) || entry->interface != interface)
+    ) {
+        neighStats.changes++;
+    }
+
+    memcpy(entry->mac, mac, 6);
+    entry->interface = interface;
+    entry->confirmed = now;
+    neigh_set_state(entry, NEIGH_REACHABLE, now);
+}
+
+/**
+ * Mark a neighbour as reachable again, if the MAC address matches what we already know.
+ * Used for traffic that shows the neighbour is alive, but is not trusted to change the MAC address.
+ * Input:
+ *      mip - The MIP address.
+ *      mac - The MAC address the traffic came from.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_refresh(uint8_t mip, uint8_t mac[6], uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+    if ((entry->state == NEIGH_REACHABLE || entry->state == NEIGH_STALE) && !memcmp(entry->mac, mac, 6)) {
+        entry->confirmed = now;
+        if (entry->state == NEIGH_STALE) {
+            neigh_set_state(entry, NEIGH_REACHABLE, now);
+        }
+    }
+}
+
+/**
+ * Mark that an ARP request has been sent for a neighbour with no usable MAC address.
+ * Input:
+ *      mip - The MIP address.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_incomplete(uint8_t mip, uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+    if (entry->state != NEIGH_REACHABLE && entry->state != NEIGH_STALE) {
+        neigh_set_state(entry, NEIGH_INCOMPLETE, now);
+    }
+}
+
+/**
+ * Mark a neighbour as unreachable, because it did not answer ARP.
+ * Input:
+ *      mip - The MIP address.
+ *      now - The current time, in milliseconds.
+ */
+void neigh_failed(uint8_t mip, uint64_t now) {
+    struct neigh_entry *entry = &neighTable[mip];
+    if (entry->state == NEIGH_INCOMPLETE) {
+        neigh_set_state(entry, NEIGH_FAILED, now);
+        entry->interface = NULL;
+    }
+}
+
+/**
+ * Get the neighbour with a MIP address, without ageing it or counting the lookup.
+ * Input:
+ *      mip - The MIP address.
+ * Return:
+ *      A pointer to the neighbour.
+ */
+struct neigh_entry *neigh_get(uint8_t mip) {
+    return &neighTable[mip];
+}
+
+/**
+ * Get the counters for the table.
+ * Return:
+ *      A pointer to the counters.
+ */
+struct neigh_stats *neigh_get_stats() {
+    return &neighStats;
+}
@@ -0,0 +1,75 @@
+#ifndef _neigh_h
+#define _neigh_h
+
+#include "daemon.h"
+
+#include <stdint.h>
+
+/**
+ * Time in milliseconds a neighbour is considered reachable after it was last confirmed.
+ */
+#define NEIGH_REACHABLE_TIME 30000
+
+/**
+ * Time in milliseconds a stale neighbour is kept before it is forgotten.
+ */
+#define NEIGH_STALE_TIME 300000
+
+/**
+ * Min time in milliseconds between ARP requests to confirm a stale neighbour.
+ */
+#define NEIGH_PROBE_INTERVAL 1000
+
+/**
+ * Time in milliseconds a neighbour that did not answer ARP is considered unreachable,
+ * before a new ARP request is allowed.
+ */
+#define NEIGH_FAILED_TIME 3000
+
+/**
+ * The state of a neighbour.
+ */
+enum neigh_state {
+    NEIGH_NONE          = 0, // Nothing known.
+    NEIGH_INCOMPLETE    = 1, // ARP request sent, waiting for a response.
+    NEIGH_REACHABLE     = 2, // Recently confirmed.
+    NEIGH_STALE         = 3, // Not confirmed for a while. Still used, but will be confirmed again.
+    NEIGH_FAILED        = 4 // Did not answer ARP. Negative entry.
+};
+
+/**
+ * What we know about the neighbour with a single MIP address.
+ */
+struct neigh_entry {
+    enum neigh_state state;
+    uint8_t mac[6]; // The MAC address of the neighbour.
+    struct eth_interface *interface; // The interface the neighbour was learned on.
+    uint64_t confirmed; // When the neighbour was last confirmed, in milliseconds.
+    uint64_t updated; // When the state last changed, in milliseconds.
+    uint64_t probed; // When an ARP request was last sent to confirm the neighbour, in milliseconds.
+};
+
+/**
+ * Counters for the neighbour table.
+ */
+struct neigh_stats {
+    uint64_t hits; // Lookups that found a usable neighbour.
+    uint64_t misses; // Lookups that did not.
+    uint64_t probes; // ARP requests sent to confirm stale neighbours.
+    uint64_t suppressed; // Requests failed right away, because of a negative entry.
+    uint64_t changes; // Times a neighbour changed MAC address or interface.
+};
+
+struct neigh_entry *neigh_lookup(uint8_t mip, uint64_t now);
+int neigh_needs_probe(struct neigh_entry *entry, uint64_t now);
+int neigh_is_failed(uint8_t mip, uint64_t now);
+
+void neigh_confirm(uint8_t mip, uint8_t mac[6], struct eth_interface *interface, uint64_t now);
+void neigh_refresh(uint8_t mip, uint8_t mac[6], uint64_t now);
+void neigh_incomplete(uint8_t mip, uint64_t now);
+void neigh_failed(uint8_t mip, uint64_t now);
+
+struct neigh_entry *neigh_get(uint8_t mip);
+struct neigh_stats *neigh_get_stats();
+
+#endif
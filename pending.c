@@ -0,0 +1,362 @@
+#include "pending.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Store the outstanding operations for every MIP address.
+ * Format:
+ *      pendingTable[Mip Address] = Entry, or NULL if nothing has been sent to the address yet.
+ */
+struct pending_entry *pendingTable[256] = {0};
+
+/**
+ * Store the timer wheel the request timeouts are kept in, and what to call when they expire.
+ */
+struct timer_wheel *pendingWheel;
+void (*pendingArpExpired)(struct timer *timer);
+void (*pendingDataExpired)(struct timer *timer);
+
+/**
+ * Set up the timeouts of the pending table.
+ * Input:
+ *      wheel - The timer wheel to keep the timeouts in.
+ *      arpExpired - Called when the oldest payload waiting for ARP of an entry times out.
+ *      dataExpired - Called when the oldest session waiting for data of an entry times out.
+ */
+void pending_init(struct timer_wheel *wheel, void (*arpExpired)(struct timer *timer), void (*dataExpired)(struct timer *timer)) {
+    pendingWheel = wheel;
+    pendingArpExpired = arpExpired;
+    pendingDataExpired = dataExpired;
+}
+
+/**
+ * Get the entry for a MIP address, creating it if it does not exist.
+ * Input:
+ *      mip - The MIP address.
+ * Return:
+ *      A pointer to the entry.
+ */
+struct pending_entry *pending_get(uint8_t mip) {
+    if (!pendingTable[mip]) {
+        pendingTable[mip] = calloc(1, sizeof(struct pending_entry));
+        if (!pendingTable[mip]) {
+            perror("pending_get: calloc()");
+            exit(EXIT_FAILURE);
+        }
+        pendingTable[mip]->mip = mip;
+        pendingTable[mip]->status = NOT_WAITING;
+        timer_init(&pendingTable[mip]->arpTimer, pendingArpExpired, pendingTable[mip]);
+        timer_init(&pendingTable[mip]->dataTimer, pendingDataExpired, pendingTable[mip]);
+    }
+    return pendingTable[mip];
+}
+
+/**
+ * Get the entry for a MIP address, if it exists.
+ * Input:
+ *      mip - The MIP address.
+ * Return:
+ *      A pointer to the entry, or NULL if nothing has been sent to the address.
+ */
+struct pending_entry *pending_find(uint8_t mip) {
+    return pendingTable[mip];
+}
+
+/**
+ * Queue a payload until the ARP lookup for the destination is done.
+ * Input:
+ *      entry - The entry of the destination.
+ *      fd - The session the payload was sent from.
+ *      requestId - The request of the session the payload belongs to.
+ *      tag - Fingerprint of the payload, see pending_tag().
+ *      respBuffer - Whether the session expects a response.
+ *      buffer - The buffer with the payload at FRAME_PAYLOAD_OFFSET, or the first of its fragments. Referenced
+ *               until the payload is popped.
+ *      length - Length of the payload. At most MAX_MESSAGE_SIZE.
+ *      deadline - When the request times out, in milliseconds. Never earlier than queued payloads.
+ * Return:
+ *      0 if successful, -1 if the queue is full.
+ */
+int pending_queue_frame(
+    struct pending_entry *entry,
+    int fd,
+    uint32_t requestId,
+    uint32_t tag,
+    enum arp_restore_status respBuffer,
+    struct frame_buffer *buffer,
+    size_t length,
+    uint64_t deadline
+) {
+    if (entry->frameCount == PENDING_QUEUE_SIZE) {
+        return -1;
+    }
+
+    struct pending_frame *frame = &entry->frames[(entry->frameHead + entry->frameCount) % PENDING_QUEUE_SIZE];
+    frame->fd = fd;
+    frame->requestId = requestId;
+    frame->tag = tag;
+    frame->respBuffer = respBuffer;
+    frame->deadline = deadline;
+    frame->buffer = frame_ref(buffer);
+    frame->length = length;
+
+    entry->frameCount++;
+    pending_update_status(entry);
+    return 0;
+}
+
+/**
+ * Get the oldest payload waiting for ARP.
+ * Input:
+ *      entry - The entry of the destination.
+ * Return:
+ *      A pointer to the payload, valid until it is popped, or NULL if the queue is empty.
+ */
+struct pending_frame *pending_peek_frame(struct pending_entry *entry) {
+    if (!entry->frameCount) {
+        return NULL;
+    }
+    return &entry->frames[entry->frameHead];
+}
+
+/**
+ * Remove the oldest payload waiting for ARP.
+ * Input:
+ *      entry - The entry of the destination.
+ */
+void pending_pop_frame(struct pending_entry *entry) {
+    if (!entry->frameCount) {
+        return;
+    }
+    frame_unref(entry->frames[entry->frameHead].buffer);
+    entry->frameHead = (entry->frameHead + 1) % PENDING_QUEUE_SIZE;
+    entry->frameCount--;
+    pending_update_status(entry);
+}
+
+/**
+ * Get a fingerprint of the start of a payload. MIP carries no request ID, so a reply can only be told apart from
+ * the others if it echoes its request, which the fingerprints of both then show. Trailing zeroes are left out,
+ * since payloads are padded with them on the wire.
+ * Input:
+ *      payload - The payload.
+ *      length - Length of the payload. Only the first PENDING_TAG_BYTES are used.
+ * Return:
+ *      The fingerprint, a 32 bit FNV-1a hash.
+ */
+uint32_t pending_tag(const char *payload, size_t length) {
+    if (length > PENDING_TAG_BYTES) {
+        length = PENDING_TAG_BYTES;
+    }
+    while (length && !payload[length - 1]) {
+        length--;
+    }
+
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)payload[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Add a session to the sessions waiting for a data response.
+ * Input:
+ *      entry - The entry of the destination.
+ *      fd - The waiting session.
+ *      requestId - The request of the session that waits.
+ *      tag - Fingerprint of the request payload, see pending_tag().
+ *      deadline - When the request times out, in milliseconds. Never earlier than other waiters.
+ *      sentAt - When the request was sent, in nanoseconds.
+ * Return:
+ *      0 if successful, -1 if there are too many waiting sessions.
+ */
+int pending_add_waiter(
+    struct pending_entry *entry,
+    int fd,
+    uint32_t requestId,
+    uint32_t tag,
+    uint64_t deadline,
+    uint64_t sentAt
+) {
+    if (entry->waiterCount == PENDING_MAX_WAITERS) {
+        return -1;
+    }
+    struct pending_waiter *waiter = &entry->waiters[(entry->waiterHead + entry->waiterCount) % PENDING_MAX_WAITERS];
+    waiter->fd = fd;
+    waiter->requestId = requestId;
+    waiter->tag = tag;
+    waiter->deadline = deadline;
+    waiter->sentAt = sentAt;
+    entry->waiterCount++;
+    pending_update_status(entry);
+    return 0;
+}
+
+/**
+ * Get the session that has waited the longest for a data response.
+ * Input:
+ *      entry - The entry of the destination.
+ * Return:
+ *      A pointer to the waiter, valid until it is popped, or NULL if no session is waiting.
+ */
+struct pending_waiter *pending_peek_waiter(struct pending_entry *entry) {
+    if (!entry->waiterCount) {
+        return NULL;
+    }
+    return &entry->waiters[entry->waiterHead];
+}
+
+/**
+ * Get a session waiting for a data response, by its place in the queue.
+ * Input:
+ *      entry - The entry of the destination.
+ *      index - The place of the waiter, 0 for the one that has waited the longest.
+ * Return:
+ *      A pointer to the waiter, valid until a waiter is removed, or NULL if there are not that many waiters.
+ */
+struct pending_waiter *pending_waiter_at(struct pending_entry *entry, int index) {
+    if (index < 0 || index >= entry->waiterCount) {
+        return NULL;
+    }
+    return &entry->waiters[(entry->waiterHead + index) % PENDING_MAX_WAITERS];
+}
+
+/**
+ * Remove the session that has waited the longest for a data response.
+ * Input:
+ *      entry - The entry of the destination.
+ * Return:
+ *      The file descriptor of the session, or -1 if no session is waiting.
+ */
+int pending_pop_waiter(struct pending_entry *entry) {
+    if (!entry->waiterCount) {
+        return -1;
+    }
+    int fd = entry->waiters[entry->waiterHead].fd;
+    entry->waiterHead = (entry->waiterHead + 1) % PENDING_MAX_WAITERS;
+    entry->waiterCount--;
+    pending_update_status(entry);
+    return fd;
+}
+
+/**
+ * Find the waiter a data response is for. That is the oldest waiter whose request the response echoes, going by
+ * the fingerprints, or the oldest waiter if none does: requests are answered in the order they were sent.
+ * Input:
+ *      entry - The entry of the destination. Must have waiters.
+ *      tag - Fingerprint of the response, see pending_tag().
+ * Return:
+ *      The place of the waiter in the queue, for pending_take_waiter().
+ */
+int pending_match_waiter(struct pending_entry *entry, uint32_t tag) {
+    int i;
+    for (i = 0; i < entry->waiterCount; i++) {
+        if (pending_waiter_at(entry, i)->tag == tag) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Remove a session waiting for a data response, wherever it is in the queue.
+ * Input:
+ *      entry - The entry of the destination.
+ *      index - The place of the waiter. Must be less than the number of waiters.
+ *      waiter - Where to store a copy of the waiter.
+ */
+void pending_take_waiter(struct pending_entry *entry, int index, struct pending_waiter *waiter) {
+    *waiter = *pending_waiter_at(entry, index);
+
+    // Close the gap by moving the older waiters up, keeping the order.
+    int i;
+    for (i = index; i > 0; i--) {
+        *pending_waiter_at(entry, i) = *pending_waiter_at(entry, i - 1);
+    }
+    entry->waiterHead = (entry->waiterHead + 1) % PENDING_MAX_WAITERS;
+    entry->waiterCount--;
+    pending_update_status(entry);
+}
+
+/**
+ * Update the timer of an entry, so it expires with the oldest request in a queue.
+ * Input:
+ *      timer - The timer to update.
+ *      count - Number of requests in the queue.
+ *      deadline - The deadline of the oldest request in the queue.
+ */
+void pending_update_timer(struct timer *timer, int count, uint64_t deadline) {
+    if (!pendingWheel) {
+        return;
+    }
+    if (!count) {
+        timer_cancel(pendingWheel, timer);
+    } else if (!timer->active || timer->expires != deadline) {
+        timer_add(pendingWheel, timer, deadline);
+    }
+}
+
+/**
+ * Update the status and timers of an entry, based on what it has queued.
+ * Input:
+ *      entry - The entry to update.
+ */
+void pending_update_status(struct pending_entry *entry) {
+    if (entry->frameCount) {
+        entry->status = WAITING_ARP;
+    } else if (entry->waiterCount) {
+        entry->status = WAITING_DATA;
+    } else {
+        entry->status = NOT_WAITING;
+    }
+
+    pending_update_timer(&entry->arpTimer, entry->frameCount, entry->frames[entry->frameHead].deadline);
+    pending_update_timer(&entry->dataTimer, entry->waiterCount, entry->waiters[entry->waiterHead].deadline);
+}
+
+/**
+ * Remove everything a session has queued or is waiting for, typically because it disconnected.
+ * Input:
+ *      fd - The file descriptor of the session.
+ */
+void pending_drop_session(int fd) {
+    int mip;
+    for (mip = 0; mip < 256; mip++) {
+        struct pending_entry *entry = pendingTable[mip];
+        if (!entry) {
+            continue;
+        }
+
+        int i, kept = 0;
+        for (i = 0; i < entry->frameCount; i++) {
+            struct pending_frame *frame = &entry->frames[(entry->frameHead + i) % PENDING_QUEUE_SIZE];
+            if (frame->fd == fd) {
+                frame_unref(frame->buffer);
+                continue;
+            }
+            struct pending_frame *dest = &entry->frames[(entry->frameHead + kept) % PENDING_QUEUE_SIZE];
+            if (dest != frame) {
+                memcpy(dest, frame, sizeof(struct pending_frame));
+            }
+            kept++;
+        }
+        entry->frameCount = kept;
+
+        kept = 0;
+        for (i = 0; i < entry->waiterCount; i++) {
+            struct pending_waiter waiter = entry->waiters[(entry->waiterHead + i) % PENDING_MAX_WAITERS];
+            if (waiter.fd == fd) {
+                continue;
+            }
+            entry->waiters[(entry->waiterHead + kept) % PENDING_MAX_WAITERS] = waiter;
+            kept++;
+        }
+        entry->waiterCount = kept;
+
+        pending_update_status(entry);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef _pending_h
+#define _pending_h
+
+#include "daemon.h"
+#include "ethernet.h"
+#include "frame_pool.h"
+#include "timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Max number of payloads that can wait for an ARP response for a single destination.
+ */
+#define PENDING_QUEUE_SIZE 8
+
+/**
+ * Max number of sessions that can wait for a data response from a single destination.
+ */
+#define PENDING_MAX_WAITERS 64
+
+/**
+ * Number of bytes at the start of a payload its tag is computed from, see pending_tag().
+ */
+#define PENDING_TAG_BYTES 64
+
+/**
+ * A payload waiting for the ARP lookup of its destination to finish.
+ */
+struct pending_frame {
+    int fd; // The session the payload was sent from.
+    uint32_t requestId; // The request of the session the payload belongs to.
+    uint32_t tag; // Fingerprint of the payload, see pending_tag().
+    enum arp_restore_status respBuffer; // Whether the session expects a response.
+    uint64_t deadline; // When the request times out, in milliseconds.
+    struct frame_buffer *buffer; // Holds the payload at FRAME_PAYLOAD_OFFSET, or its first fragment. Referenced while queued.
+    size_t length; // Length of the payload. Larger than MAX_PAYLOAD_SIZE if it is split into fragments.
+};
+
+/**
+ * A session waiting for a data response.
+ */
+struct pending_waiter {
+    int fd; // The waiting session.
+    uint32_t requestId; // The request of the session that waits.
+    uint32_t tag; // Fingerprint of the request payload, to recognize a reply echoing it.
+    uint64_t deadline; // When the request times out, in milliseconds.
+    uint64_t sentAt; // When the request was sent, in nanoseconds, for the round trip time.
+};
+
+/**
+ * Every outstanding operation towards a single MIP address.
+ * Requests time out in the order they were made, so only the oldest payload and the oldest waiter
+ * need a timer in the wheel at any time.
+ */
+struct pending_entry {
+    uint8_t mip; // The destination.
+    enum packet_waiting_status status; // What the entry is waiting for.
+    uint64_t arpStarted; // When the last ARP request was broadcast, in nanoseconds.
+    struct timer arpTimer; // Expires with the oldest payload waiting for ARP.
+    struct timer dataTimer; // Expires with the oldest waiter.
+
+    // Ring buffer of payloads waiting for ARP.
+    int frameHead;
+    int frameCount;
+    struct pending_frame frames[PENDING_QUEUE_SIZE];
+
+    // Ring buffer of sessions waiting for a data response, oldest first.
+    int waiterHead;
+    int waiterCount;
+    struct pending_waiter waiters[PENDING_MAX_WAITERS];
+};
+
+void pending_init(struct timer_wheel *wheel, void (*arpExpired)(struct timer *timer), void (*dataExpired)(struct timer *timer));
+struct pending_entry *pending_get(uint8_t mip);
+struct pending_entry *pending_find(uint8_t mip);
+
+int pending_queue_frame(
+    struct pending_entry *entry,
+    int fd,
+    uint32_t requestId,
+    uint32_t tag,
+    enum arp_restore_status respBuffer,
+    struct frame_buffer *buffer,
+    size_t length,
+    uint64_t deadline);
+struct pending_frame *pending_peek_frame(struct pending_entry *entry);
+void pending_pop_frame(struct pending_entry *entry);
+
+uint32_t pending_tag(const char *payload, size_t length);
+int pending_add_waiter(
+    struct pending_entry *entry,
+    int fd,
+    uint32_t requestId,
+    uint32_t tag,
+    uint64_t deadline,
+    uint64_t sentAt);
+struct pending_waiter *pending_peek_waiter(struct pending_entry *entry);
+struct pending_waiter *pending_waiter_at(struct pending_entry *entry, int index);
+int pending_pop_waiter(struct pending_entry *entry);
+int pending_match_waiter(struct pending_entry *entry, uint32_t tag);
+void pending_take_waiter(struct pending_entry *entry, int index, struct pending_waiter *waiter);
+
+void pending_update_status(struct pending_entry *entry);
+void pending_drop_session(int fd);
+
+#endif
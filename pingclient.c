@@ -1,97 +1,390 @@
 #include "ethernet.h"
 #include "shared.h"
+#include "histogram.h"
+#include "libmip.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
-int main(int argc, char* argv[]) {
-    if (argc <= 1) { //Not enough args for help.
-        printf("Syntax: %s [-h] <Destination host> <Message> <Unix socket>\n", argv[0]);
-        return EXIT_SUCCESS;
+#define SYNTAX "Syntax: %s [-h] [-n count] [-w window] [-s size] [-r rate] [-m] <Destination host> <Message> <Unix socket>\n"
+
+/**
+ * Time in milliseconds without any reply before a load test gives up on the outstanding requests.
+ */
+#define LOAD_IDLE_TIMEOUT 10000
+
+/**
+ * Start of every payload sent in load mode. The rest of the payload is filled with the message.
+ */
+struct load_payload {
+    uint32_t sequence; // Sequence number of the request. Starts at 1.
+    uint64_t sentAt; // Time the request was sent, in nanoseconds of the monotonic clock.
+} __attribute__((packed));
+
+/**
+ * The progress of a load test.
+ */
+struct load_state {
+    uint64_t *sentAt; // Send time of every request, by sequence number. 0 once it has been answered.
+    struct histogram *latency; // Round trip times of the answered requests.
+    unsigned int sent, done; // Requests sent, and requests answered in any way.
+    unsigned int received, timedOut, failed; // Requests answered with a reply, with TIMED_OUT, or another error.
+    unsigned int mismatched; // Replies echoing the payload of another request than the one they answered.
+    uint64_t lastReply; // Time of the last reply.
+};
+
+/**
+ * Store the progress of the load test, for the reply callback.
+ */
+struct load_state loadState = {0};
+
+/**
+ * Get the current time of the monotonic clock.
+ * Return:
+ *      The time in nanoseconds.
+ */
+uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Print what an info code in a reply means.
+ * Input:
+ *      infoBuffer - The info code.
+ */
+void print_error(enum info infoBuffer) {
+    if (infoBuffer == TIMED_OUT) { // If the connection timed out.
+        printf("Timed out.\n");
+    } else if (infoBuffer == TOO_LONG_PAYLOAD) {
+        printf("Payload too large.\n");
+    } else if (infoBuffer == QUEUE_FULL) {
+        printf("Too many pending requests.\n");
+    } else if (infoBuffer == HOST_UNREACHABLE) {
+        printf("Host unreachable.\n");
+    } else {
+        printf("Unknown error occured.\n");
     }
+}
 
-    if (!strcmp(argv[1], "-h")) { // Show help.
-        printf("Syntax: %s [-h] <Destination host> <Message> <Unix socket>\n", argv[0]);
-        printf("-h: Show help and exit.\n");
-        return EXIT_SUCCESS;
+/**
+ * Print the reply to a single ping, and stop waiting.
+ * Input:
+ *      client - The connection.
+ *      requestId - The request ID of the ping.
+ *      info - NO_ERROR if answered, the error otherwise.
+ *      mip - The MIP address the reply is from.
+ *      payload - The reply.
+ *      length - Length of the reply.
+ *      arg - Set to 1 once answered.
+ */
+void ping_reply(
+    struct mip_client *client,
+    uint32_t requestId,
+    enum info info,
+    uint8_t mip,
+    char *payload,
+    size_t length,
+    void *arg
+) {
+    if (info == NO_ERROR) { // If no error occured.
+        printf("Ping received: %.*s\n", (int)strnlen(payload, length), payload);
+    } else {
+        print_error(info);
     }
+    *(char *)arg = 1;
+}
 
-    if (argc < 4) { //Not enough args
-        printf("Syntax: %s [-h] <Destination host> <Message> <Unix socket>\n", argv[0]);
-        return EXIT_SUCCESS;
+/**
+ * Send a single ping, and print the reply.
+ * Input:
+ *      client - The connection to the daemon.
+ *      mip_addr - The destination.
+ *      msg - The message to send.
+ */
+void ping_once(struct mip_client *client, unsigned char mip_addr, char *msg) {
+    printf("Pinging %hhu..\n", mip_addr);
+
+    char answered = 0;
+    if (!mip_send(client, mip_addr, msg, strlen(msg), ping_reply, &answered)) {
+        perror("mip_send()");
+        exit(EXIT_FAILURE);
+    }
+    if (mip_flush(client) == -1) {
+        perror("mip_flush()");
+        exit(EXIT_FAILURE);
     }
+    printf("Ping sent %s.\n", msg);
 
-    // Message:
-    char * msg = argv[2];
+    // The daemon answers with a timeout, if nothing else.
+    while (!answered) {
+        if (mip_wait(client, -1) == -1) {
+            if (errno == EPROTONOSUPPORT) {
+                printf("The daemon does not support the length prefixed format.\n");
+            } else {
+                printf("Connection to the daemon lost.\n");
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-    // Socket path:
-    char *sockpath = argv[3];
+/**
+ * Account for a reply in a load test.
+ * Input:
+ *      client - The connection.
+ *      requestId - The request ID of the ping.
+ *      info - NO_ERROR if answered, the error otherwise.
+ *      mip - The MIP address the reply is from.
+ *      payload - The reply.
+ *      length - Length of the reply.
+ *      arg - The sequence number of the ping.
+ */
+void load_reply(
+    struct mip_client *client,
+    uint32_t requestId,
+    enum info info,
+    uint8_t mip,
+    char *payload,
+    size_t length,
+    void *arg
+) {
+    struct load_state *state = &loadState;
+    uint32_t sequence = (uintptr_t)arg;
+    if (!state->sentAt[sequence]) { // Answered already.
+        return;
+    }
+    uint64_t replyAt = now_ns();
+    state->lastReply = replyAt;
 
-    // Create socket.
-    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-    if (sock == -1) {
-        perror("socket()");
-        exit(EXIT_FAILURE);
+    if (info == NO_ERROR) {
+        // Use the send time carried in the payload if the server echoed it, the one stored otherwise. The daemon
+        // can only guess which request an echo answers, so it may carry another request's sequence number: Its
+        // own send time still gives a true round trip, but a sequence never sent gives no sample at all.
+        uint64_t sendTime = state->sentAt[sequence];
+        struct load_payload head;
+        if (length >= sizeof(head)) {
+            memcpy(&head, payload, sizeof(head));
+            if (head.sequence != sequence) {
+                state->mismatched++;
+                sendTime = head.sequence >= 1 && head.sequence <= state->sent ? head.sentAt : 0;
+            } else {
+                sendTime = head.sentAt;
+            }
+        }
+        if (sendTime && sendTime <= replyAt) {
+            histogram_record(state->latency, replyAt - sendTime);
+        }
+        state->received++;
+    } else if (info == TIMED_OUT) {
+        state->timedOut++;
+    } else {
+        state->failed++;
     }
+    state->sentAt[sequence] = 0;
+    state->done++;
+}
 
-    // Connect it.
-    struct sockaddr_un sockaddr;
-    sockaddr.sun_family = AF_UNIX;
-    strcpy(sockaddr.sun_path, sockpath);
-    
-    if (connect(sock, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1) {
-        perror("connect()");
+/**
+ * Send a number of pings with several outstanding at a time, and print the throughput, loss and latency.
+ * Input:
+ *      client - The connection to the daemon.
+ *      mip_addr - The destination.
+ *      msg - The message the payloads are filled with.
+ *      count - Number of pings to send.
+ *      window - Max number of pings waiting for a reply.
+ *      size - Size of each payload, in bytes.
+ *      rate - Max number of pings sent per second, or 0 for no limit.
+ */
+void load_test(
+    struct mip_client *client,
+    unsigned char mip_addr,
+    char *msg,
+    unsigned int count,
+    unsigned int window,
+    size_t size,
+    double rate
+) {
+    struct load_state *state = &loadState;
+    state->sentAt = calloc(count + 1, sizeof(uint64_t));
+    state->latency = malloc(sizeof(struct histogram));
+    if (!state->sentAt || !state->latency) {
+        perror("malloc()");
         exit(EXIT_FAILURE);
     }
+    histogram_init(state->latency);
+
+    if (size < sizeof(struct load_payload)) {
+        size = sizeof(struct load_payload);
+    }
+    if (size > MAX_MESSAGE_SIZE) {
+        size = MAX_MESSAGE_SIZE;
+    }
+    // Payloads larger than a frame are split by the daemon, and reassembled before they reach the server.
+    static char payload[MAX_MESSAGE_SIZE];
+    size_t i, msgLength = strlen(msg);
+    for (i = 0; i < size; i++) {
+        payload[i] = msgLength ? msg[i % msgLength] : 0;
+    }
 
-    // Variables for sendmsg and recvmsg.
-    char buffer[MAX_PACKET_SIZE] = {0};
-    strcpy(buffer, msg);
-    unsigned char mip_addr = atoi(argv[1]);
-    enum info infoBuffer = NO_ERROR;
+    printf("Sending %u pings of %zu bytes to %hhu, window %u.\n", count, size, mip_addr, window);
 
-    struct iovec iov[3];
-    iov[0].iov_base = &mip_addr;
-    iov[0].iov_len = sizeof(mip_addr);
+    uint64_t interval = rate > 0 ? (uint64_t)(1000000000.0 / rate) : 0;
+    uint64_t start = now_ns();
+    state->lastReply = start;
 
-    iov[1].iov_base = &infoBuffer;
-    iov[1].iov_len = sizeof(infoBuffer);
+    while (state->done < count) {
+        uint64_t now = now_ns();
 
-    iov[2].iov_base = buffer;
-    iov[2].iov_len = sizeof(buffer);
+        // Send as much as the window and the rate allow, and the connection has room for.
+        while (
+            state->sent < count
+            && state->sent - state->done < window
+            && (!interval || now >= start + state->sent * interval)
+        ) {
+            struct load_payload head;
+            head.sequence = state->sent + 1;
+            head.sentAt = now;
+            memcpy(payload, &head, sizeof(head));
 
-    struct msghdr message = {0};
-    message.msg_iov = iov;
-    message.msg_iovlen = 3;
+            if (!mip_send(client, mip_addr, payload, size, load_reply, (void *)(uintptr_t)head.sequence)) {
+                if (errno == EAGAIN || errno == EBUSY) {
+                    break;
+                }
+                perror("mip_send()");
+                exit(EXIT_FAILURE);
+            }
+            state->sentAt[head.sequence] = now;
+            state->sent++;
+            now = now_ns();
+        }
 
-    printf("Pinging %hhu..\n", mip_addr);
+        // Wait for a reply, or until the next ping may be sent.
+        int timeout = 1000;
+        if (interval && state->sent < count && state->sent - state->done < window) {
+            uint64_t next = start + state->sent * interval;
+            timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+        }
+        if (mip_wait(client, timeout) == -1) {
+            if (errno == EPROTONOSUPPORT) {
+                printf("Load mode needs a daemon supporting the length prefixed format.\n");
+            } else {
+                printf("Connection to the daemon lost.\n");
+            }
+            exit(EXIT_FAILURE);
+        }
 
-    if (sendmsg(sock, &message, 0) == -1) {
-        perror("sendmsg()");
-        exit(EXIT_FAILURE);
+        // Stop if the daemon has stopped answering altogether.
+        if (state->done < state->sent && now_ns() - state->lastReply > (uint64_t)LOAD_IDLE_TIMEOUT * 1000000) {
+            printf("No reply for %d ms, giving up.\n", LOAD_IDLE_TIMEOUT);
+            break;
+        }
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+    unsigned int lost = count - state->received;
+    printf(
+        "%u sent, %u received, %u timed out, %u failed, %.2f%% loss, in %.3f s%s.\n",
+        state->sent,
+        state->received,
+        state->timedOut,
+        state->failed,
+        count ? 100.0 * lost / count : 0,
+        elapsed,
+        client->hasRings ? ", through shared memory" : ""
+    );
+    if (state->mismatched) {
+        printf("%u replies echoed another request, timed from the echoed send time.\n", state->mismatched);
     }
-    printf("Ping sent %s.\n", buffer);
-    memset(&buffer, 0, sizeof(buffer));
+    printf("Throughput: %.1f pings/s.\n", elapsed > 0 ? state->received / elapsed : 0);
+    printf(
+        "Latency (us): min %.1f, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p999 %.1f, max %.1f.\n",
+        state->latency->count ? state->latency->min / 1e3 : 0,
+        histogram_mean(state->latency) / 1e3,
+        histogram_percentile(state->latency, 50) / 1e3,
+        histogram_percentile(state->latency, 90) / 1e3,
+        histogram_percentile(state->latency, 99) / 1e3,
+        histogram_percentile(state->latency, 99.9) / 1e3,
+        state->latency->max / 1e3
+    );
+
+    free(state->latency);
+    free(state->sentAt);
+}
 
-    // Receive message.
-    if (recvmsg(sock, &message, 0) == -1) {
-        perror("recvmsg()");
+int main(int argc, char* argv[]) {
+    if (argc <= 1) { //Not enough args for help.
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    unsigned int count = 0; // Number of pings in load mode. 0 for a single ping.
+    unsigned int window = 1;
+    size_t size = 0;
+    double rate = 0;
+    char shared = 0; // Whether to use shared memory rings.
+
+    // Options.
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h")) { // Show help.
+            printf(SYNTAX, argv[0]);
+            printf("-h: Show help and exit.\n");
+            printf("-n: Load mode: Send this many pings, and print throughput, loss and latency percentiles.\n");
+            printf("-w: Load mode: Max number of pings waiting for a reply. Default 1.\n");
+            printf("-s: Load mode: Size of each payload in bytes, up to %d. Default and min %zu.\n", MAX_MESSAGE_SIZE, sizeof(struct load_payload));
+            printf("-r: Load mode: Max number of pings per second. Default unlimited.\n");
+            printf("-m: Pass the messages through shared memory rings, when the daemon supports it.\n");
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-m")) {
+            shared = 1;
+        } else {
+            break;
+        }
+    }
+    if (window < 1) {
+        window = 1;
+    }
+
+    if (argc - i < 3) { //Not enough args
+        printf(SYNTAX, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    // Destination:
+    unsigned char mip_addr = atoi(argv[i]);
+
+    // Message:
+    char * msg = argv[i + 1];
+
+    // Socket path:
+    char *sockpath = argv[i + 2];
+
+    // Connect, in the length prefixed format so only the message itself is sent.
+    struct mip_client *client = mip_connect(sockpath, 2 * window, shared ? MIP_CLIENT_RINGS : 0);
+    if (!client) {
+        perror("mip_connect()");
         exit(EXIT_FAILURE);
     }
 
-    if (infoBuffer == NO_ERROR) { // If no error occured.
-        printf("Ping received: %s\n", buffer);
-    } else if (infoBuffer == TIMED_OUT) { // If the connection timed out.
-        printf("Timed out.\n");
-    } else if (infoBuffer == TOO_LONG_PAYLOAD) {
-        printf("Payload too large.\n");
+    if (count) {
+        load_test(client, mip_addr, msg, count, window, size, rate);
     } else {
-        printf("Unknown error occured.\n");
+        ping_once(client, mip_addr, msg);
     }
 
-    close(sock);
-}
\ No newline at end of file
+    mip_close(client);
+}
@@ -1,109 +1,212 @@
 #include "ethernet.h"
 #include "shared.h"
+#include "libmip.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/un.h>
-#include <unistd.h>
+#include <time.h>
+
+#define SYNTAX "Syntax: %s [-h] [-e] [-m] [-s size] [-i seconds] <Unix socket>\n"
+
+/**
+ * Get the current time of the monotonic clock.
+ * Return:
+ *      The time in milliseconds.
+ */
+uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * The progress of echo mode.
+ */
+struct echo_state {
+    size_t size; // Size of each reply in bytes, or 0 to reply with exactly what was received.
+    uint64_t served; // Requests served since the last report.
+};
+
+/**
+ * Send a payload back where it came from, in echo mode.
+ * Input:
+ *      client - The connection.
+ *      mip - The MIP address the payload came from.
+ *      payload - The payload.
+ *      length - Length of the payload.
+ *      arg - The struct echo_state.
+ */
+void echo_message(struct mip_client *client, uint8_t mip, char *payload, size_t length, void *arg) {
+    static char padded[MAX_MESSAGE_SIZE];
+    struct echo_state *state = arg;
+
+    if (state->size && state->size != length) {
+        memcpy(padded, payload, length < state->size ? length : state->size);
+        if (state->size > length) {
+            memset(padded + length, 0, state->size - length);
+        }
+        payload = padded;
+        length = state->size;
+    }
+    if (mip_reply(client, mip, payload, length) == -1) {
+        if (errno == EAGAIN) { // The daemon is not keeping up, the ping times out.
+            return;
+        }
+        perror("mip_reply()");
+        exit(EXIT_FAILURE);
+    }
+    state->served++;
+}
+
+/**
+ * Serve pings in echo mode: Every payload is sent back, and the number of requests served is reported.
+ * Input:
+ *      client - The connection to the daemon.
+ *      size - Size of each reply in bytes, or 0 to reply with exactly what was received.
+ *      interval - Seconds between each report of the number of served requests.
+ */
+void echo_loop(struct mip_client *client, size_t size, unsigned int interval) {
+    struct echo_state state = {0};
+    state.size = size;
+    if (mip_listen(client, echo_message, &state) == -1) {
+        perror("mip_listen()");
+        exit(EXIT_FAILURE);
+    }
+    printf("Now echoing connections.\n");
+    fflush(stdout);
+
+    uint64_t total = 0;
+    uint64_t lastReport = now_ms();
+    char announced = 0;
+
+    while (1) {
+        // Wait for messages, but not past the next report.
+        uint64_t now = now_ms();
+        uint64_t nextReport = lastReport + interval * 1000;
+        if (mip_wait(client, nextReport > now ? nextReport - now : 0) == -1) {
+            if (errno == EPROTONOSUPPORT) {
+                printf("Echo mode needs a daemon supporting the length prefixed format.\n");
+            } else {
+                printf("Connection to the daemon lost.\n");
+            }
+            exit(EXIT_FAILURE);
+        }
+        if (client->hasRings && !announced) {
+            printf("Using shared memory rings.\n");
+            fflush(stdout);
+            announced = 1;
+        }
+
+        now = now_ms();
+        if (now >= nextReport) {
+            total += state.served;
+            printf(
+                "Served %.1f requests/s, %llu in total.\n",
+                state.served * 1000.0 / (now - lastReport),
+                (unsigned long long)total
+            );
+            fflush(stdout);
+            state.served = 0;
+            lastReport = now;
+        }
+    }
+}
+
+/**
+ * Print a ping, and answer it with a pong.
+ * Input:
+ *      client - The connection.
+ *      mip - The MIP address the ping came from.
+ *      payload - The ping.
+ *      length - Length of the ping.
+ *      arg - Unused.
+ */
+void pong_message(struct mip_client *client, uint8_t mip, char *payload, size_t length, void *arg) {
+    printf("Ping received: %.*s \n", (int)strnlen(payload, length), payload);
+    fflush(stdout);
+    if (mip_reply(client, mip, "PONG", 4) == -1) {
+        perror("mip_reply()");
+        exit(EXIT_FAILURE);
+    }
+}
 
 int main(int argc, char* argv[]) {
     if (argc <= 1) { //Not enough args
-        printf("Syntax: %s [-h] <Unix socket>\n", argv[0]);
+        printf(SYNTAX, argv[0]);
         return EXIT_SUCCESS;
     }
 
-    if (!strcmp(argv[1], "-h")) { // Show help.
-        printf("Syntax: %s [-h] <Unix socket>\n", argv[0]);
-        printf("-h: Show help and exit.\n");
+    char echo = 0;
+    char shared = 0; // Whether to use shared memory rings.
+    size_t size = 0;
+    unsigned int interval = 1;
+
+    // Options.
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h")) { // Show help.
+            printf(SYNTAX, argv[0]);
+            printf("-h: Show help and exit.\n");
+            printf("-e: Echo mode: Send every payload back, and report requests per second.\n");
+            printf("-m: Pass the messages through shared memory rings, when the daemon supports it.\n");
+            printf("-s: Echo mode: Size of each reply in bytes, padded or cut from the payload. Default the payload size.\n");
+            printf("-i: Echo mode: Seconds between each report. Default 1.\n");
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "-e")) {
+            echo = 1;
+        } else if (!strcmp(argv[i], "-m")) {
+            shared = 1;
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+            if (size > MAX_MESSAGE_SIZE) {
+                size = MAX_MESSAGE_SIZE;
+            }
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interval = atoi(argv[++i]);
+            if (interval < 1) {
+                interval = 1;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (i >= argc) {
+        printf(SYNTAX, argv[0]);
         return EXIT_SUCCESS;
     }
 
     // Socket path:
-    char *sockpath = argv[1];
+    char *sockpath = argv[i];
 
-    // Create socket.
-    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-    if (sock == -1) {
-        perror("socket()");
+    // Connect, in the length prefixed format.
+    struct mip_client *client = mip_connect(sockpath, 0, shared ? MIP_CLIENT_RINGS : 0);
+    if (!client) {
+        perror("mip_connect()");
         exit(EXIT_FAILURE);
     }
 
-    // Connect it.
-    struct sockaddr_un sockaddr;
-    sockaddr.sun_family = AF_UNIX;
-    strcpy(sockaddr.sun_path, sockpath);
-    
-    if (connect(sock, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1) {
-        perror("connect()");
-        exit(EXIT_FAILURE);
+    if (echo) {
+        echo_loop(client, size, interval);
     }
 
-    // Variables for sendmsg and recvmsg.
-    char buffer[MAX_PACKET_SIZE] = {0};
-    char mip_addr = 0;
-    enum info infoBuffer = LISTEN;
-
-    struct iovec iov[3];
-    iov[0].iov_base = &mip_addr;
-    iov[0].iov_len = sizeof(mip_addr);
-
-    iov[1].iov_base = &infoBuffer;
-    iov[1].iov_len = sizeof(infoBuffer);
-
-    iov[2].iov_base = buffer;
-    iov[2].iov_len = sizeof(buffer);
-
-    struct msghdr message = {0};
-    message.msg_iov = iov;
-    message.msg_iovlen = 3;
-
-    if (sendmsg(sock, &message, 0) == -1) {
-        perror("sendmsg()");
+    if (mip_listen(client, pong_message, NULL) == -1) {
+        perror("mip_listen()");
         exit(EXIT_FAILURE);
     }
     printf("Now listening to connections.\n");
+    fflush(stdout);
 
-    while (1) {
-        // Receive message.
-        if (recvmsg(sock, &message, 0) == -1) {
-            perror("recvmsg()");
-            exit(EXIT_FAILURE);
-        }
-
-        // Print it.
-        if (infoBuffer == NO_ERROR) {
-            printf("Ping received: %s \n", buffer);
-        } else {
-            printf("Unknown error.\n");
-        }
-
-        // Prepare to send a pong back.
-        memset(&buffer, 0, MAX_PAYLOAD_SIZE);
-        buffer[0] = 'P';
-        buffer[1] = 'O';
-        buffer[2] = 'N';
-        buffer[3] = 'G';
-        buffer[4] = '\0';
-        infoBuffer = NO_RESPONSE;
-
-        // Send it.
-        if (sendmsg(sock, &message, 0) == -1) {
-            perror("sendmsg()");
-            exit(EXIT_FAILURE);
-        }
-
-        // Tell the daemon to listen again.
-        /*
-        infoBuffer = LISTEN;
-        memset(&buffer, 0, MAX_PAYLOAD_SIZE);
-        if (sendmsg(sock, &message, 0) == -1) {
-            perror("sendmsg()");
-            exit(EXIT_FAILURE);
-        }
-        */
+    while (mip_wait(client, -1) != -1) {
+    }
+    if (errno == EPROTONOSUPPORT) {
+        printf("The daemon does not support the length prefixed format.\n");
+    } else {
+        printf("Connection to the daemon lost.\n");
     }
 
-    close(sock);
-}
\ No newline at end of file
+    mip_close(client);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+#include "routing.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Store the route to every MIP address, by address.
+ */
+struct route routeTable[256];
+
+/**
+ * Store the counters for the table.
+ */
+struct routing_stats routingStats = {0};
+
+/**
+ * Store the timer wheel, the interfaces and the function the updates are sent with.
+ */
+struct timer_wheel *routingWheel;
+struct eth_interface *routingInterfaces;
+void (*routingSend)(struct eth_interface *interface, char *payload, size_t length);
+
+/**
+ * Store the timers for the full updates, and for the triggered updates.
+ */
+struct timer routingPeriodicTimer;
+struct timer routingTriggerTimer;
+
+/**
+ * Send a routing update on every interface. Routes through an interface are advertised back on it as
+ * unreachable (split horizon with poison reverse), so two neighbours never count to infinity between them.
+ * Input:
+ *      triggered - 1 to only send the routes changed since the last update, 0 to send every route.
+ */
+void routing_send_updates(char triggered) {
+    char payload[ROUTE_UPDATE_SIZE];
+    struct routing_update *update = (struct routing_update *)payload;
+    struct routing_entry *entries = (struct routing_entry *)(update + 1);
+
+    struct eth_interface *tmp_interface;
+    for (tmp_interface = routingInterfaces; tmp_interface; tmp_interface = tmp_interface->next) {
+        uint16_t count = 0;
+        int destination;
+        for (destination = 0; destination < 256; destination++) {
+            struct route *route = &routeTable[destination];
+            if (!route->known || (triggered && !route->changed)) {
+                continue;
+            }
+            entries[count].destination = destination;
+            entries[count].cost = !route->local && route->interface == tmp_interface ? ROUTE_INFINITY : route->cost;
+            count++;
+        }
+        if (!count) {
+            continue;
+        }
+
+        update->version = ROUTE_VERSION;
+        update->flags = triggered ? ROUTE_FLAG_TRIGGERED : 0;
+        update->count = htons(count);
+        routingSend(tmp_interface, payload, sizeof(struct routing_update) + count * sizeof(struct routing_entry));
+
+        routingStats.updatesOut++;
+        if (triggered) {
+            routingStats.triggered++;
+        }
+    }
+
+    int destination;
+    for (destination = 0; destination < 256; destination++) {
+        routeTable[destination].changed = 0;
+    }
+}
+
+/**
+ * Send the changed routes soon, unless an update is already on its way.
+ * Does nothing before routing_init() has set up the timers.
+ */
+void routing_trigger() {
+    if (!routingTriggerTimer.callback) {
+        return;
+    }
+    if (!routingTriggerTimer.active) {
+        timer_add(routingWheel, &routingTriggerTimer, timer_now() + ROUTE_TRIGGER_DELAY);
+    }
+}
+
+/**
+ * Change a route, and send the change to the neighbours if it is a change.
+ * Input:
+ *      destination - The MIP address the route is to.
+ *      cost - The new cost. ROUTE_INFINITY if unreachable.
+ *      nextHop - The new next hop.
+ *      interface - The interface of the new next hop.
+ *      now - The current time, in milliseconds.
+ */
+void routing_set(uint8_t destination, uint8_t cost, uint8_t nextHop, struct eth_interface *interface, uint64_t now) {
+    struct route *route = &routeTable[destination];
+    route->updated = now;
+    if (route->known && route->cost == cost && route->nextHop == nextHop && route->interface == interface) {
+        return;
+    }
+
+    route->known = 1;
+    route->cost = cost;
+    route->nextHop = nextHop;
+    route->interface = interface;
+    route->changed = 1;
+    routingStats.changes++;
+    TRACE(TRACE_ROUTE, nextHop, destination, interface ? interface->sock : 0, cost, 0);
+    routing_trigger();
+}
+
+/**
+ * Send a full update on every interface, and time out the routes that have not been advertised in a while.
+ * Input:
+ *      timer - The periodic timer.
+ */
+void routing_periodic(struct timer *timer) {
+    uint64_t now = timer_now();
+
+    int destination;
+    for (destination = 0; destination < 256; destination++) {
+        struct route *route = &routeTable[destination];
+        if (!route->known || route->local) {
+            continue;
+        }
+        if (route->cost < ROUTE_INFINITY && now - route->updated > ROUTE_TIMEOUT) {
+            routingStats.expired++;
+            routing_set(destination, ROUTE_INFINITY, route->nextHop, route->interface, now);
+        } else if (route->cost >= ROUTE_INFINITY && now - route->updated > ROUTE_GARBAGE_TIME) {
+            route->known = 0;
+            route->interface = NULL;
+        }
+    }
+
+    // A full update includes every change.
+    timer_cancel(routingWheel, &routingTriggerTimer);
+    routing_send_updates(0);
+
+    // Spread the updates of neighbours out, so they do not all arrive at once.
+    timer_add(routingWheel, timer, now + ROUTE_UPDATE_INTERVAL - rand() % (ROUTE_UPDATE_INTERVAL / 4));
+}
+
+/**
+ * Send the routes changed since the last update.
+ * Input:
+ *      timer - The trigger timer.
+ */
+void routing_triggered(struct timer *timer) {
+    routing_send_updates(1);
+}
+
+/**
+ * Set up the routing table with a route to each of our own addresses, and start sending updates.
+ * Input:
+ *      wheel - The timer wheel driving the updates and the route timeouts.
+ *      interfaces - The list of interfaces. Each address is a local route, and each interface gets updates.
+ *      send - Function broadcasting a MIP_ROUTING frame with a payload on an interface.
+ */
+void routing_init(
+    struct timer_wheel *wheel,
+    struct eth_interface *interfaces,
+    void (*send)(struct eth_interface *interface, char *payload, size_t length)
+) {
+    routingWheel = wheel;
+    routingInterfaces = interfaces;
+    routingSend = send;
+
+    int destination;
+    for (destination = 0; destination < 256; destination++) {
+        routeTable[destination].cost = ROUTE_INFINITY;
+    }
+
+    // Before the local routes, as setting a route may arm the trigger timer.
+    timer_init(&routingPeriodicTimer, routing_periodic, NULL);
+    timer_init(&routingTriggerTimer, routing_triggered, NULL);
+
+    uint64_t now = timer_now();
+    struct eth_interface *tmp_interface;
+    for (tmp_interface = interfaces; tmp_interface; tmp_interface = tmp_interface->next) {
+        struct route *route = &routeTable[(uint8_t)tmp_interface->mip_addr];
+        route->local = 1;
+        routing_set(tmp_interface->mip_addr, 0, tmp_interface->mip_addr, NULL, now);
+    }
+
+    // Announce ourselves right away, so the neighbours learn about us without waiting for a full update.
+    timer_add(routingWheel, &routingPeriodicTimer, now);
+}
+
+/**
+ * Get the route to a MIP address.
+ * Input:
+ *      destination - The MIP address.
+ * Return:
+ *      A pointer to the route. Not known if there is none.
+ */
+struct route *routing_lookup(uint8_t destination) {
+    return &routeTable[destination];
+}
+
+/**
+ * Get the neighbour to send a frame to a MIP address through.
+ * Input:
+ *      destination - The MIP address.
+ * Return:
+ *      The next hop, or the destination itself if it is a neighbour or there is no route to it.
+ */
+uint8_t routing_next_hop(uint8_t destination) {
+    struct route *route = &routeTable[destination];
+    if (route->known && !route->local && route->cost < ROUTE_INFINITY) {
+        return route->nextHop;
+    }
+    return destination;
+}
+
+/**
+ * Update the table from a routing update received from a neighbour. The neighbour itself is one hop away,
+ * and everything it can reach is one hop further. A route is replaced by a cheaper one, and always follows
+ * what its own next hop says, better or worse.
+ * Input:
+ *      interface - The interface the update arrived on.
+ *      source - The MIP address of the neighbour.
+ *      payload - The payload of the MIP_ROUTING frame.
+ *      length - Length of the payload.
+ *      now - The current time, in milliseconds.
+ */
+void routing_receive(struct eth_interface *interface, uint8_t source, char *payload, size_t length, uint64_t now) {
+    struct routing_update update;
+    if (length < sizeof(update) || routeTable[source].local) {
+        return;
+    }
+    memcpy(&update, payload, sizeof(update));
+    uint16_t count = ntohs(update.count);
+    if (update.version != ROUTE_VERSION || length < sizeof(update) + count * sizeof(struct routing_entry)) {
+        return;
+    }
+    routingStats.updatesIn++;
+
+    routing_set(source, 1, source, interface, now);
+
+    struct routing_entry *entries = (struct routing_entry *)(payload + sizeof(update));
+    uint16_t n;
+    for (n = 0; n < count; n++) {
+        uint8_t destination = entries[n].destination;
+        struct route *route = &routeTable[destination];
+        if (route->local || destination == source) {
+            continue;
+        }
+
+        uint8_t cost = entries[n].cost >= ROUTE_INFINITY - 1 ? ROUTE_INFINITY : entries[n].cost + 1;
+        if (route->known && route->nextHop == source && route->interface == interface) {
+            if (cost != route->cost) {
+                routing_set(destination, cost, source, interface, now);
+            } else if (cost < ROUTE_INFINITY) {
+                route->updated = now;
+            }
+        } else if (cost < route->cost) {
+            routing_set(destination, cost, source, interface, now);
+        }
+    }
+}
+
+/**
+ * Make every route through a neighbour unreachable, because the neighbour is gone.
+ * Input:
+ *      neighbour - The MIP address of the neighbour.
+ *      now - The current time, in milliseconds.
+ */
+void routing_neighbour_lost(uint8_t neighbour, uint64_t now) {
+    int destination;
+    for (destination = 0; destination < 256; destination++) {
+        struct route *route = &routeTable[destination];
+        if (route->known && !route->local && route->nextHop == neighbour && route->cost < ROUTE_INFINITY) {
+            routing_set(destination, ROUTE_INFINITY, neighbour, route->interface, now);
+        }
+    }
+}
+
+/**
+ * Get the counters for the table.
+ * Return:
+ *      A pointer to the counters.
+ */
+struct routing_stats *routing_get_stats() {
+    return &routingStats;
+}
@@ -0,0 +1,103 @@
+#ifndef _routing_h
+#define _routing_h
+
+#include "daemon.h"
+#include "timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Cost of an unreachable destination. Every hop costs 1, so this is also the max path length.
+ */
+#define ROUTE_INFINITY 16
+
+/**
+ * Time in milliseconds between full routing updates on every interface.
+ */
+#define ROUTE_UPDATE_INTERVAL 1000
+
+/**
+ * Time in milliseconds a route is kept without being advertised again by its next hop.
+ */
+#define ROUTE_TIMEOUT 3500
+
+/**
+ * Time in milliseconds an unreachable route is still advertised, so its neighbours learn about it,
+ * before it is forgotten.
+ */
+#define ROUTE_GARBAGE_TIME 4000
+
+/**
+ * Time in milliseconds a triggered update is held back, so several changes go out in a single update.
+ */
+#define ROUTE_TRIGGER_DELAY 20
+
+/**
+ * Version of the routing update format.
+ */
+#define ROUTE_VERSION 1
+
+/**
+ * Flags in the header of a routing update.
+ */
+#define ROUTE_FLAG_TRIGGERED 1 // Only the routes changed since the last update.
+
+/**
+ * The start of the payload of a MIP_ROUTING frame, followed by count struct routing_entry.
+ */
+struct routing_update {
+    uint8_t version; // ROUTE_VERSION.
+    uint8_t flags; // ROUTE_FLAG_*.
+    uint16_t count; // Number of entries, in network byte order.
+} __attribute__((packed));
+
+/**
+ * A single destination in a routing update.
+ */
+struct routing_entry {
+    uint8_t destination; // MIP address.
+    uint8_t cost; // Hops from the sender. ROUTE_INFINITY if unreachable.
+} __attribute__((packed));
+
+/**
+ * Max length of the payload of a routing update.
+ */
+#define ROUTE_UPDATE_SIZE (sizeof(struct routing_update) + 256 * sizeof(struct routing_entry))
+
+/**
+ * The route to a single MIP address.
+ */
+struct route {
+    char known; // Whether the route is advertised. Unreachable routes are, until they are forgotten.
+    char local; // Whether the address is one of our own.
+    char changed; // Whether the route changed since the last triggered update.
+    uint8_t cost; // Hops to the destination. ROUTE_INFINITY if unreachable.
+    uint8_t nextHop; // The neighbour to send through. The destination itself if it is a neighbour.
+    struct eth_interface *interface; // The interface the next hop is on.
+    uint64_t updated; // When the route was last advertised by its next hop, or became unreachable, in milliseconds.
+};
+
+/**
+ * Counters for the routing table.
+ */
+struct routing_stats {
+    uint64_t updatesIn; // Routing updates received.
+    uint64_t updatesOut; // Routing updates sent, on each interface.
+    uint64_t triggered; // Triggered updates sent, on each interface.
+    uint64_t changes; // Times a route changed next hop or cost.
+    uint64_t expired; // Routes that timed out.
+};
+
+void routing_init(
+    struct timer_wheel *wheel,
+    struct eth_interface *interfaces,
+    void (*send)(struct eth_interface *interface, char *payload, size_t length)
+);
+struct route *routing_lookup(uint8_t destination);
+uint8_t routing_next_hop(uint8_t destination);
+void routing_receive(struct eth_interface *interface, uint8_t source, char *payload, size_t length, uint64_t now);
+void routing_neighbour_lost(uint8_t neighbour, uint64_t now);
+struct routing_stats *routing_get_stats();
+
+#endif
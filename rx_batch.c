@@ -0,0 +1,63 @@
+#include "rx_batch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Prepare the buffers of a batch.
+ * Input:
+ *      batch - The batch to prepare.
+ */
+void rx_batch_init(struct rx_batch *batch) {
+    memset(batch->msgs, 0, sizeof(batch->msgs));
+
+    int i;
+    for (i = 0; i < RX_BATCH_SIZE; i++) {
+        batch->iovs[i].iov_base = batch->frames[i];
+        batch->iovs[i].iov_len = RX_BATCH_FRAME_SIZE;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/**
+ * Read every frame queued on a non-blocking packet socket, a batch at a time, until it is drained.
+ * Input:
+ *      batch - The buffers to read into. Reused for each batch.
+ *      sock - The socket to read from.
+ *      handler - Function called for each frame.
+ * Return:
+ *      The number of frames read.
+ * Error:
+ *      Will end the program if the socket cannot be read.
+ */
+int rx_batch_read(struct rx_batch *batch, int sock, rx_ring_handler handler) {
+    int frames = 0;
+
+    while (1) {
+        int received = recvmmsg(sock, batch->msgs, RX_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return frames;
+            }
+            perror("rx_batch_read: recvmmsg()");
+            exit(EXIT_FAILURE);
+        }
+
+        int i;
+        for (i = 0; i < received; i++) {
+            handler(sock, batch->frames[i], batch->msgs[i].msg_len);
+        }
+        frames += received;
+
+        // A short batch means the socket was empty, and any new frame will trigger a new event.
+        if (received < RX_BATCH_SIZE) {
+            return frames;
+        }
+    }
+}
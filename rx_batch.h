@@ -0,0 +1,31 @@
+#ifndef _rx_batch_h
+#define _rx_batch_h
+
+#include "ethernet.h"
+#include "rx_ring.h"
+
+#include <sys/socket.h>
+
+/**
+ * Max number of frames read with a single recvmmsg().
+ */
+#define RX_BATCH_SIZE 32
+
+/**
+ * Max size of a single frame in the batch, including the ethernet header.
+ */
+#define RX_BATCH_FRAME_SIZE (MAX_PACKET_SIZE + sizeof(struct ethernet_frame))
+
+/**
+ * Buffers for reading a batch of frames from a packet socket with recvmmsg().
+ */
+struct rx_batch {
+    struct mmsghdr msgs[RX_BATCH_SIZE];
+    struct iovec iovs[RX_BATCH_SIZE];
+    char frames[RX_BATCH_SIZE][RX_BATCH_FRAME_SIZE];
+};
+
+void rx_batch_init(struct rx_batch *batch);
+int rx_batch_read(struct rx_batch *batch, int sock, rx_ring_handler handler);
+
+#endif
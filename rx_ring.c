@@ -0,0 +1,96 @@
+#include "rx_ring.h"
+
+#include <linux/if_packet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+/**
+ * Attach a TPACKET_V3 receive ring to a packet socket and map it.
+ * Input:
+ *      ring - The ring struct to fill in.
+ *      sock - The packet socket, not yet bound.
+ * Return:
+ *      0 if successful, -1 if the kernel does not support the ring. The socket is left usable with recv().
+ */
+int rx_ring_setup(struct rx_ring *ring, int sock) {
+    int version = TPACKET_V3;
+    if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        perror("rx_ring_setup: setsockopt(PACKET_VERSION)");
+        return -1;
+    }
+
+    struct tpacket_req3 req = {0};
+    req.tp_block_size = RX_RING_BLOCK_SIZE;
+    req.tp_block_nr = RX_RING_BLOCK_COUNT;
+    req.tp_frame_size = RX_RING_FRAME_SIZE;
+    req.tp_frame_nr = (RX_RING_BLOCK_SIZE / RX_RING_FRAME_SIZE) * RX_RING_BLOCK_COUNT;
+    req.tp_retire_blk_tov = RX_RING_BLOCK_TIMEOUT;
+
+    if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        perror("rx_ring_setup: setsockopt(PACKET_RX_RING)");
+        return -1;
+    }
+
+    ring->mapLength = (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCK_COUNT;
+    ring->map = mmap(NULL, ring->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, sock, 0);
+    if (ring->map == MAP_FAILED) {
+        // Locking the pages is only an optimization, try again without.
+        ring->map = mmap(NULL, ring->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+    }
+    if (ring->map == MAP_FAILED) {
+        perror("rx_ring_setup: mmap()");
+        ring->map = NULL;
+        return -1;
+    }
+
+    ring->sock = sock;
+    ring->current = 0;
+    return 0;
+}
+
+/**
+ * Read every frame in every block the kernel has handed over, and give the blocks back.
+ * Input:
+ *      ring - The ring to read from.
+ *      handler - Function called for each frame.
+ * Return:
+ *      The number of frames read.
+ */
+int rx_ring_read(struct rx_ring *ring, rx_ring_handler handler) {
+    int frames = 0;
+
+    while (1) {
+        struct tpacket_block_desc *block =
+            (struct tpacket_block_desc *)(ring->map + (size_t)ring->current * RX_RING_BLOCK_SIZE);
+
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            return frames;
+        }
+
+        struct tpacket3_hdr *frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+        uint32_t i;
+        for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            handler(ring->sock, (char *)frame + frame->tp_mac, frame->tp_snaplen);
+            frames++;
+            frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+        }
+
+        // Give the block back to the kernel.
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->current = (ring->current + 1) % RX_RING_BLOCK_COUNT;
+    }
+}
+
+/**
+ * Unmap a ring.
+ * Input:
+ *      ring - The ring to unmap.
+ */
+void rx_ring_close(struct rx_ring *ring) {
+    if (ring->map) {
+        munmap(ring->map, ring->mapLength);
+        ring->map = NULL;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef _rx_ring_h
+#define _rx_ring_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Size of a single block in the ring. Must be a multiple of the page size.
+ */
+#define RX_RING_BLOCK_SIZE (1 << 16)
+
+/**
+ * Number of blocks in the ring.
+ */
+#define RX_RING_BLOCK_COUNT 64
+
+/**
+ * Max size of a single frame in the ring.
+ */
+#define RX_RING_FRAME_SIZE 2048
+
+/**
+ * Time in milliseconds before the kernel hands a partially filled block over to us.
+ */
+#define RX_RING_BLOCK_TIMEOUT 1
+
+/**
+ * A TPACKET_V3 memory mapped receive ring attached to a packet socket.
+ */
+struct rx_ring {
+    int sock; // The socket the ring is attached to.
+    uint8_t *map; // The memory mapped ring.
+    size_t mapLength; // Size of the memory map.
+    unsigned int current; // The next block to read.
+};
+
+/**
+ * Function called for every frame read from a ring.
+ * Input:
+ *      sock - The socket the frame arrived on.
+ *      frame - The frame, starting at the ethernet header.
+ *      length - Length of the frame.
+ */
+typedef void (*rx_ring_handler)(int sock, char *frame, size_t length);
+
+int rx_ring_setup(struct rx_ring *ring, int sock);
+int rx_ring_read(struct rx_ring *ring, rx_ring_handler handler);
+void rx_ring_close(struct rx_ring *ring);
+
+#endif
@@ -0,0 +1,457 @@
+#include "session.h"
+#include "pending.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Store every connected session, indexed by the file descriptor of the connection.
+ */
+struct session *sessionTable[MAX_SESSIONS] = {0};
+
+/**
+ * Store the highest file descriptor in use, so iterating the table can stop early.
+ */
+int sessionMaxFd = -1;
+
+/**
+ * Store every session with shared memory rings, indexed by the eventfd the process wakes the daemon with.
+ */
+struct session *sessionByEvent[MAX_SESSIONS] = {0};
+
+/**
+ * Store the sessions with messages pushed to their ring since the last session_wake(), by file descriptor.
+ */
+int sessionWakeups[MAX_SESSIONS];
+int sessionWakeupCount = 0;
+
+/**
+ * Store the sessions that started queueing replies since the last session_next_blocked(), by file descriptor.
+ */
+int sessionBlocked[MAX_SESSIONS];
+int sessionBlockedCount = 0;
+
+/**
+ * Store the zeroes padding a reply to the fixed buffer size of the message format.
+ */
+const char sessionPadding[MAX_PACKET_SIZE] = {0};
+
+/**
+ * Create a new session for a newly accepted connection.
+ * Input:
+ *      fd - The file descriptor of the accepted connection.
+ * Return:
+ *      A pointer to the new session, or NULL if the file descriptor does not fit in the table.
+ */
+struct session *session_open(int fd) {
+    if (fd < 0 || fd >= MAX_SESSIONS) {
+        return NULL;
+    }
+
+    struct session *s = calloc(1, sizeof(struct session));
+    if (!s) {
+        perror("session_open: calloc()");
+        exit(EXIT_FAILURE);
+    }
+    s->fd = fd;
+    s->status = NOT_WAITING;
+    s->version = 1;
+
+    int bufferSize = SESSION_SEND_BUFFER;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize)) == -1) {
+        perror("session_open: setsockopt()");
+    }
+
+    sessionTable[fd] = s;
+    if (fd > sessionMaxFd) {
+        sessionMaxFd = fd;
+    }
+    return s;
+}
+
+/**
+ * Get the session belonging to a file descriptor.
+ * Input:
+ *      fd - The file descriptor to look up.
+ * Return:
+ *      A pointer to the session, or NULL if the file descriptor is not a session.
+ */
+struct session *session_get(int fd) {
+    if (fd < 0 || fd >= MAX_SESSIONS) {
+        return NULL;
+    }
+    return sessionTable[fd];
+}
+
+/**
+ * Drop the replies queued for a session, counting each as a reply that could not be sent.
+ * Input:
+ *      s - The session.
+ */
+void session_drop_queue(struct session *s) {
+    while (s->queueHead) {
+        struct session_queued *queued = s->queueHead;
+        s->queueHead = queued->next;
+        stats_drop(DROP_REPLY_FAILED);
+        free(queued);
+    }
+    s->queueTail = NULL;
+    s->queuedBytes = 0;
+}
+
+/**
+ * Close the connection of a session, drop everything it has pending and free it.
+ * Input:
+ *      s - The session to close.
+ */
+void session_close(struct session *s) {
+    pending_drop_session(s->fd);
+    session_drop_queue(s);
+
+    if (s->rings) {
+        sessionByEvent[s->rings->daemonEvent] = NULL;
+        ipc_rings_close(s->rings);
+        free(s->rings);
+    }
+
+    sessionTable[s->fd] = NULL;
+    while (sessionMaxFd >= 0 && !sessionTable[sessionMaxFd]) {
+        sessionMaxFd--;
+    }
+    close(s->fd);
+    free(s);
+}
+
+/**
+ * Give a session shared memory rings, and send them to the process: a reply with SHM_RINGS, carrying the memfd
+ * and both eventfds.
+ * Input:
+ *      s - The session. Must use the length prefixed format.
+ * Return:
+ *      The eventfd the process wakes the daemon with, to wait for, or -1 if the rings could not be set up.
+ */
+int session_open_rings(struct session *s) {
+    struct ipc_rings *rings = calloc(1, sizeof(struct ipc_rings));
+    if (!rings) {
+        perror("session_open_rings: calloc()");
+        exit(EXIT_FAILURE);
+    }
+    int memfd;
+    if (ipc_rings_create(rings, &memfd) == -1) {
+        free(rings);
+        return -1;
+    }
+    if (rings->daemonEvent >= MAX_SESSIONS) {
+        ipc_rings_close(rings);
+        close(memfd);
+        free(rings);
+        return -1;
+    }
+
+    struct ipc_header header = {0};
+    header.version = IPC_VERSION;
+    header.info = SHM_RINGS;
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    int fds[3] = {memfd, rings->daemonEvent, rings->clientEvent};
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int result = sendmsg(s->fd, &message, MSG_NOSIGNAL);
+    close(memfd); // The mapping and the copy sent along are all that is needed.
+    if (result == -1) {
+        perror("session_open_rings: sendmsg()");
+        ipc_rings_close(rings);
+        free(rings);
+        return -1;
+    }
+
+    s->rings = rings;
+    sessionByEvent[rings->daemonEvent] = s;
+    return rings->daemonEvent;
+}
+
+/**
+ * Get the session belonging to the eventfd of its rings.
+ * Input:
+ *      fd - The file descriptor to look up.
+ * Return:
+ *      A pointer to the session, or NULL if the file descriptor is not the eventfd of a session.
+ */
+struct session *session_by_event(int fd) {
+    if (fd < 0 || fd >= MAX_SESSIONS) {
+        return NULL;
+    }
+    return sessionByEvent[fd];
+}
+
+/**
+ * Wake every process with messages pushed to its ring since the last call, once each.
+ */
+void session_wake() {
+    int i;
+    for (i = 0; i < sessionWakeupCount; i++) {
+        struct session *s = session_get(sessionWakeups[i]);
+        if (s && s->wake) {
+            ipc_rings_wake(s->rings->clientEvent);
+            s->wake = 0;
+        }
+    }
+    sessionWakeupCount = 0;
+}
+
+/**
+ * Iterate over all sessions.
+ * Input:
+ *      prev - The previous session returned, or NULL to start from the beginning.
+ * Return:
+ *      The next session, or NULL when there are no more sessions.
+ */
+struct session *session_next(struct session *prev) {
+    int fd = prev ? prev->fd + 1 : 0;
+    for (; fd <= sessionMaxFd; fd++) {
+        if (sessionTable[fd]) {
+            return sessionTable[fd];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find a session listening to incoming packets as a server.
+ * Return:
+ *      The first listening session, or NULL if there are none.
+ */
+struct session *session_find_listening() {
+    struct session *s = NULL;
+    while ((s = session_next(s))) {
+        if (s->status == LISTENING) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Count a message sent to the process connected to a session.
+ * Input:
+ *      s - The session.
+ *      info - Info/error code of the message.
+ *      length - Length of the payload.
+ */
+void session_count_reply(struct session *s, enum info info, size_t length) {
+    s->counters.messagesOut++;
+    s->counters.bytesOut += length;
+    if (info == TIMED_OUT) {
+        s->counters.timeouts++;
+    }
+    if (info != NO_ERROR && info != UPGRADE && info != STATS && info != SHM_RINGS) {
+        s->counters.errors++;
+    }
+}
+
+/**
+ * Queue a reply the socket of a session has no room for, to be sent by session_flush(). The first reply queued
+ * puts the session on the list returned by session_next_blocked().
+ * Input:
+ *      s - The session.
+ *      message - The reply, as it would have been sent. Copied.
+ * Return:
+ *      0 if successful, -1 if the queue is full and the reply was dropped.
+ */
+int session_queue_reply(struct session *s, struct msghdr *message) {
+    size_t length = 0;
+    size_t i;
+    for (i = 0; i < message->msg_iovlen; i++) {
+        length += message->msg_iov[i].iov_len;
+    }
+    if (s->queuedBytes + length > SESSION_QUEUE_LIMIT) {
+        stats_drop(DROP_REPLY_FAILED);
+        return -1;
+    }
+
+    struct session_queued *queued = malloc(sizeof(struct session_queued) + length);
+    if (!queued) {
+        perror("session_queue_reply: malloc()");
+        exit(EXIT_FAILURE);
+    }
+    queued->next = NULL;
+    queued->length = 0;
+    for (i = 0; i < message->msg_iovlen; i++) {
+        memcpy(queued->data + queued->length, message->msg_iov[i].iov_base, message->msg_iov[i].iov_len);
+        queued->length += message->msg_iov[i].iov_len;
+    }
+
+    if (s->queueTail) {
+        s->queueTail->next = queued;
+    } else {
+        s->queueHead = queued;
+    }
+    s->queueTail = queued;
+    s->queuedBytes += length;
+
+    if (!s->blocked) {
+        s->blocked = 1;
+        sessionBlocked[sessionBlockedCount++] = s->fd;
+    }
+    return 0;
+}
+
+/**
+ * Send the replies queued for a session, for as long as its socket has room. Once the queue is empty, or had to
+ * be dropped, the session is no longer blocked.
+ * Input:
+ *      s - The session.
+ * Return:
+ *      1 if replies are still queued, 0 if every reply was sent, -1 if the process could not be reached and the
+ *      queued replies were dropped.
+ */
+int session_flush(struct session *s) {
+    while (s->queueHead) {
+        struct session_queued *queued = s->queueHead;
+        if (send(s->fd, queued->data, queued->length, MSG_NOSIGNAL) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            perror("session_flush: send()");
+            session_drop_queue(s);
+            s->blocked = 0;
+            return -1;
+        }
+        s->queueHead = queued->next;
+        s->queuedBytes -= queued->length;
+        free(queued);
+    }
+    s->queueTail = NULL;
+    s->blocked = 0;
+    return 0;
+}
+
+/**
+ * Get the next session that started queueing replies since the last call, so the daemon waits for room on its
+ * socket.
+ * Return:
+ *      The session, or NULL when there are no more.
+ */
+struct session *session_next_blocked() {
+    while (sessionBlockedCount > 0) {
+        struct session *s = session_get(sessionBlocked[--sessionBlockedCount]);
+        if (s && s->blocked) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Send a message back to the process connected to a session, in the format the session uses.
+ * Input:
+ *      s - The session to send to.
+ *      mip - The MIP address the message is from.
+ *      info - Info/error code for the message.
+ *      requestId - The request the message answers, or 0. Only sent in the length prefixed format.
+ *      payload - The payload to send, or NULL.
+ *      length - Length of the payload. Truncated to MAX_MESSAGE_SIZE, or to MAX_PACKET_SIZE in the legacy format.
+ * Return:
+ *      0 if sent or queued, -1 if the process could not be reached, or too many replies are queued for it.
+ */
+int session_reply(struct session *s, uint8_t mip, enum info info, uint32_t requestId, char *payload, size_t length) {
+    size_t maxLength = s->version == IPC_VERSION ? MAX_MESSAGE_SIZE : MAX_PACKET_SIZE;
+    if (!payload || length > maxLength) {
+        length = payload ? maxLength : 0;
+    }
+
+    // Through shared memory if it fits, and the process is woken once for every reply of this round.
+    if (s->rings && length <= IPC_RING_MAX_PAYLOAD) {
+        struct ipc_header header = {0};
+        header.version = IPC_VERSION;
+        header.mip = mip;
+        header.info = info;
+        header.requestId = requestId;
+        header.length = length;
+        if (ipc_rings_push(&s->rings->toClient, &header, payload) == 0) {
+            if (!s->wake) {
+                s->wake = 1;
+                sessionWakeups[sessionWakeupCount++] = s->fd;
+            }
+            session_count_reply(s, info, length);
+            return 0;
+        }
+    }
+
+    struct msghdr message = {0};
+    struct iovec iov[4];
+    message.msg_iov = iov;
+
+    if (s->version == IPC_VERSION) {
+        // Only the real size of the payload is sent.
+        struct ipc_header header = {0};
+        header.version = IPC_VERSION;
+        header.mip = mip;
+        header.info = info;
+        header.requestId = requestId;
+        header.length = length;
+
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+
+        iov[1].iov_base = payload;
+        iov[1].iov_len = length;
+
+        message.msg_iovlen = 2;
+    } else {
+        // The payload is sent from where it is, followed by shared zeroes up to the buffer size.
+        iov[0].iov_base = &mip;
+        iov[0].iov_len = sizeof(mip);
+
+        iov[1].iov_base = &info;
+        iov[1].iov_len = sizeof(info);
+
+        iov[2].iov_base = payload;
+        iov[2].iov_len = length;
+
+        iov[3].iov_base = (char *)sessionPadding;
+        iov[3].iov_len = MAX_PACKET_SIZE - length;
+
+        message.msg_iovlen = 4;
+    }
+
+    // A reply the socket has no room for waits until it has, and every later one queues behind it, in order.
+    if (s->queueHead || sendmsg(s->fd, &message, MSG_NOSIGNAL) == -1) {
+        if (s->queueHead || errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (session_queue_reply(s, &message) == -1) {
+                return -1;
+            }
+        } else {
+            perror("session_reply: sendmsg()");
+            stats_drop(DROP_REPLY_FAILED);
+            return -1;
+        }
+    }
+
+    session_count_reply(s, info, length);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef _session_h
+#define _session_h
+
+#include "daemon.h"
+#include "ethernet.h"
+#include "ipc_ring.h"
+#include "shared.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Max number of simultaneous client connections. Sessions are indexed by their file descriptor,
+ * so this is also the upper bound (exclusive) for a session file descriptor.
+ */
+#define MAX_SESSIONS 1024
+
+/**
+ * Size of the send buffer asked for on every session, so a window of replies up to MAX_MESSAGE_SIZE each fits
+ * without the non-blocking send failing. The kernel caps it at net.core.wmem_max.
+ */
+#define SESSION_SEND_BUFFER (16 * MAX_MESSAGE_SIZE)
+
+/**
+ * Max bytes of replies queued for a session while its socket has no room. Replies beyond it are dropped, so a
+ * process that stops reading cannot make the daemon grow without bound.
+ */
+#define SESSION_QUEUE_LIMIT (4 * SESSION_SEND_BUFFER)
+
+/**
+ * A reply the socket of a session had no room for, as it is to be sent.
+ */
+struct session_queued {
+    struct session_queued *next; // The next reply to send, or NULL.
+    size_t length; // Length of the message.
+    char data[]; // The message.
+};
+
+/**
+ * Counters for a single session.
+ */
+struct session_counters {
+    uint64_t messagesIn; // Messages received from the process.
+    uint64_t bytesIn; // Payload bytes in those messages.
+    uint64_t messagesOut; // Messages sent to the process, including errors.
+    uint64_t bytesOut; // Payload bytes in those messages.
+    uint64_t errors; // Replies with an error.
+    uint64_t timeouts; // Replies with TIMED_OUT.
+};
+
+/**
+ * A single ping server/client connected to the daemon over the UNIX socket.
+ */
+struct session {
+    int fd; // The file descriptor for the connection.
+    enum packet_waiting_status status; // LISTENING if the session serves incoming packets, NOT_WAITING otherwise.
+    uint8_t version; // Message format: 1 for the legacy format, IPC_VERSION after an upgrade.
+    struct ipc_rings *rings; // Shared memory rings, or NULL if every message goes through the socket.
+    char wake; // Whether messages were pushed to toClient since the process was last woken.
+    struct session_queued *queueHead, *queueTail; // Replies waiting for room on the socket, oldest first.
+    size_t queuedBytes; // Bytes in those replies.
+    char blocked; // Whether the daemon waits for room on the socket to send the queued replies.
+    struct session_counters counters;
+};
+
+struct session *session_open(int fd);
+struct session *session_get(int fd);
+void session_close(struct session *s);
+
+int session_open_rings(struct session *s);
+struct session *session_by_event(int fd);
+void session_wake();
+
+struct session *session_find_listening();
+struct session *session_next(struct session *prev);
+
+int session_reply(struct session *s, uint8_t mip, enum info info, uint32_t requestId, char *payload, size_t length);
+int session_flush(struct session *s);
+struct session *session_next_blocked();
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _shared_h
 #define _shared_h
 
+#include <stdint.h>
+
 // Types of info/error/actions we can send in the UNIX socket.
 enum info {
     NO_ERROR            = 0, // No error, no action, nothing special about this request.
@@ -8,7 +10,38 @@ enum info {
     TIMED_OUT           = 2, // Error: The quest timed out.
     LISTEN              = 3, // Action: Listen to any incoming packets and send them to me.
     RESET               = 4, // Action: Reset, stop listening.
-    NO_RESPONSE         = 5 // Do not expect a response after sending this payload.
+    NO_RESPONSE         = 5, // Do not expect a response after sending this payload.
+    QUEUE_FULL          = 6, // Error: Too many requests are already pending for the destination.
+    HOST_UNREACHABLE    = 7, // Error: The destination did not answer ARP recently.
+    UPGRADE             = 8, // Action: Use struct ipc_header for every later message, in both directions.
+    STATS               = 9, // Action: Reply with STATS and a snapshot of the daemon statistics, see stats.h.
+    SHM_RINGS           = 10 // Action: Reply with SHM_RINGS and shared memory rings for later messages, see ipc_ring.h.
+};
+
+/**
+ * Version of the length prefixed message format.
+ */
+#define IPC_VERSION 2
+
+/**
+ * Max size of the payload of a message in the length prefixed format. The daemon splits payloads larger than
+ * MAX_PAYLOAD_SIZE into several frames, and delivers them whole at the other end.
+ */
+#define MAX_MESSAGE_SIZE 65536
+
+/**
+ * Header of a message in the length prefixed format. Followed by exactly length bytes of payload.
+ * A session starts out in the legacy format: MIP address, enum info and a MAX_PACKET_SIZE buffer holding a
+ * string. Sending UPGRADE in the legacy format switches it over; the daemon confirms with UPGRADE in the
+ * legacy format, and uses the new format from then on.
+ */
+struct ipc_header {
+    uint8_t version; // IPC_VERSION.
+    uint8_t mip; // The MIP address the message is to or from.
+    uint16_t flags; // Reserved, must be 0.
+    uint32_t info; // enum info.
+    uint32_t requestId; // Chosen by the client, and returned in every reply to the request. 0 otherwise.
+    uint32_t length; // Length of the payload, in bytes.
 };
 
 #endif
\ No newline at end of file
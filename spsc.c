@@ -0,0 +1,155 @@
+#include "spsc.h"
+
+#include <stdlib.h>
+
+/**
+ * Prepare an empty ring.
+ * Input:
+ *      ring - The ring to prepare.
+ *      size - Number of slots. Rounded up to a power of two.
+ *      itemSize - Size of each slot, in bytes.
+ * Return:
+ *      0 if successful, -1 if the memory could not be allocated.
+ */
+int spsc_init(struct spsc_ring *ring, size_t size, size_t itemSize) {
+    size_t slots = 1;
+    while (slots < size) {
+        slots <<= 1;
+    }
+
+    ring->head = 0;
+    ring->cachedTail = 0;
+    ring->tail = 0;
+    ring->cachedHead = 0;
+    ring->size = slots;
+    ring->itemSize = itemSize;
+    ring->items = aligned_alloc(SPSC_CACHE_LINE, ((slots * itemSize + SPSC_CACHE_LINE - 1) / SPSC_CACHE_LINE) * SPSC_CACHE_LINE);
+    return ring->items ? 0 : -1;
+}
+
+/**
+ * Free the slots of a ring.
+ * Input:
+ *      ring - The ring.
+ */
+void spsc_free(struct spsc_ring *ring) {
+    free(ring->items);
+    ring->items = NULL;
+}
+
+/**
+ * Get the memory needed for a ring with its slots following it, as set up by spsc_init_shared().
+ * Input:
+ *      size - Number of slots. Must be a power of two.
+ *      itemSize - Size of each slot, in bytes.
+ * Return:
+ *      The size in bytes, a multiple of the cache line.
+ */
+size_t spsc_shared_size(size_t size, size_t itemSize) {
+    return sizeof(struct spsc_ring) + ((size * itemSize + SPSC_CACHE_LINE - 1) / SPSC_CACHE_LINE) * SPSC_CACHE_LINE;
+}
+
+/**
+ * Prepare an empty ring, with its slots right after it in memory. Since the ring holds no pointers, it can be
+ * placed in memory shared between processes, each mapping it at its own address. The other process can write
+ * anything to it, so each side keeps its own copy of where the slots are and how large they are, and uses the
+ * ring through spsc_reserve_slots() and spsc_peek_slots(). size and itemSize are only set for reference.
+ * Input:
+ *      ring - The ring to prepare, followed by spsc_shared_size() - sizeof(struct spsc_ring) bytes.
+ *      size - Number of slots. Must be a power of two.
+ *      itemSize - Size of each slot, in bytes.
+ */
+void spsc_init_shared(struct spsc_ring *ring, size_t size, size_t itemSize) {
+    ring->head = 0;
+    ring->cachedTail = 0;
+    ring->tail = 0;
+    ring->cachedHead = 0;
+    ring->size = size;
+    ring->itemSize = itemSize;
+    ring->items = NULL;
+}
+
+/**
+ * Producer: Get the next free slot to write an item in. The item is published by spsc_push().
+ * Input:
+ *      ring - The ring.
+ * Return:
+ *      A pointer to the slot, or NULL if the ring is full.
+ */
+void *spsc_reserve(struct spsc_ring *ring) {
+    return spsc_reserve_slots(ring, ring->items, ring->size, ring->itemSize);
+}
+
+/**
+ * Producer: Get the next free slot of a ring, with slots given by the caller instead of read from the ring.
+ * Only the indexes are read from the ring, and they are masked, so the slot is always one of the given ones.
+ * Input:
+ *      ring - The ring.
+ *      items - The slots.
+ *      size - Number of slots, a power of two.
+ *      itemSize - Size of each slot, in bytes.
+ * Return:
+ *      A pointer to the slot, or NULL if the ring is full.
+ */
+void *spsc_reserve_slots(struct spsc_ring *ring, char *items, size_t size, size_t itemSize) {
+    size_t tail = ring->tail;
+    if (tail - ring->cachedHead >= size) {
+        ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->cachedHead >= size) {
+            return NULL;
+        }
+    }
+    return items + (tail & (size - 1)) * itemSize;
+}
+
+/**
+ * Producer: Publish the item written in the slot from the last spsc_reserve().
+ * Input:
+ *      ring - The ring.
+ */
+void spsc_push(struct spsc_ring *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Consumer: Get the oldest item in the ring.
+ * Input:
+ *      ring - The ring.
+ * Return:
+ *      A pointer to the item, valid until it is popped, or NULL if the ring is empty.
+ */
+void *spsc_peek(struct spsc_ring *ring) {
+    return spsc_peek_slots(ring, ring->items, ring->size, ring->itemSize);
+}
+
+/**
+ * Consumer: Get the oldest item in a ring, with slots given by the caller instead of read from the ring.
+ * Only the indexes are read from the ring, and they are masked, so the item is always one of the given slots.
+ * Input:
+ *      ring - The ring.
+ *      items - The slots.
+ *      size - Number of slots, a power of two.
+ *      itemSize - Size of each slot, in bytes.
+ * Return:
+ *      A pointer to the item, valid until it is popped, or NULL if the ring is empty, or holds more items than
+ *      it has slots, which only a broken producer can cause.
+ */
+void *spsc_peek_slots(struct spsc_ring *ring, char *items, size_t size, size_t itemSize) {
+    size_t head = ring->head;
+    if (head == ring->cachedTail || ring->cachedTail - head > size) {
+        ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->cachedTail || ring->cachedTail - head > size) {
+            return NULL;
+        }
+    }
+    return items + (head & (size - 1)) * itemSize;
+}
+
+/**
+ * Consumer: Remove the oldest item in the ring, giving its slot back to the producer.
+ * Input:
+ *      ring - The ring.
+ */
+void spsc_pop(struct spsc_ring *ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,44 @@
+#ifndef _spsc_h
+#define _spsc_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Assumed size of a cache line, used to keep the producer and consumer indexes apart.
+ */
+#define SPSC_CACHE_LINE 64
+
+/**
+ * A lock-free single producer, single consumer ring queue of fixed size items.
+ * Exactly one thread may push, and exactly one other thread may pop.
+ */
+struct spsc_ring {
+    // Written by the consumer only.
+    size_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+    size_t cachedTail; // The consumer's last view of tail.
+
+    // Written by the producer only.
+    size_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+    size_t cachedHead; // The producer's last view of head.
+
+    // Read only after setup.
+    size_t size __attribute__((aligned(SPSC_CACHE_LINE))); // Number of slots, a power of two.
+    size_t itemSize; // Size of each slot, in bytes.
+    char *items; // The slots, or NULL for rings shared between processes, see spsc_reserve_slots().
+};
+
+int spsc_init(struct spsc_ring *ring, size_t size, size_t itemSize);
+void spsc_free(struct spsc_ring *ring);
+size_t spsc_shared_size(size_t size, size_t itemSize);
+void spsc_init_shared(struct spsc_ring *ring, size_t size, size_t itemSize);
+
+void *spsc_reserve(struct spsc_ring *ring);
+void *spsc_reserve_slots(struct spsc_ring *ring, char *items, size_t size, size_t itemSize);
+void spsc_push(struct spsc_ring *ring);
+
+void *spsc_peek(struct spsc_ring *ring);
+void *spsc_peek_slots(struct spsc_ring *ring, char *items, size_t size, size_t itemSize);
+void spsc_pop(struct spsc_ring *ring);
+
+#endif
@@ -0,0 +1,190 @@
+#include "stats.h"
+#include "daemon.h"
+#include "fragment.h"
+#include "histogram.h"
+#include "neigh.h"
+#include "session.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Store the daemon wide counters. The parts kept by other modules are filled in when a snapshot is taken.
+ */
+struct stats_global statsGlobal = {0};
+
+/**
+ * Store the latency histograms, in nanoseconds.
+ */
+struct histogram *statsArpResolution;
+struct histogram *statsRoundTrip;
+
+/**
+ * Store when the daemon started, in milliseconds.
+ */
+uint64_t statsStarted;
+
+/**
+ * Set up the counters and histograms.
+ * Error:
+ *      Will end the program if the memory cannot be allocated.
+ */
+void stats_init() {
+    statsArpResolution = malloc(sizeof(struct histogram));
+    statsRoundTrip = malloc(sizeof(struct histogram));
+    if (!statsArpResolution || !statsRoundTrip) {
+        perror("stats_init: malloc()");
+        exit(EXIT_FAILURE);
+    }
+    histogram_init(statsArpResolution);
+    histogram_init(statsRoundTrip);
+    statsStarted = timer_now();
+}
+
+/**
+ * Count a dropped frame or message.
+ * Input:
+ *      reason - Why it was dropped.
+ */
+void stats_drop(enum stats_drop reason) {
+    statsGlobal.drops[reason]++;
+    TRACE(TRACE_DROP, 0, 0, 0, reason, 0);
+}
+
+/**
+ * Count a request that timed out.
+ * Input:
+ *      arp - 1 if it timed out waiting for ARP, 0 if waiting for a response.
+ */
+void stats_timeout(char arp) {
+    if (arp) {
+        statsGlobal.arpTimeouts++;
+    } else {
+        statsGlobal.dataTimeouts++;
+    }
+}
+
+/**
+ * Record the time an ARP lookup took.
+ * Input:
+ *      nanoseconds - Time from the request to the response.
+ */
+void stats_arp_resolved(uint64_t nanoseconds) {
+    histogram_record(statsArpResolution, nanoseconds);
+}
+
+/**
+ * Record the round trip time of a request.
+ * Input:
+ *      nanoseconds - Time from sending the request to delivering the response.
+ */
+void stats_round_trip(uint64_t nanoseconds) {
+    histogram_record(statsRoundTrip, nanoseconds);
+}
+
+/**
+ * Count a frame forwarded for another node.
+ */
+void stats_forwarded() {
+    statsGlobal.forwarded++;
+}
+
+/**
+ * Summarize a histogram for a snapshot.
+ * Input:
+ *      h - The histogram.
+ *      latency - Where to store the summary.
+ */
+void stats_summarize(struct histogram *h, struct stats_latency *latency) {
+    latency->count = h->count;
+    latency->min = h->count ? h->min : 0;
+    latency->mean = histogram_mean(h);
+    latency->p50 = histogram_percentile(h, 50);
+    latency->p90 = histogram_percentile(h, 90);
+    latency->p99 = histogram_percentile(h, 99);
+    latency->p999 = histogram_percentile(h, 99.9);
+    latency->max = h->max;
+}
+
+/**
+ * Write a snapshot of every counter: a struct stats_global, then a struct stats_interface per interface and a
+ * struct stats_session per session. Sessions that do not fit are left out.
+ * Input:
+ *      interfaces - The list of interfaces.
+ *      buffer - Where to write the snapshot.
+ *      size - Size of the buffer. Must fit the global counters and every interface.
+ * Return:
+ *      The length of the snapshot, in bytes.
+ */
+size_t stats_snapshot(struct eth_interface *interfaces, char *buffer, size_t size) {
+    struct stats_global global = statsGlobal;
+    global.version = STATS_VERSION;
+    global.uptime = timer_now() - statsStarted;
+
+    struct neigh_stats *neigh = neigh_get_stats();
+    global.neighHits = neigh->hits;
+    global.neighMisses = neigh->misses;
+    global.neighProbes = neigh->probes;
+    global.drops[DROP_UNREACHABLE] += neigh->suppressed;
+
+    struct fragment_stats *fragment = fragment_get_stats();
+    global.fragmentsSplit = fragment->split;
+    global.fragmentsReassembled = fragment->reassembled;
+    global.fragmentsTimedOut = fragment->timeouts;
+    global.fragmentsEvicted = fragment->evicted;
+    global.drops[DROP_BAD_FRAGMENT] += fragment->invalid;
+
+    stats_summarize(statsArpResolution, &global.arpResolution);
+    stats_summarize(statsRoundTrip, &global.roundTrip);
+
+    size_t length = sizeof(global);
+
+    struct eth_interface *tmp_interface;
+    for (tmp_interface = interfaces; tmp_interface; tmp_interface = tmp_interface->next) {
+        struct stats_interface entry = {0};
+        strncpy(entry.name, tmp_interface->name, STATS_NAME_SIZE - 1);
+        entry.mip = tmp_interface->mip_addr;
+        memcpy(entry.mac, tmp_interface->mac, 6);
+        entry.rxFrames = tmp_interface->counters.rxFrames;
+        entry.rxBytes = tmp_interface->counters.rxBytes;
+        entry.txFrames = tmp_interface->txq->sentFrames;
+        entry.txBytes = tmp_interface->txq->sentBytes;
+        entry.arpRequestsIn = tmp_interface->counters.arpRequestsIn;
+        entry.arpRepliesIn = tmp_interface->counters.arpRepliesIn;
+        entry.arpRequestsOut = tmp_interface->counters.arpRequestsOut;
+        entry.arpRepliesOut = tmp_interface->counters.arpRepliesOut;
+
+        memcpy(buffer + length, &entry, sizeof(entry));
+        length += sizeof(entry);
+        global.interfaceCount++;
+    }
+
+    struct session *s = NULL;
+    while ((s = session_next(s))) {
+        global.sessionTotal++;
+        if (length + sizeof(struct stats_session) > size) {
+            continue;
+        }
+
+        struct stats_session entry = {0};
+        entry.fd = s->fd;
+        entry.status = s->status;
+        entry.version = s->version;
+        entry.messagesIn = s->counters.messagesIn;
+        entry.bytesIn = s->counters.bytesIn;
+        entry.messagesOut = s->counters.messagesOut;
+        entry.bytesOut = s->counters.bytesOut;
+        entry.errors = s->counters.errors;
+        entry.timeouts = s->counters.timeouts;
+
+        memcpy(buffer + length, &entry, sizeof(entry));
+        length += sizeof(entry);
+        global.sessionCount++;
+    }
+
+    memcpy(buffer, &global, sizeof(global));
+    return length;
+}
@@ -0,0 +1,120 @@
+#ifndef _stats_h
+#define _stats_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Version of the statistics snapshot format.
+ */
+#define STATS_VERSION 2
+
+/**
+ * Max length of an interface name in a snapshot, including the terminating zero.
+ */
+#define STATS_NAME_SIZE 16
+
+/**
+ * Why the daemon dropped a frame or a message.
+ */
+enum stats_drop {
+    DROP_SHORT          = 0, // Frame too short to be a MIP frame.
+    DROP_NOT_MIP        = 1, // Frame of another ethertype.
+    DROP_TRUNCATED      = 2, // Frame shorter than its MIP header says.
+    DROP_NOT_FOR_US     = 3, // Data frame addressed to another MIP address.
+    DROP_NO_SESSION     = 4, // Data frame with no session waiting for it, and no server.
+    DROP_NO_EGRESS      = 5, // Payload to a destination without a usable interface.
+    DROP_QUEUE_FULL     = 6, // Request refused, too many pending for the destination.
+    DROP_UNREACHABLE    = 7, // Request refused, the destination did not answer ARP recently.
+    DROP_TOO_LONG       = 8, // Request refused, the payload is larger than MAX_MESSAGE_SIZE.
+    DROP_BAD_FRAGMENT   = 9, // Fragment not matching its message.
+    DROP_UNKNOWN_TYPE   = 10, // Frame of a MIP type the daemon does not handle.
+    DROP_REPLY_FAILED   = 11, // Reply that could not be sent to its session, nor queued for it.
+    DROP_NO_ROUTE       = 12, // Frame to forward to a destination without a route.
+    DROP_TTL_EXPIRED    = 13, // Frame to forward with no time to live left.
+    STATS_DROP_COUNT    = 14
+};
+
+/**
+ * A latency distribution, summarized from a histogram. Every time is in nanoseconds.
+ */
+struct stats_latency {
+    uint64_t count;
+    uint64_t min;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} __attribute__((packed));
+
+/**
+ * Counters for the daemon as a whole. The first part of a snapshot.
+ */
+struct stats_global {
+    uint32_t version; // STATS_VERSION.
+    uint32_t interfaceCount; // Number of struct stats_interface following.
+    uint32_t sessionCount; // Number of struct stats_session following those.
+    uint32_t sessionTotal; // Number of sessions. More than sessionCount if they did not all fit.
+    uint64_t uptime; // Time since the daemon started, in milliseconds.
+    uint64_t neighHits; // Neighbour lookups that found a usable MAC address.
+    uint64_t neighMisses; // Neighbour lookups that needed ARP.
+    uint64_t neighProbes; // ARP requests sent to confirm stale neighbours.
+    uint64_t arpTimeouts; // Payloads that timed out waiting for ARP.
+    uint64_t dataTimeouts; // Requests that timed out waiting for a response.
+    uint64_t fragmentsSplit; // Messages split into fragments.
+    uint64_t fragmentsReassembled; // Messages reassembled from fragments.
+    uint64_t fragmentsTimedOut; // Messages dropped because a fragment did not arrive in time.
+    uint64_t fragmentsEvicted; // Messages dropped to make room for newer ones.
+    uint64_t forwarded; // Frames forwarded for other nodes.
+    uint64_t drops[STATS_DROP_COUNT]; // By enum stats_drop.
+    struct stats_latency arpResolution; // From the ARP request to the response.
+    struct stats_latency roundTrip; // From sending a request to delivering the response to the session.
+} __attribute__((packed));
+
+/**
+ * Counters for a single interface.
+ */
+struct stats_interface {
+    char name[STATS_NAME_SIZE];
+    uint8_t mip;
+    uint8_t mac[6];
+    uint8_t reserved;
+    uint64_t rxFrames;
+    uint64_t rxBytes;
+    uint64_t txFrames;
+    uint64_t txBytes;
+    uint64_t arpRequestsIn;
+    uint64_t arpRepliesIn;
+    uint64_t arpRequestsOut;
+    uint64_t arpRepliesOut;
+} __attribute__((packed));
+
+/**
+ * Counters for a single session.
+ */
+struct stats_session {
+    int32_t fd;
+    uint8_t status; // enum packet_waiting_status.
+    uint8_t version; // Message format of the session.
+    uint16_t reserved;
+    uint64_t messagesIn; // Messages received from the process.
+    uint64_t bytesIn;
+    uint64_t messagesOut; // Messages sent to the process, including errors.
+    uint64_t bytesOut;
+    uint64_t errors; // Replies with an error.
+    uint64_t timeouts; // Replies with TIMED_OUT.
+} __attribute__((packed));
+
+struct eth_interface;
+
+void stats_init();
+void stats_drop(enum stats_drop reason);
+void stats_timeout(char arp);
+void stats_arp_resolved(uint64_t nanoseconds);
+void stats_round_trip(uint64_t nanoseconds);
+void stats_forwarded();
+size_t stats_snapshot(struct eth_interface *interfaces, char *buffer, size_t size);
+
+#endif
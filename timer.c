@@ -0,0 +1,245 @@
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Get the current time of the monotonic clock.
+ * Return:
+ *      The time in milliseconds.
+ */
+uint64_t timer_now() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        perror("timer_now: clock_gettime()");
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Get the current time of the monotonic clock, with the precision needed to measure latencies.
+ * Return:
+ *      The time in nanoseconds.
+ */
+uint64_t timer_now_ns() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        perror("timer_now_ns: clock_gettime()");
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Prepare an empty timer wheel.
+ * Input:
+ *      wheel - The wheel to prepare.
+ *      now - The current time, in milliseconds.
+ */
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now) {
+    int level, slot;
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+    }
+    wheel->current = now;
+    wheel->count = 0;
+}
+
+/**
+ * Prepare an inactive timer.
+ * Input:
+ *      timer - The timer to prepare.
+ *      callback - Function called when the timer expires.
+ *      data - Owner of the timer, for the callback.
+ */
+void timer_init(struct timer *timer, void (*callback)(struct timer *timer), void *data) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->active = 0;
+}
+
+/**
+ * Place a timer in the slot matching its expiry time.
+ * Input:
+ *      wheel - The wheel.
+ *      timer - The timer, not in any slot.
+ */
+void timer_place(struct timer_wheel *wheel, struct timer *timer) {
+    uint64_t expires = timer->expires;
+    if (expires < wheel->current) {
+        expires = wheel->current;
+    }
+    uint64_t delta = expires - wheel->current;
+    if (delta > TIMER_MAX_DELAY) {
+        delta = TIMER_MAX_DELAY;
+        expires = wheel->current + delta;
+    }
+
+    // The level is the first one where the delta fits, the slot is given by the expiry time itself.
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+    struct timer *head = &wheel->slots[level][(expires >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)];
+
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/**
+ * Start a timer, or move it if it is already active.
+ * Input:
+ *      wheel - The wheel.
+ *      timer - The timer.
+ *      expires - Expiry time, in milliseconds.
+ */
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires) {
+    timer_cancel(wheel, timer);
+    timer->expires = expires;
+    timer->active = 1;
+    timer_place(wheel, timer);
+    wheel->count++;
+}
+
+/**
+ * Stop a timer. Does nothing if it is not active.
+ * Input:
+ *      wheel - The wheel.
+ *      timer - The timer.
+ */
+void timer_cancel(struct timer_wheel *wheel, struct timer *timer) {
+    if (!timer->active) {
+        return;
+    }
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->active = 0;
+    wheel->count--;
+}
+
+/**
+ * Move every timer in a slot of a higher level down to where it belongs now.
+ * Input:
+ *      wheel - The wheel.
+ *      level - The level of the slot.
+ *      slot - The slot.
+ * Return:
+ *      The slot index, so the caller knows whether the next level must cascade too.
+ */
+int timer_cascade(struct timer_wheel *wheel, int level, int slot) {
+    struct timer *head = &wheel->slots[level][slot];
+    struct timer *timer = head->next;
+    head->next = head;
+    head->prev = head;
+
+    while (timer != head) {
+        struct timer *next = timer->next;
+        timer_place(wheel, timer);
+        timer = next;
+    }
+    return slot;
+}
+
+/**
+ * Process every tick up to and including a point in time, running the callback of every expired timer.
+ * Input:
+ *      wheel - The wheel.
+ *      now - The current time, in milliseconds.
+ * Return:
+ *      The number of timers that expired.
+ */
+int timer_advance(struct timer_wheel *wheel, uint64_t now) {
+    int expired = 0;
+
+    if (!wheel->count && now >= wheel->current) { // Nothing to run, skip straight ahead.
+        wheel->current = now + 1;
+        return 0;
+    }
+
+    while (wheel->current <= now) {
+        int slot = wheel->current & (TIMER_SLOTS - 1);
+
+        // At the start of each lap, pull the timers of the next higher level slot down.
+        int level = 1;
+        int index = slot;
+        while (index == 0 && level < TIMER_LEVELS) {
+            index = timer_cascade(
+                wheel,
+                level,
+                (wheel->current >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)
+            );
+            level++;
+        }
+
+        // Detach the slot before running it, so callbacks can add timers for the current time.
+        struct timer *head = &wheel->slots[0][slot];
+        struct timer *timer = head->next;
+        head->prev->next = NULL;
+        head->next = head;
+        head->prev = head;
+        wheel->current++;
+
+        while (timer && timer != head) {
+            struct timer *next = timer->next;
+            timer->next = NULL;
+            timer->prev = NULL;
+            timer->active = 0;
+            wheel->count--;
+            timer->callback(timer);
+            expired++;
+            timer = next;
+        }
+    }
+    return expired;
+}
+
+/**
+ * Get the earliest time the wheel must be advanced. Can be earlier than the actual first expiry, when
+ * timers in a higher level must be moved down first.
+ * Input:
+ *      wheel - The wheel.
+ * Return:
+ *      The time in milliseconds, or 0 if there are no active timers.
+ */
+uint64_t timer_next_expiry(struct timer_wheel *wheel) {
+    if (!wheel->count) {
+        return 0;
+    }
+
+    uint64_t next = 0;
+    int i;
+    for (i = 0; i < TIMER_SLOTS; i++) {
+        struct timer *head = &wheel->slots[0][(wheel->current + i) & (TIMER_SLOTS - 1)];
+        if (head->next != head) {
+            next = wheel->current + i;
+            break;
+        }
+    }
+
+    // Timers in higher levels are cascaded at the start of the next lap of the lowest level.
+    uint64_t lap = (wheel->current | (TIMER_SLOTS - 1)) + 1;
+    if (next && next <= lap) {
+        return next;
+    }
+    int level, slot;
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            if (wheel->slots[level][slot].next != &wheel->slots[level][slot]) {
+                return lap;
+            }
+        }
+    }
+    return next;
+}
@@ -0,0 +1,58 @@
+#ifndef _timer_h
+#define _timer_h
+
+#include <stdint.h>
+
+/**
+ * Number of levels in the timer wheel.
+ */
+#define TIMER_LEVELS 4
+
+/**
+ * Number of bits of the expiry time each level covers.
+ */
+#define TIMER_SLOT_BITS 6
+
+/**
+ * Number of slots in each level of the timer wheel.
+ */
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+/**
+ * Max time, in milliseconds, a timer can be set into the future. Later timers fire at this point.
+ */
+#define TIMER_MAX_DELAY ((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+/**
+ * A single timer. Embedded in whatever needs a timeout, and must not move while it is active.
+ */
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expires; // Expiry time, in milliseconds.
+    void (*callback)(struct timer *timer); // Function called when the timer expires.
+    void *data; // Owner of the timer, for the callback.
+    char active; // Whether the timer is in the wheel.
+};
+
+/**
+ * A hierarchical timer wheel with millisecond ticks.
+ * Adding, cancelling and expiring a timer are all O(1).
+ */
+struct timer_wheel {
+    uint64_t current; // The next tick to process. Every earlier tick has been processed.
+    int count; // Number of active timers.
+    struct timer slots[TIMER_LEVELS][TIMER_SLOTS]; // Heads of the lists of timers in each slot.
+};
+
+uint64_t timer_now();
+uint64_t timer_now_ns();
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now);
+void timer_init(struct timer *timer, void (*callback)(struct timer *timer), void *data);
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires);
+void timer_cancel(struct timer_wheel *wheel, struct timer *timer);
+int timer_advance(struct timer_wheel *wheel, uint64_t now);
+uint64_t timer_next_expiry(struct timer_wheel *wheel);
+
+#endif
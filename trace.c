@@ -0,0 +1,117 @@
+#include "trace.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+char traceEnabled = 0;
+
+/**
+ * Store the trace ring, or NULL if events are not recorded.
+ */
+struct trace_header *traceRing = NULL;
+struct trace_event *traceEvents;
+
+/**
+ * Store whether every event is also printed, for debug mode.
+ */
+char tracePrint = 0;
+
+/**
+ * Create a trace ring in shared memory, and start recording events in it. The ring can be read through
+ * /proc/<pid>/fd/<fd> while the daemon runs, or copied from there and read later.
+ * Input:
+ *      eventCount - Number of events in the ring. Rounded up to a power of two.
+ * Return:
+ *      The file descriptor of the ring, or -1 if it could not be created.
+ */
+int trace_open(uint32_t eventCount) {
+    uint32_t count = 1;
+    while (count < eventCount && count < (1U << 31)) {
+        count <<= 1;
+    }
+
+    int fd = memfd_create("mip_trace", 0);
+    if (fd == -1) {
+        perror("trace_open: memfd_create()");
+        return -1;
+    }
+    size_t size = sizeof(struct trace_header) + (size_t)count * sizeof(struct trace_event);
+    if (ftruncate(fd, size) == -1) {
+        perror("trace_open: ftruncate()");
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("trace_open: mmap()");
+        close(fd);
+        return -1;
+    }
+
+    traceRing = map;
+    traceRing->magic = TRACE_MAGIC;
+    traceRing->version = TRACE_VERSION;
+    traceRing->eventCount = count;
+    traceRing->head = 0;
+    traceEvents = (struct trace_event *)(traceRing + 1);
+    traceEnabled = 1;
+    return fd;
+}
+
+/**
+ * Print every event as it is recorded, whether or not there is a ring.
+ */
+void trace_enable_print() {
+    tracePrint = 1;
+    traceEnabled = 1;
+}
+
+/**
+ * Record an event. Use TRACE() instead, which does nothing when tracing is off.
+ * Slots are claimed with an atomic add, so recording never takes a lock. The sequence number of a slot is
+ * cleared while it is written, and set last, so a reader can tell a complete event from one being overwritten.
+ * Input:
+ *      type - What happened, see enum trace_type.
+ *      source - Source MIP address, or 0.
+ *      destination - Destination MIP address, or 0.
+ *      object - The session or interface socket, or 0.
+ *      arg - Depends on the type.
+ *      length - Length of the frame or payload, or 0.
+ */
+void trace_record(uint16_t type, uint8_t source, uint8_t destination, uint32_t object, uint32_t arg, uint32_t length) {
+    struct trace_event event;
+    event.time = timer_now_ns();
+    event.type = type;
+    event.source = source;
+    event.destination = destination;
+    event.object = object;
+    event.arg = arg;
+    event.length = length;
+
+    if (traceRing) {
+        uint64_t sequence = __atomic_fetch_add(&traceRing->head, 1, __ATOMIC_RELAXED);
+        struct trace_event *slot = &traceEvents[sequence & (traceRing->eventCount - 1)];
+
+        __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->time = event.time;
+        slot->type = event.type;
+        slot->source = event.source;
+        slot->destination = event.destination;
+        slot->object = event.object;
+        slot->arg = event.arg;
+        slot->length = event.length;
+        __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELEASE);
+        event.sequence = sequence + 1;
+    }
+
+    if (tracePrint) {
+        char line[128];
+        trace_format(&event, line, sizeof(line));
+        puts(line);
+    }
+}
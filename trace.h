@@ -0,0 +1,87 @@
+#ifndef _trace_h
+#define _trace_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Magic number at the start of a trace ring, "MIPTRACE".
+ */
+#define TRACE_MAGIC 0x4543415254504D49ULL
+
+/**
+ * Version of the trace ring format.
+ */
+#define TRACE_VERSION 1
+
+/**
+ * Default number of events in a trace ring.
+ */
+#define TRACE_DEFAULT_EVENTS (1 << 16)
+
+/**
+ * What happened, for a trace event.
+ */
+enum trace_type {
+    TRACE_FRAME_RX      = 1, // A MIP frame was received. arg is the MIP type.
+    TRACE_FRAME_TX      = 2, // A MIP frame was queued for sending. arg is the MIP type.
+    TRACE_ARP_START     = 3, // ARP requests were broadcast for destination.
+    TRACE_ARP_RESOLVED  = 4, // source answered ARP on the interface with socket object.
+    TRACE_ARP_TIMEOUT   = 5, // A payload from session object to destination timed out waiting for ARP.
+    TRACE_DATA_TIMEOUT  = 6, // Session object timed out waiting for a response from destination.
+    TRACE_SESSION_OPEN  = 7, // Session object connected.
+    TRACE_SESSION_CLOSE = 8, // Session object disconnected.
+    TRACE_SESSION_MSG   = 9, // Session object sent a message to destination. arg is the enum info.
+    TRACE_DELIVER       = 10, // A payload from source was passed to session object. arg is the request ID.
+    TRACE_DROP          = 11, // Something was dropped. arg is the enum stats_drop.
+    TRACE_ROUTE         = 12, // The route to destination changed to go through source. arg is the cost.
+    TRACE_FORWARD       = 13 // A frame from source to destination was forwarded on socket object. arg is the new TTL.
+};
+
+/**
+ * A single trace event. Fixed size, so the ring is an array.
+ */
+struct trace_event {
+    uint64_t sequence; // Position of the event in the trace, plus 1. 0 while the event is written.
+    uint64_t time; // When it happened, in nanoseconds of the monotonic clock.
+    uint16_t type; // enum trace_type.
+    uint8_t source; // MIP address, if any.
+    uint8_t destination; // MIP address, if any.
+    uint32_t object; // The session or interface socket, if any.
+    uint32_t arg; // Depends on the type.
+    uint32_t length; // Length of the frame or payload, if any.
+};
+
+/**
+ * Start of a trace ring, followed by eventCount events.
+ */
+struct trace_header {
+    uint64_t magic; // TRACE_MAGIC.
+    uint32_t version; // TRACE_VERSION.
+    uint32_t eventCount; // Number of events in the ring. A power of two.
+    uint64_t head; // Number of events ever recorded. The next one goes in slot head % eventCount.
+    uint8_t reserved[40]; // Pads the header to a cache line.
+};
+
+/**
+ * Whether trace events are recorded or printed. Checked before anything else is evaluated.
+ */
+extern char traceEnabled;
+
+/**
+ * Record a trace event, if tracing is on. The arguments are not evaluated otherwise.
+ */
+#define TRACE(type, source, destination, object, arg, length) \
+    do { \
+        if (__builtin_expect(traceEnabled, 0)) { \
+            trace_record((type), (source), (destination), (object), (arg), (length)); \
+        } \
+    } while (0)
+
+int trace_open(uint32_t eventCount);
+void trace_enable_print();
+void trace_record(uint16_t type, uint8_t source, uint8_t destination, uint32_t object, uint32_t arg, uint32_t length);
+
+size_t trace_format(const struct trace_event *event, char *output, size_t size);
+
+#endif
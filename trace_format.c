@@ -0,0 +1,108 @@
+#include "trace.h"
+#include "mip.h"
+
+#include <stdio.h>
+
+/**
+ * Name a MIP type, for a trace line.
+ * Input:
+ *      type - The transport, routing and ARP bits, see enum mip_type.
+ * Return:
+ *      The name, or "unknown".
+ */
+const char *trace_mip_type_name(uint32_t type) {
+    switch (type) {
+        case MIP_ARP_RESPONSE: return "arp-response";
+        case MIP_ARP_REQUEST: return "arp-request";
+        case MIP_ROUTING: return "routing";
+        case MIP_DATA: return "data";
+        case MIP_FRAGMENT: return "fragment";
+        default: return "unknown";
+    }
+}
+
+/**
+ * Format a trace event as a single line of text. Shared by the daemon, in debug mode, and the trace decoder.
+ * Input:
+ *      event - The event.
+ *      output - Where to write the line, without a newline.
+ *      size - Size of output.
+ * Return:
+ *      The length of the line, as snprintf.
+ */
+size_t trace_format(const struct trace_event *event, char *output, size_t size) {
+    int n = snprintf(
+        output, size, "%llu.%09llu ",
+        (unsigned long long)(event->time / 1000000000ULL),
+        (unsigned long long)(event->time % 1000000000ULL)
+    );
+    if (n < 0 || (size_t)n >= size) {
+        return n < 0 ? 0 : n;
+    }
+    char *line = output + n;
+    size_t left = size - n;
+
+    switch (event->type) {
+        case TRACE_FRAME_RX:
+            n += snprintf(
+                line, left, "rx %s %u -> %u, %u bytes, socket %u",
+                trace_mip_type_name(event->arg), event->source, event->destination, event->length, event->object
+            );
+            break;
+        case TRACE_FRAME_TX:
+            n += snprintf(
+                line, left, "tx %s %u -> %u, %u bytes, socket %u",
+                trace_mip_type_name(event->arg), event->source, event->destination, event->length, event->object
+            );
+            break;
+        case TRACE_ARP_START:
+            n += snprintf(line, left, "arp started for %u", event->destination);
+            break;
+        case TRACE_ARP_RESOLVED:
+            n += snprintf(line, left, "arp resolved %u, socket %u", event->source, event->object);
+            break;
+        case TRACE_ARP_TIMEOUT:
+            n += snprintf(line, left, "arp for %u timed out, session %u", event->destination, event->object);
+            break;
+        case TRACE_DATA_TIMEOUT:
+            n += snprintf(line, left, "response from %u timed out, session %u", event->destination, event->object);
+            break;
+        case TRACE_SESSION_OPEN:
+            n += snprintf(line, left, "session %u connected", event->object);
+            break;
+        case TRACE_SESSION_CLOSE:
+            n += snprintf(line, left, "session %u disconnected", event->object);
+            break;
+        case TRACE_SESSION_MSG:
+            n += snprintf(
+                line, left, "session %u to %u, info %u, %u bytes",
+                event->object, event->destination, event->arg, event->length
+            );
+            break;
+        case TRACE_DELIVER:
+            n += snprintf(
+                line, left, "deliver from %u to session %u, request %u, %u bytes",
+                event->source, event->object, event->arg, event->length
+            );
+            break;
+        case TRACE_DROP:
+            n += snprintf(line, left, "drop, reason %u", event->arg);
+            break;
+        case TRACE_ROUTE:
+            n += snprintf(
+                line, left, "route to %u via %u, cost %u, socket %u",
+                event->destination, event->source, event->arg, event->object
+            );
+            break;
+        case TRACE_FORWARD:
+            n += snprintf(
+                line, left, "forward %u -> %u, %u bytes, ttl %u, socket %u",
+                event->source, event->destination, event->length, event->arg, event->object
+            );
+            break;
+        default:
+            n += snprintf(line, left, "unknown event %u", event->type);
+            break;
+    }
+    return n;
+}
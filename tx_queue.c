@@ -0,0 +1,287 @@
+#include "tx_queue.h"
+
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Get a slot in the transmit ring.
+ * Input:
+ *      q - The queue with the ring.
+ *      slot - The slot number.
+ * Return:
+ *      A pointer to the header of the slot.
+ */
+struct tpacket2_hdr *tx_ring_slot(struct tx_queue *q, unsigned int slot) {
+    return (struct tpacket2_hdr *)(q->map + (size_t)slot * TX_RING_FRAME_SIZE);
+}
+
+/**
+ * Prepare an empty transmit queue for a socket. Frames are sent by the sender until a ring is set up.
+ * Input:
+ *      q - The queue to prepare.
+ *      sock - The socket to send frames on.
+ *      sender - Function sending a batch of frames, or NULL for sendmmsg().
+ */
+void tx_queue_init(struct tx_queue *q, int sock, tx_queue_sender sender) {
+    memset(q, 0, sizeof(struct tx_queue));
+    q->sock = sock;
+    q->sender = sender ? sender : tx_queue_sendmmsg;
+    q->ringSock = -1;
+
+    int i;
+    for (i = 0; i < TX_QUEUE_SIZE; i++) {
+        q->msgs[i].msg_hdr.msg_iov = q->iovs[i];
+    }
+}
+
+/**
+ * Send frames through a PACKET_TX_RING instead of sendmmsg(). The ring is attached to a second socket
+ * for the same interface, so it does not interfere with the receive side of the original socket.
+ * Input:
+ *      q - The queue to set up the ring for.
+ *      ifindex - The index of the interface to send on.
+ * Return:
+ *      0 if successful, -1 if the ring is unavailable. The queue keeps using sendmmsg() then.
+ */
+int tx_queue_setup_ring(struct tx_queue *q, int ifindex) {
+    // Protocol 0, so the socket never receives anything.
+    int sock = socket(AF_PACKET, SOCK_RAW, 0);
+    if (sock == -1) {
+        perror("tx_queue_setup_ring: socket()");
+        return -1;
+    }
+
+    int version = TPACKET_V2;
+    if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        perror("tx_queue_setup_ring: setsockopt(PACKET_VERSION)");
+        close(sock);
+        return -1;
+    }
+
+    struct tpacket_req req = {0};
+    req.tp_block_size = TX_RING_BLOCK_SIZE;
+    req.tp_block_nr = TX_RING_BLOCK_COUNT;
+    req.tp_frame_size = TX_RING_FRAME_SIZE;
+    req.tp_frame_nr = TX_QUEUE_SIZE;
+    if (setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+        perror("tx_queue_setup_ring: setsockopt(PACKET_TX_RING)");
+        close(sock);
+        return -1;
+    }
+
+    struct sockaddr_ll sockaddr_net = {0};
+    sockaddr_net.sll_family = AF_PACKET;
+    sockaddr_net.sll_protocol = 0;
+    sockaddr_net.sll_ifindex = ifindex;
+    if (bind(sock, (struct sockaddr *)&sockaddr_net, sizeof(sockaddr_net)) == -1) {
+        perror("tx_queue_setup_ring: bind()");
+        close(sock);
+        return -1;
+    }
+
+    q->mapLength = (size_t)TX_RING_BLOCK_SIZE * TX_RING_BLOCK_COUNT;
+    q->map = mmap(NULL, q->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+    if (q->map == MAP_FAILED) {
+        perror("tx_queue_setup_ring: mmap()");
+        q->map = NULL;
+        close(sock);
+        return -1;
+    }
+
+    q->ringSock = sock;
+    q->head = 0;
+    return 0;
+}
+
+/**
+ * Get a buffer to build the next frame in. The frame is queued by tx_queue_commit().
+ * Input:
+ *      q - The queue.
+ * Return:
+ *      A pointer to a buffer of at least TX_QUEUE_FRAME_SIZE bytes.
+ */
+char *tx_queue_reserve(struct tx_queue *q) {
+    if (q->count == TX_QUEUE_SIZE) {
+        tx_queue_flush(q);
+    }
+
+    if (q->ringSock == -1) {
+        return q->frames[q->count];
+    }
+
+    struct tpacket2_hdr *hdr = tx_ring_slot(q, q->head);
+    while (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        // The kernel is still sending from this slot, kick it and wait for it to finish.
+        tx_queue_flush(q);
+    }
+    return (char *)hdr + TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+}
+
+/**
+ * Queue the frame built in the buffer from the last tx_queue_reserve().
+ * Input:
+ *      q - The queue.
+ *      length - The length of the frame.
+ */
+void tx_queue_commit(struct tx_queue *q, size_t length) {
+    if (q->ringSock == -1) {
+        q->iovs[q->count][0].iov_base = q->frames[q->count];
+        q->iovs[q->count][0].iov_len = length;
+        q->msgs[q->count].msg_hdr.msg_iovlen = 1;
+        q->buffers[q->count] = NULL;
+    } else {
+        struct tpacket2_hdr *hdr = tx_ring_slot(q, q->head);
+        hdr->tp_len = length;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        q->head = (q->head + 1) % TX_QUEUE_SIZE;
+    }
+    q->count++;
+    q->sentFrames++;
+    q->sentBytes += length;
+}
+
+/**
+ * Copy a complete frame into the queue.
+ * Input:
+ *      q - The queue.
+ *      frame - The frame, including the ethernet header.
+ *      length - The length of the frame. At most TX_QUEUE_FRAME_SIZE.
+ */
+void tx_queue_push(struct tx_queue *q, char *frame, size_t length) {
+    memcpy(tx_queue_reserve(q), frame, length);
+    tx_queue_commit(q, length);
+}
+
+/**
+ * Queue a frame made of its headers and a payload in a frame buffer. With sendmmsg(), only the headers are
+ * copied, and the payload is sent straight from the buffer, which is referenced until the frame is sent.
+ * A transmit ring needs the frame in its slot, so both parts are copied there instead.
+ * Input:
+ *      q - The queue.
+ *      header - The ethernet and MIP headers.
+ *      headerLength - Length of the headers. At most TX_QUEUE_HEADER_SIZE.
+ *      buffer - The buffer holding the payload.
+ *      payload - The payload, inside the buffer.
+ *      length - Length of the payload, including any padding.
+ */
+void tx_queue_push_gather(
+    struct tx_queue *q,
+    char *header,
+    size_t headerLength,
+    struct frame_buffer *buffer,
+    char *payload,
+    size_t length
+) {
+    if (q->ringSock != -1) {
+        char *frame = tx_queue_reserve(q);
+        memcpy(frame, header, headerLength);
+        memcpy(frame + headerLength, payload, length);
+        tx_queue_commit(q, headerLength + length);
+        return;
+    }
+
+    if (q->count == TX_QUEUE_SIZE) {
+        tx_queue_flush(q);
+    }
+    memcpy(q->headers[q->count], header, headerLength);
+    q->iovs[q->count][0].iov_base = q->headers[q->count];
+    q->iovs[q->count][0].iov_len = headerLength;
+    q->iovs[q->count][1].iov_base = payload;
+    q->iovs[q->count][1].iov_len = length;
+    q->msgs[q->count].msg_hdr.msg_iovlen = 2;
+    q->buffers[q->count] = frame_ref(buffer);
+    q->count++;
+    q->sentFrames++;
+    q->sentBytes += headerLength + length;
+}
+
+/**
+ * Send a batch of frames on a socket with as few sendmmsg() calls as possible.
+ * Input:
+ *      sock - The socket.
+ *      msgs - The frames, one per message.
+ *      count - Number of frames.
+ * Return:
+ *      The number of frames sent.
+ * Error:
+ *      Will end the program if the frames cannot be sent.
+ */
+int tx_queue_sendmmsg(int sock, struct mmsghdr *msgs, unsigned int count) {
+    unsigned int sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(sock, &msgs[sent], count - sent, 0);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("tx_queue_sendmmsg: sendmmsg()");
+            exit(EXIT_FAILURE);
+        }
+        sent += result;
+    }
+    return sent;
+}
+
+/**
+ * Send every queued frame.
+ * Input:
+ *      q - The queue.
+ * Return:
+ *      The number of frames sent.
+ * Error:
+ *      Will end the program if the frames cannot be sent.
+ */
+int tx_queue_flush(struct tx_queue *q) {
+    int sent = 0;
+
+    if (q->ringSock != -1) {
+        // A blocking send() makes the kernel send every requested slot before returning.
+        if (send(q->ringSock, NULL, 0, 0) == -1) {
+            perror("tx_queue_flush: send()");
+            exit(EXIT_FAILURE);
+        }
+        sent = q->count;
+        q->count = 0;
+        return sent;
+    }
+
+    sent = q->sender(q->sock, q->msgs, q->count);
+    tx_queue_done(q);
+    return sent;
+}
+
+/**
+ * Empty a queue once every frame in it has been sent, by tx_queue_flush() or by the caller.
+ * Input:
+ *      q - The queue. Must not use a transmit ring.
+ */
+void tx_queue_done(struct tx_queue *q) {
+    // The kernel has its own copy of every payload now.
+    int i;
+    for (i = 0; i < q->count; i++) {
+        if (q->buffers[i]) {
+            frame_unref(q->buffers[i]);
+            q->buffers[i] = NULL;
+        }
+    }
+    q->count = 0;
+}
+
+/**
+ * Send everything left in a queue and release its ring, if any.
+ * Input:
+ *      q - The queue.
+ */
+void tx_queue_close(struct tx_queue *q) {
+    tx_queue_flush(q);
+    if (q->ringSock != -1) {
+        munmap(q->map, q->mapLength);
+        close(q->ringSock);
+        q->ringSock = -1;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef _tx_queue_h
+#define _tx_queue_h
+
+#include "ethernet.h"
+#include "frame_pool.h"
+#include "mip.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Max number of frames queued before the queue is flushed.
+ */
+#define TX_QUEUE_SIZE 64
+
+/**
+ * Max size of a single queued frame, including the ethernet header.
+ */
+#define TX_QUEUE_FRAME_SIZE (MAX_PACKET_SIZE + sizeof(struct ethernet_frame))
+
+/**
+ * Max size of the headers in front of a payload sent by reference.
+ */
+#define TX_QUEUE_HEADER_SIZE (sizeof(struct ethernet_frame) + MIP_HEADER_SIZE)
+
+/**
+ * Size of a single frame slot in the transmit ring.
+ */
+#define TX_RING_FRAME_SIZE 2048
+
+/**
+ * Size of a single block in the transmit ring. Must be a multiple of the page size.
+ */
+#define TX_RING_BLOCK_SIZE (1 << 16)
+
+/**
+ * Number of blocks in the transmit ring.
+ */
+#define TX_RING_BLOCK_COUNT ((TX_QUEUE_SIZE * TX_RING_FRAME_SIZE) / TX_RING_BLOCK_SIZE)
+
+/**
+ * Function sending a batch of frames on a link, for links that cannot use sendmmsg().
+ * Input:
+ *      sock - The file descriptor of the link.
+ *      msgs - The frames, one per message.
+ *      count - Number of frames.
+ * Return:
+ *      The number of frames sent. Every frame must be sent, or dropped, before returning.
+ */
+typedef int (*tx_queue_sender)(int sock, struct mmsghdr *msgs, unsigned int count);
+
+/**
+ * Outbound frames for a single packet socket, collected so they can be sent with a single syscall.
+ */
+struct tx_queue {
+    int sock; // The socket to send the frames on.
+    tx_queue_sender sender; // Function sending the frames, tx_queue_sendmmsg() for sockets.
+    int count; // Number of frames queued.
+    uint64_t sentFrames; // Number of frames queued since the queue was created, for the statistics.
+    uint64_t sentBytes; // Number of bytes in those frames.
+
+    // Used with sendmmsg(). A frame is either copied whole into frames, or sent as two iovecs: its headers
+    // in headers, and its payload straight from a referenced frame buffer.
+    struct mmsghdr msgs[TX_QUEUE_SIZE];
+    struct iovec iovs[TX_QUEUE_SIZE][2];
+    char frames[TX_QUEUE_SIZE][TX_QUEUE_FRAME_SIZE];
+    char headers[TX_QUEUE_SIZE][TX_QUEUE_HEADER_SIZE];
+    struct frame_buffer *buffers[TX_QUEUE_SIZE]; // Buffer referenced by each frame, or NULL.
+
+    // Used with a transmit ring, if ringSock is not -1.
+    int ringSock; // A second socket for the interface, with the ring attached.
+    uint8_t *map; // The memory mapped ring.
+    size_t mapLength; // Size of the memory map.
+    unsigned int head; // The next slot to fill.
+};
+
+void tx_queue_init(struct tx_queue *q, int sock, tx_queue_sender sender);
+int tx_queue_sendmmsg(int sock, struct mmsghdr *msgs, unsigned int count);
+int tx_queue_setup_ring(struct tx_queue *q, int ifindex);
+
+char *tx_queue_reserve(struct tx_queue *q);
+void tx_queue_commit(struct tx_queue *q, size_t length);
+void tx_queue_push(struct tx_queue *q, char *frame, size_t length);
+void tx_queue_push_gather(
+    struct tx_queue *q,
+    char *header,
+    size_t headerLength,
+    struct frame_buffer *buffer,
+    char *payload,
+    size_t length);
+int tx_queue_flush(struct tx_queue *q);
+void tx_queue_done(struct tx_queue *q);
+
+void tx_queue_close(struct tx_queue *q);
+
+#endif
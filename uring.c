@@ -0,0 +1,323 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Set up an io_uring instance and its receive buffers.
+ * Input:
+ *      ring - Where to store the instance.
+ * Return:
+ *      0 if successful, -1 if io_uring, or a feature we need, is unavailable. Nothing is left open then.
+ */
+int uring_init(struct uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+    ring->fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+    if (ring->fd == -1) {
+        perror("uring_init: io_uring_setup()");
+        return -1;
+    }
+    // Both queues in a single map, and no completions dropped when the queue overflows.
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        fprintf(stderr, "uring_init: io_uring lacks the features needed.\n");
+        close(ring->fd);
+        return -1;
+    }
+
+    size_t sqLength = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cqLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqMapLength = sqLength > cqLength ? sqLength : cqLength;
+    ring->sqMap = mmap(
+        NULL, ring->sqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING
+    );
+    if (ring->sqMap == MAP_FAILED) {
+        perror("uring_init: mmap()");
+        close(ring->fd);
+        return -1;
+    }
+    ring->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(
+        NULL, ring->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES
+    );
+    if (ring->sqes == MAP_FAILED) {
+        perror("uring_init: mmap()");
+        munmap(ring->sqMap, ring->sqMapLength);
+        close(ring->fd);
+        return -1;
+    }
+
+    char *map = ring->sqMap;
+    ring->sqHead = (unsigned int *)(map + params.sq_off.head);
+    ring->sqTail = (unsigned int *)(map + params.sq_off.tail);
+    ring->sqMask = *(unsigned int *)(map + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned int *)(map + params.sq_off.ring_entries);
+    ring->cqHead = (unsigned int *)(map + params.cq_off.head);
+    ring->cqTail = (unsigned int *)(map + params.cq_off.tail);
+    ring->cqMask = *(unsigned int *)(map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(map + params.cq_off.cqes);
+
+    // Entries are always used in order, so the array never changes.
+    unsigned int *array = (unsigned int *)(map + params.sq_off.array);
+    unsigned int i;
+    for (i = 0; i < ring->sqEntries; i++) {
+        array[i] = i;
+    }
+    ring->sqLocalTail = *ring->sqTail;
+    ring->sqSubmitted = ring->sqLocalTail;
+
+    // The buffers, and the ring the kernel picks them from.
+    ring->bufRingLength = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    ring->bufRing = mmap(NULL, ring->bufRingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffers = malloc(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (ring->bufRing == MAP_FAILED || !ring->buffers) {
+        perror("uring_init: mmap()");
+        if (ring->bufRing == MAP_FAILED) {
+            ring->bufRing = NULL;
+        }
+        uring_close(ring);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        perror("uring_init: io_uring_register()");
+        uring_close(ring);
+        return -1;
+    }
+
+    for (i = 0; i < URING_BUFFER_COUNT; i++) {
+        struct io_uring_buf *buf = &ring->bufRing->bufs[i];
+        buf->addr = (uint64_t)(uintptr_t)(ring->buffers + i * URING_BUFFER_SIZE);
+        buf->len = URING_BUFFER_SIZE;
+        buf->bid = i;
+    }
+    ring->bufTail = URING_BUFFER_COUNT;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Close an io_uring instance, cancelling everything still running.
+ * Input:
+ *      ring - The instance.
+ */
+void uring_close(struct uring *ring) {
+    close(ring->fd);
+    munmap(ring->sqes, ring->sqesLength);
+    munmap(ring->sqMap, ring->sqMapLength);
+    if (ring->bufRing) {
+        munmap(ring->bufRing, ring->bufRingLength);
+    }
+    free(ring->buffers);
+    ring->bufRing = NULL;
+    ring->buffers = NULL;
+}
+
+/**
+ * Get the next free submission queue entry, cleared. Entries are handed to the kernel by uring_submit().
+ * Input:
+ *      ring - The instance.
+ * Return:
+ *      The entry. If the queue is full, it is submitted first.
+ * Error:
+ *      Exits if the queue cannot be submitted.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    while (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries) {
+        if (uring_submit(ring, 0) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqLocalTail & ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+/**
+ * Hand the prepared entries to the kernel, and optionally wait for completions.
+ * Input:
+ *      ring - The instance.
+ *      wait - Number of completions to wait for, or 0 to return at once.
+ * Return:
+ *      0 if successful or interrupted, -1 on errors.
+ */
+int uring_submit(struct uring *ring, unsigned int wait) {
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned int count = ring->sqLocalTail - ring->sqSubmitted;
+    int ret = syscall(__NR_io_uring_enter, ring->fd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return 0;
+        }
+        perror("uring_submit: io_uring_enter()");
+        return -1;
+    }
+    ring->sqSubmitted += ret;
+    return 0;
+}
+
+/**
+ * Take the completions waiting, without blocking.
+ * Input:
+ *      ring - The instance.
+ *      cqes - Where to copy them.
+ *      max - Max number of completions to take.
+ * Return:
+ *      The number of completions taken.
+ */
+unsigned int uring_reap(struct uring *ring, struct io_uring_cqe *cqes, unsigned int max) {
+    unsigned int head = *ring->cqHead;
+    unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    unsigned int count = 0;
+    while (head != tail && count < max) {
+        cqes[count++] = ring->cqes[head & ring->cqMask];
+        head++;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+/**
+ * Watch a file descriptor until cancelled, with a completion every time it becomes readable.
+ * Input:
+ *      ring - The instance.
+ *      fd - The file descriptor.
+ *      userData - Returned with every completion.
+ */
+void uring_poll_multishot(struct uring *ring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = userData;
+}
+
+/**
+ * Watch a file descriptor for a single completion, once it has room to write to.
+ * Input:
+ *      ring - The instance.
+ *      fd - The file descriptor.
+ *      userData - Returned with the completion.
+ */
+void uring_poll_writable(struct uring *ring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = userData;
+}
+
+/**
+ * Receive from a socket until cancelled, with a completion for every datagram, each in a receive buffer.
+ * Input:
+ *      ring - The instance.
+ *      fd - The socket.
+ *      userData - Returned with every completion.
+ */
+void uring_recv_multishot(struct uring *ring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = userData;
+}
+
+/**
+ * Accept connections on a listening socket until cancelled, with a completion for every connection.
+ * The new sockets are non-blocking.
+ * Input:
+ *      ring - The instance.
+ *      fd - The socket.
+ *      userData - Returned with every completion.
+ */
+void uring_accept_multishot(struct uring *ring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = userData;
+}
+
+/**
+ * Send a message. It, and everything it points to, must stay untouched until the completion.
+ * Input:
+ *      ring - The instance.
+ *      fd - The socket.
+ *      message - The message.
+ *      userData - Returned with the completion.
+ */
+void uring_sendmsg(struct uring *ring, int fd, struct msghdr *message, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)message;
+    sqe->len = 1;
+    sqe->user_data = userData;
+}
+
+/**
+ * Cancel every request with the given user data, such as multishot requests on a file descriptor about to be closed.
+ * Input:
+ *      ring - The instance.
+ *      target - The user data of the requests.
+ *      userData - Returned with the completion of the cancel itself.
+ */
+void uring_cancel(struct uring *ring, uint64_t target, uint64_t userData) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = userData;
+}
+
+/**
+ * Get the receive buffer a completion filled.
+ * Input:
+ *      ring - The instance.
+ *      cqe - The completion. Must have IORING_CQE_F_BUFFER set.
+ * Return:
+ *      The buffer. Hand it back with uring_recycle() once done with it.
+ */
+char *uring_buffer(struct uring *ring, struct io_uring_cqe *cqe) {
+    return ring->buffers + (cqe->flags >> IORING_CQE_BUFFER_SHIFT) * URING_BUFFER_SIZE;
+}
+
+/**
+ * Hand the receive buffer of a completion back to the kernel.
+ * Input:
+ *      ring - The instance.
+ *      cqe - The completion. Nothing is done unless IORING_CQE_F_BUFFER is set.
+ */
+void uring_recycle(struct uring *ring, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+    unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct io_uring_buf *buf = &ring->bufRing->bufs[ring->bufTail & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->buffers + bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,79 @@
+#ifndef _uring_h
+#define _uring_h
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Number of entries in the submission queue.
+ */
+#define URING_SQ_ENTRIES 1024
+
+/**
+ * Number of entries in the completion queue.
+ */
+#define URING_CQ_ENTRIES 8192
+
+/**
+ * Number of buffers frames are received into, and the size of each.
+ */
+#define URING_BUFFER_COUNT 256
+#define URING_BUFFER_SIZE 2048
+
+/**
+ * Buffer group of the receive buffers.
+ */
+#define URING_BUFFER_GROUP 0
+
+/**
+ * An io_uring instance, driven through the raw system calls, with a ring of buffers registered with the kernel
+ * that multishot receives pick their buffers from.
+ */
+struct uring {
+    int fd; // The io_uring file descriptor.
+
+    // Submission queue, shared with the kernel.
+    void *sqMap; // The memory map holding both queues.
+    size_t sqMapLength;
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int sqMask;
+    unsigned int sqEntries;
+    struct io_uring_sqe *sqes;
+    size_t sqesLength;
+    unsigned int sqLocalTail; // Tail including the entries not yet handed to the kernel.
+    unsigned int sqSubmitted; // Tail as far as the kernel has consumed it.
+
+    // Completion queue, in the same memory map.
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int cqMask;
+    struct io_uring_cqe *cqes;
+
+    // Receive buffers, and the ring handing them to the kernel.
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingLength;
+    char *buffers; // URING_BUFFER_COUNT buffers of URING_BUFFER_SIZE.
+    uint16_t bufTail;
+};
+
+int uring_init(struct uring *ring);
+void uring_close(struct uring *ring);
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+int uring_submit(struct uring *ring, unsigned int wait);
+unsigned int uring_reap(struct uring *ring, struct io_uring_cqe *cqes, unsigned int max);
+
+void uring_poll_multishot(struct uring *ring, int fd, uint64_t userData);
+void uring_poll_writable(struct uring *ring, int fd, uint64_t userData);
+void uring_recv_multishot(struct uring *ring, int fd, uint64_t userData);
+void uring_accept_multishot(struct uring *ring, int fd, uint64_t userData);
+void uring_sendmsg(struct uring *ring, int fd, struct msghdr *message, uint64_t userData);
+void uring_cancel(struct uring *ring, uint64_t target, uint64_t userData);
+
+char *uring_buffer(struct uring *ring, struct io_uring_cqe *cqe);
+void uring_recycle(struct uring *ring, struct io_uring_cqe *cqe);
+
+#endif
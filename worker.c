@@ -0,0 +1,309 @@
+#include "worker.h"
+#include "link.h"
+#include "ethernet.h"
+#include "filter.h"
+#include "mip.h"
+#include "interface.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Store the worker running on the current thread, for the frame handler.
+ */
+static __thread struct worker *currentWorker;
+
+/**
+ * Get the fanout group of an interface. Every worker joins the same group for the same interface, and
+ * the process id keeps the groups of several daemons in the same namespace apart.
+ * Input:
+ *      ifindex - The index of the interface.
+ * Return:
+ *      The group id.
+ */
+int worker_fanout_group(int ifindex) {
+    return (getpid() * 31 + ifindex) & 0xFFFF;
+}
+
+/**
+ * Open a socket for a worker on an interface, and add it to the fanout group of the interface.
+ * Input:
+ *      ws - The socket to set up. The interface must be set.
+ *      fanout - How the kernel spreads the frames over the group.
+ *      localAddresses - Our MIP addresses, for the socket filter.
+ *      addressCount - Number of addresses the filter should accept, or 0 to accept every destination.
+ *      useRing - Whether to read frames through a memory mapped ring.
+ * Return:
+ *      0 if successful, -1 if the socket could not join the fanout group.
+ * Error:
+ *      Will end the program if the socket cannot be created.
+ */
+int worker_open_socket(
+    struct worker_socket *ws,
+    enum worker_fanout fanout,
+    char *localAddresses,
+    int addressCount,
+    char useRing
+) {
+    // Protocol 0 until bound, so nothing is received before the filter is in place.
+    ws->sock = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, 0);
+    if (ws->sock == -1) {
+        perror("worker_open_socket: socket()");
+        exit(EXIT_FAILURE);
+    }
+
+    ws->ring = NULL;
+    if (useRing) {
+        ws->ring = calloc(1, sizeof(struct rx_ring));
+        if (rx_ring_setup(ws->ring, ws->sock) == -1) {
+            free(ws->ring);
+            ws->ring = NULL;
+        }
+    }
+
+    // Without the filter every frame reaches the worker, and is checked in worker_frame() instead. interfaceLocal
+    // is complete before the workers start, and only read by them.
+    filter_attach(ws->sock, localAddresses, addressCount);
+
+    struct sockaddr_ll sockaddr_net = {0};
+    sockaddr_net.sll_family = AF_PACKET;
+    sockaddr_net.sll_protocol = htons(ETH_P_MIP);
+    sockaddr_net.sll_ifindex = if_nametoindex(ws->interface->name);
+    if (bind(ws->sock, (struct sockaddr *)&sockaddr_net, sizeof(sockaddr_net)) == -1) {
+        perror("worker_open_socket: bind()");
+        exit(EXIT_FAILURE);
+    }
+
+    // Must come after bind(), since the group is tied to the interface and protocol.
+    int mode = fanout == FANOUT_CPU ? PACKET_FANOUT_CPU : PACKET_FANOUT_HASH;
+    int arg = worker_fanout_group(sockaddr_net.sll_ifindex) | (mode << 16);
+    if (setsockopt(ws->sock, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == -1) {
+        perror("worker_open_socket: setsockopt(PACKET_FANOUT)");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Check a frame read by the current worker, and queue it for the dispatch thread.
+ * Input:
+ *      sock - The socket of the worker the frame arrived on.
+ *      frame - The frame, starting at the ethernet header.
+ *      length - Length of the frame.
+ */
+void worker_frame(int sock, char *frame, size_t length) {
+    struct worker *w = currentWorker;
+
+    if (length < sizeof(struct ethernet_frame) + 4 || length > RX_BATCH_FRAME_SIZE) {
+        return;
+    }
+    struct mip_header header;
+    mip_decode(((struct ethernet_frame *)frame)->msg, &header);
+    if (header.length > length - sizeof(struct ethernet_frame) - 4) { // Truncated.
+        return;
+    }
+
+    struct worker_socket *ws = NULL;
+    int i;
+    for (i = 0; i < w->socketCount; i++) {
+        if (w->sockets[i].sock == sock) {
+            ws = &w->sockets[i];
+            break;
+        }
+    }
+    if (!ws) {
+        return;
+    }
+
+    // Data frames for an address that is not ours are only used if sent to us, to be forwarded, so don't spend
+    // the dispatch thread on the others. Ours are delivered whichever interface they arrive on.
+    struct ethernet_frame *ethFrame = (struct ethernet_frame *)frame;
+    if (
+        (header.type == MIP_DATA || header.type == MIP_FRAGMENT)
+        && !interface_is_local(header.destination)
+        && memcmp(ethFrame->destination, ws->interface->mac, 6)
+    ) {
+        return;
+    }
+
+    struct worker_item *item = spsc_reserve(&w->queue);
+    if (!item) {
+        w->dropped++;
+        return;
+    }
+    item->sock = ws->interface->sock;
+    item->length = length;
+    memcpy(item->frame, frame, length);
+    spsc_push(&w->queue);
+    w->queued = 1;
+}
+
+/**
+ * Main loop of a worker thread. Reads frames from every socket of the worker, and wakes the dispatch
+ * thread once per batch.
+ * Input:
+ *      arg - The worker.
+ * Return:
+ *      Never returns, the thread is cancelled by worker_stop().
+ */
+void *worker_run(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    currentWorker = w;
+
+    while (1) {
+        int nfds = epoll_wait(w->epoll_fd, events, MAX_EVENTS, -1);
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("worker_run: epoll_wait()");
+            exit(EXIT_FAILURE);
+        }
+
+        int n;
+        for (n = 0; n < nfds; n++) {
+            struct worker_socket *ws = &w->sockets[events[n].data.u32];
+            if (ws->ring) {
+                rx_ring_read(ws->ring, worker_frame);
+            } else {
+                rx_batch_read(w->batch, ws->sock, worker_frame);
+            }
+        }
+
+        if (w->queued) {
+            uint64_t one = 1;
+            if (write(w->notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+                perror("worker_run: write()");
+                exit(EXIT_FAILURE);
+            }
+            w->queued = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Open the sockets of a worker on every interface, and start its thread.
+ * Input:
+ *      w - The worker to start.
+ *      interfaces - The interfaces to receive on. Must not change while the worker runs.
+ *      fanout - How the kernel spreads the frames of an interface over the workers.
+ *      notifyFd - Eventfd to write when frames have been queued.
+ *      localAddresses - Our MIP addresses, for the socket filter.
+ *      addressCount - Number of addresses the filter should accept, or 0 to accept every destination.
+ *      useRing - Whether to read frames through memory mapped rings.
+ * Return:
+ *      0 if successful, -1 if a socket could not join its fanout group.
+ * Error:
+ *      Will end the program in case of other errors.
+ */
+int worker_start(
+    struct worker *w,
+    struct eth_interface *interfaces,
+    enum worker_fanout fanout,
+    int notifyFd,
+    char *localAddresses,
+    int addressCount,
+    char useRing
+) {
+    memset(w, 0, sizeof(struct worker));
+    w->notify_fd = notifyFd;
+
+    // Only links that can be shared through PACKET_FANOUT, the dispatch thread reads the others.
+    struct eth_interface *tmp_interface;
+    for (tmp_interface = interfaces; tmp_interface; tmp_interface = tmp_interface->next) {
+        if (tmp_interface->link->fanout) {
+            w->socketCount++;
+        }
+    }
+    w->sockets = calloc(w->socketCount ? w->socketCount : 1, sizeof(struct worker_socket));
+    w->batch = malloc(sizeof(struct rx_batch));
+    if (!w->sockets || !w->batch || spsc_init(&w->queue, WORKER_QUEUE_SIZE, sizeof(struct worker_item)) == -1) {
+        perror("worker_start: malloc()");
+        exit(EXIT_FAILURE);
+    }
+    rx_batch_init(w->batch);
+
+    w->epoll_fd = epoll_create(10);
+    if (w->epoll_fd == -1) {
+        perror("worker_start: epoll_create()");
+        exit(EXIT_FAILURE);
+    }
+
+    int i = 0;
+    for (tmp_interface = interfaces; tmp_interface; tmp_interface = tmp_interface->next) {
+        if (!tmp_interface->link->fanout) {
+            continue;
+        }
+        w->sockets[i].interface = tmp_interface;
+        if (worker_open_socket(&w->sockets[i], fanout, localAddresses, addressCount, useRing) == -1) {
+            return -1;
+        }
+
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->sockets[i].sock, &ev) == -1) {
+            perror("worker_start: epoll_ctl()");
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+
+    int error = pthread_create(&w->thread, NULL, worker_run, w);
+    if (error) {
+        errno = error;
+        perror("worker_start: pthread_create()");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+/**
+ * Dispatch thread: Handle every frame a worker has queued.
+ * Input:
+ *      w - The worker.
+ *      handler - Function called for each frame, with the socket of the interface in the dispatch thread.
+ * Return:
+ *      The number of frames handled.
+ */
+int worker_drain(struct worker *w, rx_ring_handler handler) {
+    int frames = 0;
+    struct worker_item *item;
+    while ((item = spsc_peek(&w->queue))) {
+        handler(item->sock, item->frame, item->length);
+        spsc_pop(&w->queue);
+        frames++;
+    }
+    return frames;
+}
+
+/**
+ * Stop the thread of a worker, and close its sockets.
+ * Input:
+ *      w - The worker.
+ */
+void worker_stop(struct worker *w) {
+    pthread_cancel(w->thread);
+    pthread_join(w->thread, NULL);
+
+    int i;
+    for (i = 0; i < w->socketCount; i++) {
+        if (w->sockets[i].ring) {
+            rx_ring_close(w->sockets[i].ring);
+            free(w->sockets[i].ring);
+        }
+        close(w->sockets[i].sock);
+    }
+    close(w->epoll_fd);
+    free(w->sockets);
+    free(w->batch);
+    spsc_free(&w->queue);
+}
@@ -0,0 +1,69 @@
+#ifndef _worker_h
+#define _worker_h
+
+#include "daemon.h"
+#include "rx_batch.h"
+#include "rx_ring.h"
+#include "spsc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * Number of frames that can wait in the queue from a single worker to the dispatch thread.
+ */
+#define WORKER_QUEUE_SIZE 1024
+
+/**
+ * How the kernel spreads the frames of an interface over the workers.
+ */
+enum worker_fanout {
+    FANOUT_HASH         = 0, // By flow hash, so every frame of a flow goes to the same worker.
+    FANOUT_CPU          = 1 // By the CPU the frame arrived on.
+};
+
+/**
+ * A frame handed from a worker to the dispatch thread. Already checked to be a complete MIP frame.
+ */
+struct worker_item {
+    int sock; // The socket of the interface in the dispatch thread, not the one of the worker.
+    uint16_t length; // Length of the frame.
+    char frame[RX_BATCH_FRAME_SIZE];
+};
+
+/**
+ * A socket of a worker, member of the fanout group of an interface.
+ */
+struct worker_socket {
+    int sock;
+    struct eth_interface *interface; // The interface the socket is bound to.
+    struct rx_ring *ring; // Receive ring for the socket, or NULL if frames are read with recvmmsg().
+};
+
+/**
+ * A receive thread, reading its share of the frames of every interface.
+ */
+struct worker {
+    pthread_t thread;
+    int epoll_fd; // Epoll of the sockets of the worker.
+    int notify_fd; // Eventfd written after a batch of frames has been queued.
+    int socketCount;
+    struct worker_socket *sockets;
+    struct rx_batch *batch; // Buffers for sockets without a receive ring.
+    struct spsc_ring queue; // Frames waiting for the dispatch thread. The worker is the producer.
+    char queued; // Whether frames were queued since the last notification. Worker only.
+    uint64_t dropped; // Number of frames dropped because the queue was full. Worker only.
+};
+
+int worker_start(
+    struct worker *w,
+    struct eth_interface *interfaces,
+    enum worker_fanout fanout,
+    int notifyFd,
+    char *localAddresses,
+    int addressCount,
+    char useRing);
+int worker_drain(struct worker *w, rx_ring_handler handler);
+void worker_stop(struct worker *w);
+
+#endif